@@ -0,0 +1,313 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "ArtifactDetectors.h"
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ARTIFACT_DETECTORS_SSE2 1
+#include <emmintrin.h>
+#else
+#define ARTIFACT_DETECTORS_SSE2 0
+#endif
+
+BlockStats::BlockStats()
+	: n(0)
+	, maxAbs(0)
+	, maxJump(0)
+	, meanSquare(0)
+	, lineLength(0)
+{}
+
+/********** detectors ************/
+
+ClipDetector::ClipDetector(float limit)
+	: limit(limit)
+{}
+
+bool ClipDetector::isArtifact(int slot, const BlockStats& stats)
+{
+	return stats.maxAbs >= limit;
+}
+
+StepDetector::StepDetector(float threshold, const std::atomic<float>* defaultThreshold)
+	: threshold(threshold)
+	, defaultThreshold(defaultThreshold)
+{}
+
+bool StepDetector::isArtifact(int slot, const BlockStats& stats)
+{
+	return stats.maxJump >= (threshold > 0 ? threshold : defaultThreshold->load());
+}
+
+RmsZScoreDetector::RmsZScoreDetector(float maxZ)
+	: maxZ(maxZ)
+{}
+
+void RmsZScoreDetector::reset(int nSlots)
+{
+	means.assign(nSlots, 0);
+	variances.assign(nSlots, 0);
+	counts.assign(nSlots, 0);
+}
+
+bool RmsZScoreDetector::isArtifact(int slot, const BlockStats& stats)
+{
+	double rms = std::sqrt(stats.meanSquare);
+	double& mean = means[slot];
+	double& variance = variances[slot];
+
+	if (counts[slot] >= WARMUP_BLOCKS && variance > 0 && (rms - mean) / std::sqrt(variance) > maxZ)
+	{
+		return true; // artifact blocks stay out of the running statistics
+	}
+
+	if (counts[slot] == 0)
+	{
+		mean = rms;
+	}
+	else
+	{
+		// exponentially weighted mean and variance
+		double delta = rms - mean;
+		mean += ALPHA * delta;
+		variance = (1 - ALPHA) * (variance + ALPHA * delta * delta);
+	}
+	counts[slot]++;
+	return false;
+}
+
+LineLengthDetector::LineLengthDetector(float threshold)
+	: threshold(threshold)
+{}
+
+bool LineLengthDetector::isArtifact(int slot, const BlockStats& stats)
+{
+	return stats.lineLength >= threshold;
+}
+
+/********** chains ************/
+
+ArtifactDetectors::ArtifactDetectors()
+	: defaultStep(3000)
+{
+	parse("step");
+}
+
+bool ArtifactDetectors::parse(const String& spec)
+{
+	std::vector<ChainSpec> newSpecs(1); // default chain first
+
+	StringArray chainTokens;
+	chainTokens.addTokens(spec, ";", "");
+	chainTokens.trim();
+	chainTokens.removeEmptyStrings();
+
+	for (const String& token : chainTokens)
+	{
+		ChainSpec chain;
+		if (token.containsChar(':'))
+		{
+			StringArray chanTokens;
+			chanTokens.addTokens(token.upToFirstOccurrenceOf(":", false, false), " ,", "");
+			chanTokens.removeEmptyStrings();
+
+			for (const String& chanToken : chanTokens)
+			{
+				// single channel or range "1-4"
+				String first = chanToken.upToFirstOccurrenceOf("-", false, false);
+				String last = chanToken.containsChar('-') ? chanToken.fromFirstOccurrenceOf("-", false, false) : first;
+				if (!first.containsOnly("0123456789") || !last.containsOnly("0123456789")
+					|| first.getIntValue() < 1 || last.getIntValue() < first.getIntValue())
+				{
+					return false;
+				}
+				for (int chan = first.getIntValue() - 1; chan < last.getIntValue(); chan++)
+				{
+					chain.channels.addIfNotAlreadyThere(chan);
+				}
+			}
+			if (chain.channels.isEmpty() || !parseChain(token.fromFirstOccurrenceOf(":", false, false), chain.detectors))
+			{
+				return false;
+			}
+			newSpecs.push_back(chain);
+		}
+		else if (!parseChain(token, newSpecs[0].detectors))
+		{
+			return false;
+		}
+	}
+
+	specs.swap(newSpecs);
+	return true;
+}
+
+bool ArtifactDetectors::parseChain(const String& text, std::vector<DetectorSpec>& chain)
+{
+	StringArray tokens;
+	tokens.addTokens(text, ",", "");
+	tokens.trim();
+	tokens.removeEmptyStrings();
+
+	for (const String& token : tokens)
+	{
+		DetectorSpec detector;
+		detector.type = token.upToFirstOccurrenceOf(" ", false, false).toLowerCase();
+		String value = token.fromFirstOccurrenceOf(" ", false, false).trim();
+		detector.value = value.getFloatValue();
+
+		bool needsValue = detector.type != "step";
+		if ((detector.type != "step" && detector.type != "clip" && detector.type != "rms" && detector.type != "line")
+			|| !value.containsOnly("0123456789.") || (needsValue && value.isEmpty())
+			|| (value.isNotEmpty() && detector.value <= 0))
+		{
+			return false;
+		}
+		chain.push_back(detector);
+	}
+	return true;
+}
+
+void ArtifactDetectors::build(const Array<int>& slotChannels)
+{
+	int nSlots = slotChannels.size();
+	detectors.clear();
+	slotChains.assign(nSlots, Array<ArtifactDetector*>());
+
+	for (int c = 0; c < int(specs.size()); c++)
+	{
+		// one set of detectors per chain, with state for every slot
+		Array<ArtifactDetector*> chain;
+		for (const DetectorSpec& spec : specs[c].detectors)
+		{
+			ArtifactDetector* detector;
+			if (spec.type == "clip")
+			{
+				detector = new ClipDetector(spec.value);
+			}
+			else if (spec.type == "rms")
+			{
+				detector = new RmsZScoreDetector(spec.value);
+			}
+			else if (spec.type == "line")
+			{
+				detector = new LineLengthDetector(spec.value);
+			}
+			else
+			{
+				detector = new StepDetector(spec.value, &defaultStep);
+			}
+			detector->reset(nSlots);
+			chain.add(detectors.add(detector));
+		}
+
+		// later chains override the default for their channels
+		for (int slot = 0; slot < nSlots; slot++)
+		{
+			if (c == 0 || specs[c].channels.contains(slotChannels[slot]))
+			{
+				slotChains[slot] = chain;
+			}
+		}
+	}
+}
+
+void ArtifactDetectors::setDefaultStep(float threshold)
+{
+	defaultStep = threshold;
+}
+
+BlockStats ArtifactDetectors::scan(const float* src, int n, float previous)
+{
+	BlockStats stats;
+	stats.n = n;
+	if (n <= 0)
+	{
+		return stats;
+	}
+
+	float firstJump = std::isnan(previous) ? 0 : std::abs(src[0] - previous);
+	float maxAbs = std::abs(src[0]);
+	float maxJump = firstJump;
+	float sumSquares = src[0] * src[0];
+	float sumJumps = firstJump;
+	int i = 1;
+
+#if ARTIFACT_DETECTORS_SSE2
+	// 4 samples at a time: 2 loads, sub, 2 abs, 2 max, mul, 2 add
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 maxAbs4 = _mm_setzero_ps();
+	__m128 maxJump4 = _mm_setzero_ps();
+	__m128 sumSquares4 = _mm_setzero_ps();
+	__m128 sumJumps4 = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(src + i);
+		__m128 jump = _mm_and_ps(_mm_sub_ps(x, _mm_loadu_ps(src + i - 1)), absMask);
+		maxAbs4 = _mm_max_ps(maxAbs4, _mm_and_ps(x, absMask));
+		maxJump4 = _mm_max_ps(maxJump4, jump);
+		sumSquares4 = _mm_add_ps(sumSquares4, _mm_mul_ps(x, x));
+		sumJumps4 = _mm_add_ps(sumJumps4, jump);
+	}
+
+	float lanes[4][4];
+	_mm_storeu_ps(lanes[0], maxAbs4);
+	_mm_storeu_ps(lanes[1], maxJump4);
+	_mm_storeu_ps(lanes[2], sumSquares4);
+	_mm_storeu_ps(lanes[3], sumJumps4);
+	for (int lane = 0; lane < 4; lane++)
+	{
+		maxAbs = jmax(maxAbs, lanes[0][lane]);
+		maxJump = jmax(maxJump, lanes[1][lane]);
+		sumSquares += lanes[2][lane];
+		sumJumps += lanes[3][lane];
+	}
+#endif
+
+	for (; i < n; i++)
+	{
+		float jump = std::abs(src[i] - src[i - 1]);
+		maxAbs = jmax(maxAbs, std::abs(src[i]));
+		maxJump = jmax(maxJump, jump);
+		sumSquares += src[i] * src[i];
+		sumJumps += jump;
+	}
+
+	stats.maxAbs = maxAbs;
+	stats.maxJump = maxJump;
+	stats.meanSquare = sumSquares / n;
+	stats.lineLength = sumJumps / n;
+	return stats;
+}
+
+bool ArtifactDetectors::isArtifact(int slot, const BlockStats& stats)
+{
+	bool artifact = false;
+	for (ArtifactDetector* detector : slotChains[slot])
+	{
+		artifact = detector->isArtifact(slot, stats) || artifact;
+	}
+	return artifact;
+}
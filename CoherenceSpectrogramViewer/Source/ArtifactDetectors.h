@@ -0,0 +1,176 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef ARTIFACT_DETECTORS_H_INCLUDED
+#define ARTIFACT_DETECTORS_H_INCLUDED
+
+/*
+
+Artifact Detectors - rules that decide whether a block of one channel is an artifact,
+chained per channel.
+
+Each block is scanned once (scan), in a single SIMD pass that gathers every statistic a
+detector can use. Detectors then only look at those statistics, so they cost a few
+operations per block and adding detectors adds nothing per sample.
+
+Cost budget: the scan does 2 loads and 8 vector operations per 4 samples (about 2.5
+operations per sample), which has to stay true as detectors are added: a new detector
+either uses the existing statistics or adds at most one vector operation to the scan.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <atomic>
+#include <vector>
+
+// Statistics of one block of one channel
+struct BlockStats
+{
+	BlockStats();
+
+	int n;
+	float maxAbs;      // largest |x|
+	float maxJump;     // largest |x[i] - x[i - 1]|, counting from the previous block's last sample
+	float meanSquare;  // mean of x^2
+	float lineLength;  // mean |x[i] - x[i - 1]|
+};
+
+class ArtifactDetector
+{
+public:
+	virtual ~ArtifactDetector() {}
+
+	// Size any per-slot state
+	virtual void reset(int nSlots) {}
+
+	// True if this block of the channel in slot is an artifact
+	virtual bool isArtifact(int slot, const BlockStats& stats) = 0;
+};
+
+// |x| at or above a limit (amplifier clipping)
+class ClipDetector : public ArtifactDetector
+{
+public:
+	ClipDetector(float limit);
+	bool isArtifact(int slot, const BlockStats& stats) override;
+
+private:
+	const float limit;
+};
+
+// Step between consecutive samples at or above a threshold. Without a threshold of its own
+// it follows the node's artifact threshold.
+class StepDetector : public ArtifactDetector
+{
+public:
+	StepDetector(float threshold, const std::atomic<float>* defaultThreshold);
+	bool isArtifact(int slot, const BlockStats& stats) override;
+
+private:
+	const float threshold; // <= 0 to use defaultThreshold
+	const std::atomic<float>* defaultThreshold;
+};
+
+// Block RMS more than maxZ standard deviations above its running mean. The running mean and
+// variance are exponential over clean blocks, and nothing is flagged until they've settled.
+class RmsZScoreDetector : public ArtifactDetector
+{
+public:
+	RmsZScoreDetector(float maxZ);
+	void reset(int nSlots) override;
+	bool isArtifact(int slot, const BlockStats& stats) override;
+
+private:
+	static const int WARMUP_BLOCKS = 20;
+	static constexpr double ALPHA = 0.05;
+
+	const float maxZ;
+	std::vector<double> means;
+	std::vector<double> variances;
+	std::vector<int> counts;
+};
+
+// Mean absolute step per sample (line length) at or above a threshold
+class LineLengthDetector : public ArtifactDetector
+{
+public:
+	LineLengthDetector(float threshold);
+	bool isArtifact(int slot, const BlockStats& stats) override;
+
+private:
+	const float threshold;
+};
+
+class ArtifactDetectors
+{
+public:
+	ArtifactDetectors();
+
+	// Read a spec of detector chains, with 1-based channel numbers:
+	//   "step, clip 5000"                    every channel: step at the artifact threshold, clipping at 5000
+	//   "step 3000; 1-4 9: clip 4000, rms 6"  channels 1-4 and 9 use their own chain
+	// Detectors: "step [uV]", "clip uV", "rms z", "line uV per sample". "" checks nothing.
+	// Returns false, leaving the detectors untouched, if the spec can't be read.
+	bool parse(const String& spec);
+
+	// Create the chain of each slot, slotChannels[slot] being its input channel.
+	// Must not be called while isArtifact can run.
+	void build(const Array<int>& slotChannels);
+
+	// Threshold of step detectors without one of their own (may change at any time)
+	void setDefaultStep(float threshold);
+
+	// One pass over a block; previous is the last sample of the channel's previous block
+	// (NaN if there is none, then the first sample has no step)
+	static BlockStats scan(const float* src, int n, float previous);
+
+	// Runs every detector of the slot's chain (all of them, so their state stays current)
+	bool isArtifact(int slot, const BlockStats& stats);
+
+private:
+	struct DetectorSpec
+	{
+		String type;
+		float value;
+	};
+	struct ChainSpec
+	{
+		Array<int> channels; // empty for the default chain
+		std::vector<DetectorSpec> detectors;
+	};
+
+	static bool parseChain(const String& text, std::vector<DetectorSpec>& chain);
+
+	std::vector<ChainSpec> specs;
+	std::atomic<float> defaultStep;
+
+	// every detector built, then the chain of each slot
+	OwnedArray<ArtifactDetector> detectors;
+	std::vector<Array<ArtifactDetector*>> slotChains;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArtifactDetectors);
+};
+
+#endif // ARTIFACT_DETECTORS_H_INCLUDED
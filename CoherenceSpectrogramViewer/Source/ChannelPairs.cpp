@@ -0,0 +1,286 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ChannelPairs.h"
+
+ChannelPairs::ChannelPairs()
+{}
+
+void ChannelPairs::setGroups(const Array<int>& group1, const Array<int>& group2)
+{
+	chanPairs.clear();
+	pairNames.clear();
+	pairSet.clear();
+
+	for (int chanA : group1)
+	{
+		for (int chanB : group2)
+		{
+			addPair(chanA, chanB, String(chanA + 1) + " x " + String(chanB + 1));
+		}
+	}
+
+	build();
+}
+
+void ChannelPairs::setRegions(const std::vector<ChannelRegion>& regions, const std::vector<std::pair<int, int>>& regionPairs)
+{
+	chanPairs.clear();
+	pairNames.clear();
+	pairSet.clear();
+
+	for (const auto& regionPair : regionPairs)
+	{
+		const ChannelRegion& regionA = regions[regionPair.first];
+		const ChannelRegion& regionB = regions[regionPair.second];
+		bool sameRegion = regionPair.first == regionPair.second;
+
+		for (int i = 0; i < regionA.channels.size(); i++)
+		{
+			// within a region, take each pair once
+			for (int j = sameRegion ? i + 1 : 0; j < regionB.channels.size(); j++)
+			{
+				int chanA = regionA.channels[i];
+				int chanB = regionB.channels[j];
+				addPair(chanA, chanB, regionA.name + " " + String(chanA + 1) + " x " + regionB.name + " " + String(chanB + 1));
+			}
+		}
+	}
+
+	build();
+}
+
+void ChannelPairs::setPairs(const std::vector<std::pair<int, int>>& newPairs)
+{
+	chanPairs.clear();
+	pairNames.clear();
+	pairSet.clear();
+
+	for (const auto& chanPair : newPairs)
+	{
+		addPair(chanPair.first, chanPair.second, String(chanPair.first + 1) + " x " + String(chanPair.second + 1));
+	}
+
+	build();
+}
+
+bool ChannelPairs::parse(const String& spec)
+{
+	// "a-b" with 1-based channels or region names
+	auto splitPair = [](const String& token, String& a, String& b)
+	{
+		a = token.upToFirstOccurrenceOf("-", false, false).trim();
+		b = token.fromFirstOccurrenceOf("-", false, false).trim();
+		return token.containsChar('-') && a.isNotEmpty() && b.isNotEmpty();
+	};
+
+	if (spec.containsChar(':'))
+	{
+		std::vector<ChannelRegion> regions;
+		StringArray regionTokens;
+		regionTokens.addTokens(spec.upToFirstOccurrenceOf("|", false, false), ";", "");
+		regionTokens.trim();
+		regionTokens.removeEmptyStrings();
+
+		for (const String& token : regionTokens)
+		{
+			ChannelRegion region;
+			region.name = token.upToFirstOccurrenceOf(":", false, false).trim();
+
+			StringArray chanTokens;
+			chanTokens.addTokens(token.fromFirstOccurrenceOf(":", false, false), " ,", "");
+			chanTokens.removeEmptyStrings();
+
+			for (const String& chanToken : chanTokens)
+			{
+				// single channel or range "1-8"
+				String first, last;
+				if (!splitPair(chanToken, first, last))
+				{
+					first = last = chanToken;
+				}
+				int firstChan = first.getIntValue() - 1;
+				int lastChan = last.getIntValue() - 1;
+				if (!first.containsOnly("0123456789") || !last.containsOnly("0123456789") || firstChan < 0 || lastChan < firstChan)
+				{
+					return false;
+				}
+				for (int chan = firstChan; chan <= lastChan; chan++)
+				{
+					region.channels.addIfNotAlreadyThere(chan);
+				}
+			}
+
+			if (region.name.isEmpty() || region.channels.isEmpty())
+			{
+				return false;
+			}
+			regions.push_back(region);
+		}
+
+		auto findRegion = [&regions](const String& name)
+		{
+			for (int r = 0; r < int(regions.size()); r++)
+			{
+				if (regions[r].name == name)
+				{
+					return r;
+				}
+			}
+			return -1;
+		};
+
+		std::vector<std::pair<int, int>> regionPairs;
+		StringArray pairTokens;
+		pairTokens.addTokens(spec.fromFirstOccurrenceOf("|", false, false), ",", "");
+		pairTokens.trim();
+		pairTokens.removeEmptyStrings();
+
+		for (const String& token : pairTokens)
+		{
+			String nameA, nameB;
+			if (!splitPair(token, nameA, nameB) || findRegion(nameA) < 0 || findRegion(nameB) < 0)
+			{
+				return false;
+			}
+			regionPairs.emplace_back(findRegion(nameA), findRegion(nameB));
+		}
+
+		if (regionPairs.empty())
+		{
+			return false;
+		}
+
+		setRegions(regions, regionPairs);
+		return true;
+	}
+
+	std::vector<std::pair<int, int>> newPairs;
+	StringArray pairTokens;
+	pairTokens.addTokens(spec, ",", "");
+	pairTokens.trim();
+	pairTokens.removeEmptyStrings();
+
+	for (const String& token : pairTokens)
+	{
+		String chanA, chanB;
+		if (!splitPair(token, chanA, chanB) || !chanA.containsOnly("0123456789") || !chanB.containsOnly("0123456789")
+			|| chanA.getIntValue() < 1 || chanB.getIntValue() < 1)
+		{
+			return false;
+		}
+		newPairs.emplace_back(chanA.getIntValue() - 1, chanB.getIntValue() - 1);
+	}
+
+	if (newPairs.empty())
+	{
+		return false;
+	}
+
+	setPairs(newPairs);
+	return true;
+}
+
+int ChannelPairs::getNumPairs() const
+{
+	return int(chanPairs.size());
+}
+
+int ChannelPairs::getNumChannels() const
+{
+	return slotChannels.size();
+}
+
+int ChannelPairs::getSlot(int chan) const
+{
+	if (chan < 0 || chan >= int(channelSlots.size()))
+	{
+		return -1;
+	}
+	return channelSlots[chan];
+}
+
+int ChannelPairs::getChannel(int slot) const
+{
+	return slotChannels[slot];
+}
+
+const std::pair<int, int>& ChannelPairs::getSlotPair(int pair) const
+{
+	return slotPairs[pair];
+}
+
+const std::vector<std::pair<int, int>>& ChannelPairs::getChannelPairs() const
+{
+	return chanPairs;
+}
+
+const String& ChannelPairs::getPairName(int pair) const
+{
+	return pairNames[pair];
+}
+
+void ChannelPairs::addPair(int chanA, int chanB, const String& name)
+{
+	if (chanA == chanB)
+	{
+		return;
+	}
+
+	// coherence is symmetric, so (a, b) and (b, a) are the same pair
+	if (!pairSet.insert(std::make_pair(jmin(chanA, chanB), jmax(chanA, chanB))).second)
+	{
+		return;
+	}
+
+	chanPairs.emplace_back(chanA, chanB);
+	pairNames.push_back(name);
+}
+
+void ChannelPairs::build()
+{
+	slotChannels.clear();
+	channelSlots.clear();
+	slotPairs.clear();
+
+	auto getOrAddSlot = [this](int chan)
+	{
+		if (chan >= int(channelSlots.size()))
+		{
+			channelSlots.resize(chan + 1, -1);
+		}
+		if (channelSlots[chan] == -1)
+		{
+			channelSlots[chan] = slotChannels.size();
+			slotChannels.add(chan);
+		}
+		return channelSlots[chan];
+	};
+
+	for (const auto& chanPair : chanPairs)
+	{
+		int slotA = getOrAddSlot(chanPair.first);
+		int slotB = getOrAddSlot(chanPair.second);
+		slotPairs.emplace_back(slotA, slotB);
+	}
+}
@@ -0,0 +1,114 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef CHANNEL_PAIRS_H_INCLUDED
+#define CHANNEL_PAIRS_H_INCLUDED
+
+/*
+
+Channel Pairs - the list of channel pairs coherence is computed for. Pairs come from
+the two channel groups (every group 1 channel with every group 2 channel), from named
+regions with chosen region pairs, or from an explicit list.
+
+Every channel that appears in some pair gets one slot, which is its row in the TFR
+spectra, so a channel is decomposed once however many pairs it is in. Each pair
+maps to the slots of its two channels.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <vector>
+#include <utility>
+#include <set>
+
+struct ChannelRegion
+{
+	String name;
+	Array<int> channels;
+};
+
+class ChannelPairs
+{
+public:
+	ChannelPairs();
+
+	// Every channel of group 1 with every channel of group 2
+	void setGroups(const Array<int>& group1, const Array<int>& group2);
+
+	// Every channel of region a with every channel of region b, for each (a, b) in regionPairs.
+	// A region paired with itself gives each pair of its channels once.
+	void setRegions(const std::vector<ChannelRegion>& regions, const std::vector<std::pair<int, int>>& regionPairs);
+
+	// Explicit list of (channel, channel)
+	void setPairs(const std::vector<std::pair<int, int>>& chanPairs);
+
+	// Read a spec with 1-based channel numbers, either regions and region pairs:
+	//   "HPC: 1 2 3; PFC: 4 5; AMY: 6 | HPC-PFC, HPC-AMY"
+	// or a list of channel pairs:
+	//   "1-4, 2-5, 3-6"
+	// Returns false, leaving the pairs untouched, if the spec can't be read.
+	bool parse(const String& spec);
+
+	int getNumPairs() const;
+
+	// Number of distinct channels over all pairs (= number of slots)
+	int getNumChannels() const;
+
+	// Slot of an input channel, or -1 if it isn't in any pair
+	int getSlot(int chan) const;
+
+	// Input channel in a slot
+	int getChannel(int slot) const;
+
+	// Slots of the two channels in a pair
+	const std::pair<int, int>& getSlotPair(int pair) const;
+
+	// Input channels of each pair
+	const std::vector<std::pair<int, int>>& getChannelPairs() const;
+
+	// e.g. "1 x 4", or "HPC 1 x PFC 4" for regions
+	const String& getPairName(int pair) const;
+
+private:
+	void addPair(int chanA, int chanB, const String& name);
+
+	// Assign slots to the channels of all pairs, in order of first appearance
+	void build();
+
+	std::vector<std::pair<int, int>> chanPairs;
+	std::vector<String> pairNames;
+	// unordered (low, high) channel pairs already added
+	std::set<std::pair<int, int>> pairSet;
+
+	// # slots
+	Array<int> slotChannels;
+	// indexed by input channel, -1 if not in any pair
+	std::vector<int> channelSlots;
+	// # pairs
+	std::vector<std::pair<int, int>> slotPairs;
+
+	JUCE_LEAK_DETECTOR(ChannelPairs);
+};
+
+#endif // CHANNEL_PAIRS_H_INCLUDED
@@ -0,0 +1,207 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "CoherenceBaseline.h"
+#include <cmath>
+#include <algorithm>
+
+CoherenceBaseline::CoherenceBaseline()
+	: nCombs(0)
+	, nFreqs(0)
+	, mode(OFF)
+	, requestedMode(-1)
+{}
+
+void CoherenceBaseline::reset(const Pairs& p, const std::vector<double>& f)
+{
+	nCombs = int(p.size());
+	nFreqs = int(f.size());
+	pairs = p;
+	freqs = f;
+
+	counts.assign(nCombs, 0);
+	means.assign(nCombs * nFreqs, 0);
+	m2s.assign(nCombs * nFreqs, 0);
+}
+
+bool CoherenceBaseline::matches(const Pairs& p, const std::vector<double>& f) const
+{
+	return p == pairs && f == freqs;
+}
+
+void CoherenceBaseline::beginSegment(int comb)
+{
+	if (comb < nCombs)
+	{
+		counts[comb]++;
+	}
+}
+
+void CoherenceBaseline::addValue(int comb, int freq, double coh)
+{
+	if (comb >= nCombs || freq >= nFreqs)
+	{
+		return;
+	}
+
+	int i = comb * nFreqs + freq;
+
+	// Welford update
+	double delta = coh - means[i];
+	means[i] += delta / counts[comb];
+	m2s[i] += delta * (coh - means[i]);
+}
+
+double CoherenceBaseline::getZScore(int comb, int freq, double coh) const
+{
+	if (comb >= nCombs || freq >= nFreqs || counts[comb] < 2)
+	{
+		return 0;
+	}
+
+	int i = comb * nFreqs + freq;
+	double variance = m2s[i] / (counts[comb] - 1);
+	return variance > 0 ? (coh - means[i]) / std::sqrt(variance) : 0;
+}
+
+int CoherenceBaseline::getNumSegments() const
+{
+	if (counts.empty())
+	{
+		return 0;
+	}
+	return int(*std::min_element(counts.begin(), counts.end()));
+}
+
+CoherenceBaseline::Mode CoherenceBaseline::getMode() const
+{
+	return Mode(mode.load());
+}
+
+void CoherenceBaseline::requestMode(Mode newMode)
+{
+	requestedMode = newMode;
+}
+
+void CoherenceBaseline::applyRequestedMode(const Pairs& p, const std::vector<double>& f)
+{
+	int newMode = requestedMode.exchange(-1);
+	if (newMode == -1)
+	{
+		return;
+	}
+
+	if (newMode == CAPTURE)
+	{
+		reset(p, f);
+	}
+	else if (newMode == ZSCORE && !matches(p, f))
+	{
+		newMode = OFF;
+	}
+
+	mode = newMode;
+}
+
+bool CoherenceBaseline::save(const File& file) const
+{
+	FileOutputStream out(file);
+	if (!out.openedOk())
+	{
+		return false;
+	}
+	out.setPosition(0);
+	out.truncate();
+
+	// Header, then each array as one block
+	out.writeInt(FILE_MAGIC);
+	out.writeInt(FILE_VERSION);
+	out.writeInt(nCombs);
+	out.writeInt(nFreqs);
+	out.write(freqs.data(), freqs.size() * sizeof(double));
+	for (const auto& pair : pairs)
+	{
+		out.writeInt(pair.first);
+		out.writeInt(pair.second);
+	}
+	out.write(counts.data(), counts.size() * sizeof(uint32));
+	out.write(means.data(), means.size() * sizeof(double));
+	out.write(m2s.data(), m2s.size() * sizeof(double));
+	out.flush();
+
+	return out.getStatus().wasOk();
+}
+
+bool CoherenceBaseline::load(const File& file)
+{
+	FileInputStream in(file);
+	if (!in.openedOk())
+	{
+		return false;
+	}
+
+	if (in.readInt() != FILE_MAGIC || in.readInt() != FILE_VERSION)
+	{
+		return false;
+	}
+
+	int nc = in.readInt();
+	int nf = in.readInt();
+	if (nc < 0 || nf < 0)
+	{
+		return false;
+	}
+
+	int64 expectedBytes = int64(nf) * sizeof(double) + 2 * int64(nc) * sizeof(int)
+		+ int64(nc) * sizeof(uint32) + 2 * int64(nc) * nf * sizeof(double);
+	if (in.getNumBytesRemaining() != expectedBytes)
+	{
+		return false;
+	}
+
+	std::vector<double> newFreqs(nf);
+	Pairs newPairs(nc);
+	std::vector<uint32> newCounts(nc);
+	std::vector<double> newMeans(nc * nf);
+	std::vector<double> newM2s(nc * nf);
+
+	in.read(newFreqs.data(), int(newFreqs.size() * sizeof(double)));
+	for (auto& pair : newPairs)
+	{
+		pair.first = in.readInt();
+		pair.second = in.readInt();
+	}
+	in.read(newCounts.data(), int(newCounts.size() * sizeof(uint32)));
+	in.read(newMeans.data(), int(newMeans.size() * sizeof(double)));
+	in.read(newM2s.data(), int(newM2s.size() * sizeof(double)));
+
+	nCombs = nc;
+	nFreqs = nf;
+	freqs.swap(newFreqs);
+	pairs.swap(newPairs);
+	counts.swap(newCounts);
+	means.swap(newMeans);
+	m2s.swap(newM2s);
+
+	return true;
+}
@@ -0,0 +1,117 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef COHERENCE_BASELINE_H_INCLUDED
+#define COHERENCE_BASELINE_H_INCLUDED
+
+/*
+
+Coherence Baseline - streaming mean and variance of coherence for each
+combination and frequency, collected over a baseline period. Once captured,
+new coherence values can be expressed as a z-score relative to the baseline.
+Values should come from single segments (see CumulativeTFR::getMeanCoherence),
+so that they are independent of each other.
+
+Statistics are kept with Welford's algorithm in flat (# combinations x # freqs)
+arrays, so capture costs O(1) per value and the whole baseline can be written
+to or read from disk in a single block.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <vector>
+#include <utility>
+#include <atomic>
+
+class CoherenceBaseline
+{
+public:
+	enum Mode
+	{
+		OFF,     // raw coherence, baseline untouched
+		CAPTURE, // raw coherence, every segment added to the baseline
+		ZSCORE   // coherence replaced by z-score relative to the baseline
+	};
+
+	// (channel, channel) of each combination
+	using Pairs = std::vector<std::pair<int, int>>;
+
+	CoherenceBaseline();
+
+	// Clear all statistics and set the combinations and frequencies they apply to
+	void reset(const Pairs& pairs, const std::vector<double>& freqs);
+
+	// Whether the baseline was collected for these same channel pairs, in this order, and frequencies
+	bool matches(const Pairs& pairs, const std::vector<double>& freqs) const;
+
+	// Count a new segment for this combination. Call once before adding its values.
+	void beginSegment(int comb);
+
+	// Add one coherence value to the running mean/variance
+	void addValue(int comb, int freq, double coh);
+
+	// Returns (coh - mean) / std, or 0 if the baseline has fewer than 2 segments
+	double getZScore(int comb, int freq, double coh) const;
+
+	// Least number of segments collected over all combinations
+	int getNumSegments() const;
+
+	Mode getMode() const;
+
+	// Ask for a mode change (from any thread). The change is applied by the thread
+	// that runs the coherence calculation, via applyRequestedMode.
+	void requestMode(Mode newMode);
+
+	// Apply a pending mode request before the next segment. Starting a capture
+	// clears the statistics; z-scoring against a baseline that does not match
+	// the current layout falls back to OFF.
+	void applyRequestedMode(const Pairs& pairs, const std::vector<double>& freqs);
+
+	// Write/read the baseline to/from a binary file. Returns false on failure,
+	// in which case a failed load leaves the current baseline untouched.
+	bool save(const File& file) const;
+	bool load(const File& file);
+
+private:
+	int nCombs;
+	int nFreqs;
+	Pairs pairs;
+	std::vector<double> freqs;
+
+	// # combinations
+	std::vector<uint32> counts;
+	// # combinations x # frequencies
+	std::vector<double> means;
+	std::vector<double> m2s; // sum of squared differences from the mean
+
+	std::atomic<int> mode;
+	std::atomic<int> requestedMode; // -1 if no request is pending
+
+	static const int FILE_MAGIC = 0x42484f43; // "COHB"
+	static const int FILE_VERSION = 2; // 2: with the channel pairs
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(CoherenceBaseline);
+};
+
+#endif // COHERENCE_BASELINE_H_INCLUDED
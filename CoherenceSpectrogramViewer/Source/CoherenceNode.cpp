@@ -23,10 +23,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "CoherenceNode.h"
 #include "CoherenceNodeEditor.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 /********** node ************/
 CoherenceNode::CoherenceNode()
 	: GenericProcessor("TFR-Coherence & Spectrogram")
 	, Thread("Coherence Calc")
+	, ingest(sampleRing, artifactDetectors)
 	, segLen(4)
 	, freqStart(1)
 	, freqEnd(40)
@@ -34,18 +38,48 @@ CoherenceNode::CoherenceNode()
 	, winLen(2)
 	, interpRatio(2)
     , freqStep(1.0 / float(winLen*interpRatio))
-    , nGroup1Chans(0)
-	, nGroup2Chans(0)
+	, nGroupCombs(0)
 	, Fs(0)
 	, alpha(0)
+	, windowSize(0)
+	, memoryBudget(2048)
+	, recordOutput(RECORD_BINS)
+	, pacEnabled(false)
+	, surrogatesEnabled(false)
+	, surrogateMethod(SurrogateCoherence::CIRCULAR_SHIFT)
+	, nSurrogates(200)
+	, surrogateHistory(20)
+	, surrogateCpu(25)
+	, eventLocked(false)
+	, eventChannel(0)
+	, eventPre(1)
+	, eventPost(3)
+	, segmentHop(0)
+	, nBlockEvents(0)
+	, nextSegmentStart(0)
+	, skippedWindows(0)
+	, computeLoad(0)
+	, keepUp(false)
+	, freqGrid(GRID_LINEAR)
+	, freqsPerOctave(8)
+	, nGridFreqs(0)
+	, routing(nullptr)
 	, numArtifacts(0)
+	, artifactThreshold(3000)
+	, detectorSpec("step")
 	, ready(false)
 	, group1Channels({})
 	, group2Channels({})
-	, nSamplesWait(0)
-    , WhatisIT(1)
+	, WhatisIT(1)
 {
 	setProcessorType(PROCESSOR_TYPE_SINK);
+
+	routingTables.emplace_back(new RoutingTable());
+	routing = routingTables.back().get();
+
+	setBands("theta 4-8, beta 13-30, gamma 30-40");
+	setPACRanges("4-8", "30-40");
+	updateGridSize();
 }
 
 CoherenceNode::~CoherenceNode()
@@ -62,217 +96,359 @@ AudioProcessorEditor* CoherenceNode::createEditor()
 
 void CoherenceNode::process(AudioSampleBuffer& continuousBuffer)
 {
-	// Upkeep coherence file
-	checkCohFile();
+	// Only gathers what the platform gives: all of the work is in SampleIngest::process
+	int nChannels = jmin(continuousBuffer.getNumChannels(), int(channelBlocks.size()));
+	for (int chan = 0; chan < nChannels; chan++)
+	{
+		channelBlocks[chan] = { continuousBuffer.getReadPointer(chan), int(getNumSamples(chan)), int64(getTimestamp(chan)) };
+	}
+
+	nBlockEvents = 0;
+	if (eventLocked)
+	{
+		checkForEvents();
+	}
+
+	ingest.process(getRouting(), channelBlocks.data(), nChannels, blockEvents, nBlockEvents);
+}
+
+void CoherenceNode::handleEvent(const EventChannel* eventInfo, const MidiMessage& event, int samplePosition)
+{
+	if (!eventLocked || Event::getEventType(event) != EventChannel::TTL)
+	{
+		return;
+	}
 
-	///// Add incoming data to data buffer. Let thread get the ok to start at 8seconds of data ////
-	AtomicScopedWritePtr<Array<FFTWArrayType>> dataWriter(dataBuffer);
-	// Check writer
-	if (!dataWriter.isValid())
+	int size = event.getRawDataSize();
+	if (nBlockEvents == SampleIngest::MAX_PENDING_EVENTS || size > int(sizeof(SampleIngest::BlockEvent::data)))
 	{
-		jassertfalse; // atomic sync data writer broken
+		return;
 	}
 
-	//for loop over active channels and update buffer with new data
-	Array<int> activeInputs = getActiveInputs();
-	int nActiveInputs = activeInputs.size();
-	int nSamples = 0;
-	for (int activeChan = 0; activeChan < nActiveInputs; ++activeChan)
+	// Only reads and copies here; the coherence thread checks the channel and state (see takeTriggers)
+	SampleIngest::BlockEvent& blockEvent = blockEvents[nBlockEvents++];
+	blockEvent.channel = eventInfo;
+	blockEvent.timestamp = Event::getTimestamp(event);
+	blockEvent.rate = eventInfo->getSampleRate();
+	blockEvent.size = size;
+	std::memcpy(blockEvent.data, event.getRawData(), size);
+}
+
+void CoherenceNode::takeTriggers()
+{
+	SampleIngest::PendingEvent pending;
+	while (ingest.popEvent(pending))
 	{
-		int chan = activeInputs[activeChan];
-		int groupNum = getChanGroup(chan);
-		if (groupNum != -1)
+		MidiMessage message(pending.data, pending.size);
+		TTLEventPtr ttl = TTLEvent::deserializeFromMessage(message, pending.channel);
+		if (ttl && ttl->getChannel() == eventChannel && ttl->getState())
 		{
-			int groupIt = (groupNum == 1 ? getGroupIt(groupNum, chan) : getGroupIt(groupNum, chan) + nGroup1Chans);
+			triggers.push_back(pending.position);
+		}
+	}
+}
 
-			nSamples = getNumSamples(chan); // all channels the same?
-			if (nSamples == 0)
-			{
-				continue;
-			}
+int CoherenceNode::getMaxAlignment() const
+{
+	return int(SampleIngest::MAX_ALIGNMENT_SECONDS * Fs);
+}
 
-			// Get read pointer of incoming data to move to the stored data buffer
-			const float* rpIn = continuousBuffer.getReadPointer(chan);
+bool CoherenceNode::takeNextWindow(int64& windowStart, int64& samplesNeeded)
+{
+	int windowSamples = getWindowSamples();
+	// before looking at the triggers, so any trigger still to come is at or after it
+	int64 written = sampleRing.getWriteIndex();
+	int64 gap = sampleRing.getLastGap();
 
-			if (nSamplesWaited < nSamplesWait)
-			{
-				for (int n = 0; n < nSamples; n++)
-				{
-					if (std::abs(dataWriter->getReference(groupIt).getAsReal(n - 1) - rpIn[n]) > artifactThreshold)
-					{
-						// Artifact after a previous artifact, reset again. Then wait to let signals settle.
-						discardCurBuffer(nSamplesWaited + n);
-						break;
-					}
-				}
-				nSamplesWaited += nSamples;
-				break;
-			}
+	if (!eventLocked)
+	{
+		int hopSamples = getHopSamples();
+		windowStart = nextSegmentStart;
+		samplesNeeded = windowStart + windowSamples;
+		if (samplesNeeded > written)
+		{
+			return false;
+		}
 
-			// Handle overflow
-			if (nSamplesAdded + nSamples >= segLen * Fs)
-			{
-				nSamples = segLen * Fs - nSamplesAdded;
-			}
+		if (gap > windowStart && gap < windowStart + windowSamples)
+		{
+			// blocks were dropped inside this segment, start again after them
+			skippedWindows += int((gap - windowStart + hopSamples - 1) / hopSamples);
+			nextSegmentStart = gap;
+			sampleRing.setReadIndex(nextSegmentStart);
+			samplesNeeded = nextSegmentStart + windowSamples;
+			return false;
+		}
 
-			// Add to buffer the new samples.
-			for (int n = 0; n < nSamples; n++)
-			{
-				if (std::abs(dataWriter->getReference(groupIt).getAsReal(n - 1) - rpIn[n]) < artifactThreshold)
-				{
-					dataWriter->getReference(groupIt).set(nSamplesAdded + n, rpIn[n]);
-				}
-				else // Large change. Most likely an artifact. Discard buffer and restart data collection.
-				{
-					discardCurBuffer(nSamplesAdded + n);
-					return;
-				}
-			}
+		// Behind by one or more whole segments: go straight to the newest one
+		int64 nBehind = (written - windowSamples - windowStart) / hopSamples;
+		if (keepUp && nBehind > 0)
+		{
+			skippedWindows += int(nBehind);
+			windowStart += nBehind * hopSamples;
+		}
+
+		nextSegmentStart = windowStart + hopSamples;
+		return true;
+	}
+
+	int preSamples = int(eventPre * Fs);
+	takeTriggers();
+	while (!triggers.empty())
+	{
+		windowStart = triggers.front() - preSamples;
+		samplesNeeded = windowStart + windowSamples;
+		if (samplesNeeded > written)
+		{
+			// Triggers arrive in order, so wait for this one's post-event samples
+			return false;
+		}
+		triggers.pop_front();
+
+		// pre-trigger history isn't there (trigger too early after start) or blocks were dropped inside it
+		if (windowStart >= sampleRing.getOldestIndex() && !(gap > windowStart && gap < windowStart + windowSamples))
+		{
+			return true;
 		}
+		skippedWindows++;
 	}
 
-	nSamplesAdded += nSamples;
+	// Nothing pending: keep the pre-trigger history for the next trigger
+	sampleRing.setReadIndex(jmax(int64(0), written - preSamples));
+	samplesNeeded = std::numeric_limits<int64>::max();
+	return false;
+}
+
+void CoherenceNode::waitForSamples(int64 samplesNeeded)
+{
+	int64 wakeIndex = jmin(samplesNeeded, sampleRing.getReadIndex() + sampleRing.getCapacity() / 2);
+	ingest.waitForSamples(wakeIndex, WAKE_TIMEOUT_MS);
+}
+
+void CoherenceNode::readWindow(int64 windowStart)
+{
+	int windowSamples = getWindowSamples();
+	std::fill(segment.valid.begin(), segment.valid.end(), false);
 
-	// channel buf is full. Update buffer.
-	if (nSamplesAdded >= segLen * Fs)
+	for (const ChannelRoute& route : getRouting())
 	{
-		dataWriter.pushUpdate();
-		// Reset samples added
-		nSamplesAdded = 0;
-		//updateDataBufferSize();
-		numTrials++;
+		const float* spans[2];
+		int spanLengths[2];
+		sampleRing.getSpans(route.slot, windowStart, windowSamples,
+			spans[0], spanLengths[0], spans[1], spanLengths[1]);
+
+		// the TFR zero-pads the rest up to its FFT length
+		FFTWArrayType& dest = segment.channels.getReference(route.slot);
+		bool clean = SampleIngest::copyToDouble(dest.getRealPointer(0), spans[0], spanLengths[0]);
+		if (spanLengths[1] > 0)
+		{
+			clean &= SampleIngest::copyToDouble(dest.getRealPointer(spanLengths[0]), spans[1], spanLengths[1]);
+		}
+		segment.valid[route.slot] = clean;
 	}
 }
 
 void CoherenceNode::run()
 {
-	AtomicScopedReadPtr<Array<FFTWArrayType>> dataReader(dataBuffer);
-	AtomicScopedWritePtr<std::vector<std::vector<double>>> coherenceWriter(meanCoherence);
+	AtomicScopedWritePtr<CoherenceResults> coherenceWriter(results);
+
+	auto writeValues = [this](const std::vector<double>& values)
+	{
+		for (double value : values)
+		{
+			cohFile << String(value) << ",";
+		}
+	};
 
 	while (!threadShouldExit())
 	{
-		//// Check for new filled data buffer and run stats ////        
-		if (dataBuffer.hasUpdate())
+		// Upkeep coherence file
+		checkCohFile();
+
+		//// Wait for the next complete window and run stats ////
+		int64 windowStart, samplesNeeded;
+		if (!takeNextWindow(windowStart, samplesNeeded))
+		{
+			waitForSamples(samplesNeeded);
+		}
+		else
 		{
-			dataReader.pullUpdate();
-			Array<int> activeInputs = getActiveInputs();
-			int nActiveInputs = activeInputs.size();
-			// Isolation of two entities Coherenece and Spectrogram here
-			if (WhatisIT == 1)
+			auto computeStart = std::chrono::steady_clock::now();
+			readWindow(windowStart);
+			// Everything before the next window can be overwritten now
+			sampleRing.setReadIndex(eventLocked ? windowStart : nextSegmentStart);
+
+			if (finishSegmentMask(segment) == 0)
 			{
-				for (int activeChan = 0; activeChan < nActiveInputs; ++activeChan)
+				numArtifacts++;
+				continue;
+			}
+			numTrials++;
+
+			baseline.applyRequestedMode(pairs.getChannelPairs(), getFrequencies());
+			// Decompose each channel once, for both coherence and spectrogram
+			const std::vector<bool>& valid = segment.valid;
+			for (const ChannelRoute& route : getRouting())
+			{
+				// send each window to the TFR, once per channel however many pairs it's in.
+				// Masked channels are skipped; the TFR leaves them (and their pairs) out of the averages.
+				if (valid[route.slot])
 				{
-					int chan = activeInputs[activeChan];
-					// get buffer and send it to TFR
-					// Check to make sure channel is in one of our groups
-					int groupNum = getChanGroup(chan);
-					if (groupNum != -1)
-					{
-						int groupIt = (groupNum == 1 ? getGroupIt(groupNum, chan) : getGroupIt(groupNum, chan) + nGroup1Chans);
-						TFR->addTrial(dataReader->getReference(groupIt), groupIt);
-					}
-					else
-					{
-						// channel isn't part of group 1 or 2
-						jassertfalse; // ungrouped channel
-					}
+					TFR->addTrial(segment.channels.getReference(route.slot), route.slot);
 				}
+			}
+			TFR->finishTrial(valid);
+			// a masked channel's spectra are stale, so such segments stay out of the null distribution
+			if (TFR->allChannelsValid())
+			{
+				surrogates.addSegment(TFR->getSpectra());
+			}
 
+			//// Get and send updated coherence  ////
+			if (!coherenceWriter.isValid())
+			{
+				jassertfalse; // atomic sync coherence writer broken
+			}
 
-				//// Get and send updated coherence  ////
-				if (!coherenceWriter.isValid())
+			// Calc coherence at each combination of interest
+			for (int comb = 0; comb < nGroupCombs; comb++)
+			{
+				const std::pair<int, int>& slots = pairs.getSlotPair(comb);
+				std::vector<double>& cohDest = coherenceWriter->coherence[comb];
+				std::vector<double>& bandDest = coherenceWriter->bandCoherence[comb];
+				TFR->getMeanCoherence(slots.first, slots.second, cohDest.data(), comb, bandDest.data(),
+					coherenceWriter->envelopeCorrelation[comb].data());
+
+				// same cross-spectra, other time constants
+				auto& extraCoherence = coherenceWriter->extraCoherence;
+				int nExtra = jmin(TFR->getNumExtraAlphas(), int(extraCoherence.size()));
+				for (int k = 0; k < nExtra; k++)
 				{
-					jassertfalse; // atomic sync coherence writer broken
+					TFR->getExtraCoherence(slots.first, slots.second, comb, k, extraCoherence[k][comb].data());
 				}
 
-				// Calc coherence at each combination of interest
-				for (int itX = 0, comb = 0; itX < nGroup1Chans; itX++)
+				if (CoreServices::getRecordingStatus())
 				{
-					for (int itY = 0; itY < nGroup2Chans; itY++, comb++)
+					// without bands, record the frequencies regardless
+					int output = bandDest.empty() ? RECORD_BINS : recordOutput.load();
+					if (output != RECORD_BANDS)
 					{
-						TFR->getMeanCoherence(itX, itY + nGroup1Chans, coherenceWriter->at(comb).data(), comb);
-						if (CoreServices::getRecordingStatus())
-						{
-							for (int i = 0; i < coherenceWriter->at(comb).size(); i++)
-							{
-								const char * buffer = (String(coherenceWriter->at(comb)[i]) + ",").toRawUTF8();
-								cohFile << buffer;
-
-							}
-							cohFile << "\n";
-						}
-
+						writeValues(cohDest);
+					}
+					if (output != RECORD_BINS)
+					{
+						writeValues(bandDest);
 					}
+					// then the frequencies again for each extra alpha
+					for (int k = 0; k < nExtra; k++)
+					{
+						writeValues(extraCoherence[k][comb]);
+					}
+					cohFile << "\n";
 				}
-				cohFile << "\n";
 			}
-			else
+			cohFile << "\n";
+
+			// Directionality from the updated cross-spectra
+			for (int comb = 0; comb < nGroupCombs; comb++)
 			{
-				for (int activeChan = 0; activeChan < nActiveInputs; ++activeChan)
+				const std::pair<int, int>& slots = pairs.getSlotPair(comb);
+				TFR->getPhaseSlope(slots.first, slots.second, comb,
+					coherenceWriter->phaseSlope[comb].data(), coherenceWriter->groupDelay[comb].data());
+
+				// latest thresholds the surrogate workers have published
+				if (surrogates.isActive())
 				{
-					TFR->addTrial(dataReader->getReference(activeChan), activeChan);
+					surrogates.getThresholds(comb, coherenceWriter->coherenceThreshold[comb].data());
 				}
-				ttlpwr = TFR->getPowerForChannels();
 			}
+
+			// Spectrogram
+			TFR->getPowerForChannels(spectrogramSlots, coherenceWriter->power, &coherenceWriter->bandPower);
+
+			for (int chan = 0; chan < pac.getNumChannels(); chan++)
+			{
+				pac.getModulationIndex(chan, coherenceWriter->pacMI[chan].data());
+				pac.getMeanVectorLength(chan, coherenceWriter->pacMVL[chan].data());
+			}
+
 			// Update coherence and reset data buffer           
 			coherenceWriter.pushUpdate();
+
+			updateComputeLoad(std::chrono::duration<double>(std::chrono::steady_clock::now() - computeStart).count());
 		}
 	}
+
+	// recording ends with acquisition
+	if (cohFile.is_open())
+	{
+		cohFile.close();
+	}
 }
 
 void CoherenceNode::updateDataBufferSize(int newSize)
 {
-	int totalChans;
-	if (WhatisIT == 1)
-		totalChans = nGroup1Chans + nGroup2Chans;
-	else if (WhatisIT == 0)
-	{
-		int tt1 = nGroup1Chans + nGroup2Chans;
-		int NumOfChanChan = (TotalNumofChannels).size();
-		if (tt1 != (TotalNumofChannels).size())
-		{
-			totalChans = NumOfChanChan;
-		}
-		else
-			totalChans = nGroup1Chans + nGroup2Chans;
-	}
+	// pair/spectrogram channels and their references
+	int totalChans = montage.getNumInputs();
 	/*End*/
 	// no writers or readers can exist here
 	// so this can't be called during acquisition
-	dataBuffer.map([=](Array<FFTWArrayType>& arr)
+	sampleRing.reset(totalChans, getRingCapacity());
+
+	Array<FFTWArrayType>& arr = segment.channels;
+	arr.resize(totalChans);
+	for (int i = 0; i < totalChans; i++)
 	{
-		arr.resize(totalChans);
+		arr.getReference(i).resize(newSize);
+	}
+	segment.valid.assign(totalChans, false);
 
-		for (int i = 0; i < totalChans; i++)
-		{
-			arr.getReference(i).resize(newSize);
-		}
-	});
+	updateResamplers();
+	channelBlocks.assign(getNumInputs(), SampleIngest::ChannelBlock());
+
+	// atomics can't be copied in, so the counts are replaced all at once (at 0)
+	std::vector<std::atomic<int>>(totalChans).swap(maskedSegments);
 }
 
 void CoherenceNode::updateMeanCoherenceSize()
 {
-	meanCoherence.map([=](std::vector<std::vector<double>>& vec)
+	int nBands = bands.size();
+	int nSpectrogramChans = TotalNumofChannels.size();
+	int nPACChans = pac.getNumChannels();
+	int nPACFreqs = pac.getNumPhaseFreqs() * pac.getNumAmpFreqs();
+	int nThresholdFreqs = surrogates.isActive() ? nFreqs : 0;
+	int nExtraAlphas = int(extraAlphas.size());
+	results.map([=](CoherenceResults& res)
 	{
-		// Update meanCoherence size to new num combinations
-		vec.resize(nGroupCombs);
-
-		// Update meanCoherence to new num freq at each existing combination
+		res.extraCoherence.assign(nExtraAlphas,
+			std::vector<std::vector<double>>(nGroupCombs, std::vector<double>(nFreqs)));
+		res.power.assign(nSpectrogramChans, std::vector<float>(nFreqs));
+		res.bandPower.assign(nSpectrogramChans, std::vector<float>(nBands));
+		res.pacMI.assign(nPACChans, std::vector<double>(nPACFreqs));
+		res.pacMVL.assign(nPACChans, std::vector<double>(nPACFreqs));
+
+		// Update coherence size to new num combinations
+		res.coherence.resize(nGroupCombs);
+		res.bandCoherence.resize(nGroupCombs);
+		res.envelopeCorrelation.resize(nGroupCombs);
+		res.phaseSlope.assign(nGroupCombs, std::vector<double>(nBands));
+		res.coherenceThreshold.assign(nGroupCombs, std::vector<double>(nThresholdFreqs));
+		res.groupDelay.assign(nGroupCombs, std::vector<double>(nBands));
+
+		// Update coherence to new num freq/bands at each existing combination
 		for (int comb = 0; comb < nGroupCombs; comb++)
 		{
-			vec[comb].resize(nFreqs);
+			res.coherence[comb].resize(nFreqs);
+			res.bandCoherence[comb].resize(nBands);
+			res.envelopeCorrelation[comb].resize(nFreqs);
 		}
 	});
 }
 
 void CoherenceNode::updateSettings()
 {
-	// Array of samples per channel and if ready to go
-	nSamplesAdded = 0;
+	updateFrequencies();
 
-	nFreqs = int((freqEnd - freqStart) / freqStep) + 1;
-
-	artifactThreshold = 3000; //250
 
 	int numInputs = getNumInputs();
 	// Default selected groups
@@ -292,25 +468,26 @@ void CoherenceNode::updateSettings()
 				}
 			}
 		}
-		// Set number of channels in each group
-		nGroup1Chans = group1Channels.size();
-		nGroup2Chans = group2Channels.size();
-		nGroupCombs = nGroup1Chans * nGroup2Chans;
+		// Rebuild pairs from the groups (if not set explicitly)
+		updateGroup(group1Channels, group2Channels);
 
-		if (nGroup1Chans > 0)
+		// Analysis rate from every channel the TFR decomposes, which can come from sources at different rates
+		updateMontage();
+		float newFs = getAnalysisRate();
+		if (newFs > 0 && newFs != Fs)
 		{
-			float newFs = getDataChannel(group1Channels[0])->getSampleRate();
-			if (newFs != Fs)
-			{
-				Fs = newFs;
-				updateDataBufferSize(segLen * Fs);
-			}
+			Fs = newFs;
+			updateDataBufferSize(CumulativeTFR::getFFTLength(getSegmentSeconds(), Fs));
+			// the TFR's transform length goes with Fs, so it's rebuilt before the next acquisition
+			ready = false;
 		}
 
 
 		updateMeanCoherenceSize();
 	}
-	
+
+	// active channels may have changed with the source
+	updateRouting();
 }
 
 void CoherenceNode::setParameter(int parameterIndex, float newValue)
@@ -326,66 +503,143 @@ void CoherenceNode::setParameter(int parameterIndex, float newValue)
 		break;
 	case START_FREQ:
 		freqStart = static_cast<int>(newValue);
+		updateGridSize();
 		break;
 	case END_FREQ:
 		freqEnd = static_cast<int>(newValue);
+		updateGridSize();
 		break;
 	case FREQ_STEP:
 		freqStep = static_cast<float>(newValue);
+		updateGridSize();
 		break;
 	case STEP_LENGTH:
 		stepLen = static_cast<float>(newValue);
 		break;
 	case ARTIFACT_THRESHOLD:
 		artifactThreshold = static_cast<float>(newValue);
+		artifactDetectors.setDefaultStep(artifactThreshold);
 		break;
 	}
 }
 
-int CoherenceNode::getChanGroup(int chan)
+int CoherenceNode::getChanSlot(int chan)
+{
+	return montage.getInputSlot(chan);
+}
+
+void CoherenceNode::updateRouting()
 {
-	if (group1Channels.contains(chan))
+	std::unique_ptr<RoutingTable> table(new RoutingTable());
+	for (int chan : getActiveInputs())
 	{
-		return 1;
+		int slot = getChanSlot(chan);
+		if (slot != -1)
+		{
+			table->push_back({ chan, slot });
+		}
 	}
-	else if (group2Channels.contains(chan))
+
+	routingTables.push_back(std::move(table));
+	routing.store(routingTables.back().get(), std::memory_order_release);
+
+	// Old tables are kept while the audio or TFR thread could still be reading them
+	if (!CoreServices::getAcquisitionStatus() && !isThreadRunning())
 	{
-		return 2;
+		routingTables.erase(routingTables.begin(), routingTables.end() - 1);
 	}
-	else
+}
+
+const CoherenceNode::RoutingTable& CoherenceNode::getRouting() const
+{
+	return *routing.load(std::memory_order_acquire);
+}
+
+bool CoherenceNode::setDetectorSpec(const String& spec)
+{
+	if (!artifactDetectors.parse(spec))
 	{
-		return -1; // Channel isn't in group 1 or 2. Error!
+		return false;
 	}
+
+	detectorSpec = spec.trim();
+	return true;
 }
 
-int CoherenceNode::getGroupIt(int group, int chan)
+bool CoherenceNode::setMontageSpec(const String& spec)
 {
-	if (group == 1)
+	if (!montage.parse(spec))
 	{
-		int * it = std::find(group1Channels.begin(), group1Channels.end(), chan);
-		return it - group1Channels.begin();
+		return false;
 	}
-	else if (group == 2)
+
+	montageSpec = spec.trim();
+	return true;
+}
+
+void CoherenceNode::updateMontage()
+{
+	// Output channels in TFR slot order: pair channels first (so pair slots index them directly),
+	// then spectrogram channels not in any pair
+	Array<int> outputChannels;
+	for (int slot = 0; slot < pairs.getNumChannels(); slot++)
 	{
-		int * it = std::find(group2Channels.begin(), group2Channels.end(), chan);
-		return it - group2Channels.begin();
+		outputChannels.add(pairs.getChannel(slot));
 	}
-	else
+
+	spectrogramSlots.clear();
+	for (int chan : TotalNumofChannels)
 	{
-		return -1;
+		int slot = outputChannels.indexOf(chan);
+		if (slot == -1)
+		{
+			slot = outputChannels.size();
+			outputChannels.add(chan);
+		}
+		spectrogramSlots.push_back(slot);
 	}
+
+	montage.build(outputChannels);
+	updateRouting();
 }
 
+bool CoherenceNode::setPairSpec(const String& spec)
+{
+	// The coherence thread loops over pairs and nGroupCombs during acquisition
+	if (CoreServices::getAcquisitionStatus() || isThreadRunning())
+	{
+		return false;
+	}
+
+	if (spec.trim().isEmpty())
+	{
+		pairSpec = String();
+		pairs.setGroups(group1Channels, group2Channels);
+	}
+	else if (pairs.parse(spec))
+	{
+		pairSpec = spec.trim();
+	}
+	else
+	{
+		return false;
+	}
+
+	nGroupCombs = pairs.getNumPairs();
+	return true;
+}
 
 void CoherenceNode::updateGroup(Array<int> group1Chans, Array<int> group2Chans)
 {
 	group1Channels = group1Chans;
 	group2Channels = group2Chans;
 
-	nGroup1Chans = group1Channels.size();
-	nGroup2Chans = group2Channels.size();
+	if (pairSpec.isEmpty())
+	{
+		pairs.setGroups(group1Channels, group2Channels);
+	}
 
-	nGroupCombs = nGroup1Chans * nGroup2Chans;
+	nGroupCombs = pairs.getNumPairs();
 }
 
 void CoherenceNode::updateAlpha(float a)
@@ -393,6 +647,54 @@ void CoherenceNode::updateAlpha(float a)
 	alpha = a;
 }
 
+bool CoherenceNode::setExtraAlphas(const String& spec)
+{
+	StringArray tokens;
+	tokens.addTokens(spec, " ,", "");
+	tokens.removeEmptyStrings();
+	if (tokens.size() > MAX_EXTRA_ALPHAS)
+	{
+		return false;
+	}
+
+	std::vector<double> newAlphas;
+	for (const String& token : tokens)
+	{
+		double value = token.getDoubleValue();
+		if (!token.containsOnly("0123456789.") || value <= 0 || value > 1)
+		{
+			return false;
+		}
+		newAlphas.push_back(value);
+	}
+
+	extraAlphas = newAlphas;
+	return true;
+}
+
+void CoherenceNode::updateWindowSize(int w)
+{
+	windowSize = w;
+}
+
+int64 CoherenceNode::getWindowMemoryEstimate(int w)
+{
+	return CumulativeTFR::getWindowMemory(montage.getNumOutputs(), nGroupCombs, nGridFreqs,
+		memoryPlan.collapseTime ? 1 : getNumTimes(), w);
+}
+
+int CoherenceNode::getNumTimes() const
+{
+	if (Fs <= 0)
+	{
+		return 0;
+	}
+
+	// Trim time close to edge
+	int nSamplesWin = winLen * Fs;
+	return ((getSegmentSeconds() * Fs) - (nSamplesWin)) / Fs * (1 / stepLen) + 1; // Trim half of window on both sides, so 1 window length is trimmed total
+}
+
 void CoherenceNode::updateReady(bool isReady)
 {
 	ready = isReady;
@@ -400,55 +702,447 @@ void CoherenceNode::updateReady(bool isReady)
 
 void CoherenceNode::resetTFR()
 {
-	if (((group1Channels.size() > 0) && (group2Channels.size() > 0)) || (WhatisIT == 0))
+	if ((nGroupCombs > 0) || (TotalNumofChannels.size() > 0))
 	{
+		updateMontage();
+
+		// An explicit pair list or montage can name channels this node doesn't have
+		for (int slot = 0; slot < montage.getNumInputs(); slot++)
+		{
+			if (montage.getInputChannel(slot) >= getNumInputs())
+			{
+				tfrStatus = "Channel " + String(montage.getInputChannel(slot) + 1) + " is in a pair or reference but isn't an input.";
+				ready = false;
+				return;
+			}
+		}
+
+		Fs = getAnalysisRate();
+
+		updateFrequencies();
+		if (nFreqs == 0)
+		{
+			tfrStatus = "No frequencies of interest between the start and end frequency.";
+			ready = false;
+			return;
+		}
+		nTimes = getNumTimes();
+		if (nTimes < 1)
+		{
+			tfrStatus = "Trials (" + String(getSegmentSeconds()) + " s) must be longer than the window length.";
+			ready = false;
+			return;
+		}
+
+		// Check what everything will take before allocating any of it
+		if (!planMemory())
+		{
+			ready = false;
+			return;
+		}
+
 		ready = true;
 
-		nSamplesAdded = 0;
-		updateDataBufferSize(segLen*Fs);
-		
+		// segment plus zero-padding up to the TFR's transform length
+		updateDataBufferSize(CumulativeTFR::getFFTLength(getSegmentSeconds(), Fs));
+
+		// detector chain of each data buffer slot
+		Array<int> slotChannels;
+		for (int slot = 0; slot < montage.getNumInputs(); slot++)
+		{
+			slotChannels.add(montage.getInputChannel(slot));
+		}
+		artifactDetectors.build(slotChannels);
+
 		numArtifacts = 0;
+
+		if (pacEnabled)
+		{
+			int phaseStart, nPhase, ampStart, nAmp;
+			getFreqRange(pacPhaseBand, phaseStart, nPhase);
+			getFreqRange(pacAmpBand, ampStart, nAmp);
+			pac.reset(spectrogramSlots.size(), phaseStart, nPhase, ampStart, nAmp);
+		}
+		else
+		{
+			pac.reset(0, 0, 0, 0, 0);
+		}
+
+		// Pair channels are the first TFR slots (see updateMontage)
+		std::vector<std::pair<int, int>> slotPairs;
+		if (surrogatesEnabled)
+		{
+			for (int comb = 0; comb < nGroupCombs; comb++)
+			{
+				slotPairs.push_back(pairs.getSlotPair(comb));
+			}
+		}
+		surrogates.reset(slotPairs, pairs.getNumChannels(), nFreqs, nTimes, surrogateHistory, nSurrogates,
+			surrogateMethod, surrogateCpu, alpha, windowSize, memoryPlan.collapseTime);
         
-		nFreqs = int((freqEnd - freqStart) / freqStep) + 1;
 		updateMeanCoherenceSize();
-		// Trim time close to edge
-		int nSamplesWin = winLen * Fs;
-		nTimes = ((segLen * Fs) - (nSamplesWin)) / Fs * (1 / stepLen) + 1; // Trim half of window on both sides, so 1 window length is trimmed total
 
-		if (nGroup1Chans > 0 || (WhatisIT == 0))
+		// Free the old TFR first so both never exist at once.
+		// One TFR serves both coherence (pair channels) and spectrogram (all channels).
+		TFR = nullptr;
+		TFR = new CumulativeTFR(montage.getNumOutputs(), nGroupCombs, frequencies, nTimes, Fs, winLen, stepLen,
+			getSegmentSeconds(), alpha, windowSize, memoryPlan.collapseTime, extraAlphas);
+		if (!montage.isIdentity())
 		{
-			float newFs = getDataChannel(group1Channels[0])->getSampleRate();
-			if (newFs != Fs)
-			{
-				Fs = newFs;
-				updateDataBufferSize(segLen * Fs);
+			TFR->setMontage(montage.getNumInputs(), montage.getTerms(), montage.getAverageTerms());
+		}
+		TFR->setBaseline(&baseline);
+		TFR->setBands(bands);
+		if (pacEnabled)
+		{
+			TFR->setPAC(&pac, spectrogramSlots);
+		}
+
+		// Capture restarts and z-scoring stops if the baseline no longer fits the pairs or frequencies
+		CoherenceBaseline::Mode baselineMode = baseline.getMode();
+		if (baselineMode != CoherenceBaseline::OFF && !baseline.matches(pairs.getChannelPairs(), getFrequencies()))
+		{
+			baseline.requestMode(baselineMode);
+		}
+	}
+	else
+	{
+		ready = false;
+	}
+}
+
+bool CoherenceNode::planMemory()
+{
+	int nChans = montage.getNumOutputs();
+	int nInputs = montage.isIdentity() ? 0 : montage.getNumInputs();
+	int64 nSpectrogramChans = spectrogramSlots.size();
+	int64 nBands = bands.size();
+	int64 budget = int64(memoryBudget * 1048576.0);
+
+	int64 pacMemory = 0;
+	if (pacEnabled)
+	{
+		int phaseStart, nPhase, ampStart, nAmp;
+		getFreqRange(pacPhaseBand, phaseStart, nPhase);
+		getFreqRange(pacAmpBand, ampStart, nAmp);
+		// accumulators, the TFR's PAC spectra, plus 3 copies each of MI and MVL output
+		pacMemory = PhaseAmplitudeCoupling::getMemory(nSpectrogramChans, nPhase, nAmp)
+			+ 6 * nSpectrogramChans * nPhase * nAmp * sizeof(double);
+		if (nPhase > 0 && nAmp > 0)
+		{
+			pacMemory += CumulativeTFR::getPACMemory(nInputs > 0 ? nInputs : nChans, nSpectrogramChans,
+				nPhase, nAmp, frequencies[phaseStart + nPhase - 1], nTimes, Fs, winLen, stepLen, getSegmentSeconds());
+		}
+	}
+
+	int64 surrogateMemory = 0;
+	if (surrogatesEnabled)
+	{
+		// history and null values, plus 3 copies of the thresholds
+		surrogateMemory = SurrogateCoherence::getMemory(nGroupCombs, pairs.getNumChannels(), nFreqs, nTimes,
+			surrogateHistory, nSurrogates) + 3 * int64(nGroupCombs) * nFreqs * sizeof(double);
+	}
 
+	// Full resolution first, then fall back to accumulators averaged over time
+	for (bool collapseTime : { false, true })
+	{
+		memoryPlan = CumulativeTFR::planMemory(nChans, nGroupCombs, nFreqs, nTimes, Fs, getSegmentSeconds(),
+			windowSize, collapseTime, nInputs, int(extraAlphas.size()));
+		// raw sample ring, plus the window being transformed
+		memoryPlan.dataBuffers = int64(montage.getNumInputs()) * (int64(nextPowerOfTwo(getRingCapacity())) * sizeof(float)
+			+ int64(memoryPlan.nfft) * sizeof(std::complex<double>));
+		// and the resampler of each channel at another rate, a second of input and of output
+		for (int slot = 0; slot < montage.getNumInputs(); slot++)
+		{
+			float rate = getDataChannel(montage.getInputChannel(slot))->getSampleRate();
+			if (rate != Fs)
+			{
+				memoryPlan.dataBuffers += int64(rate + Fs) * sizeof(float);
 			}
 		}
-		if (WhatisIT == 1)
+		memoryPlan.outputs = 3 * (int64(nGroupCombs) * ((2 + extraAlphas.size()) * nFreqs + 3 * nBands) * sizeof(double)
+			+ nSpectrogramChans * (nFreqs + nBands) * sizeof(float)) + pacMemory + surrogateMemory;
+
+		if (memoryPlan.getTotal() <= budget)
+		{
+			tfrStatus = String();
+			return true;
+		}
+	}
+
+	tfrStatus = "TFR needs " + String(memoryPlan.getTotal() / 1048576.0, 1) + " MB even averaged over time, over the "
+		+ String(memoryBudget, 0) + " MB budget. Use fewer channels or frequencies, or a shorter segment.";
+	return false;
+}
+
+void CoherenceNode::setMemoryBudget(float megabytes)
+{
+	memoryBudget = megabytes;
+}
+
+bool CoherenceNode::setBaselineMode(CoherenceBaseline::Mode mode)
+{
+	if (mode == CoherenceBaseline::ZSCORE && !baseline.matches(pairs.getChannelPairs(), getFrequencies()))
+	{
+		return false;
+	}
+
+	baseline.requestMode(mode);
+	return true;
+}
+
+bool CoherenceNode::saveBaseline(const File& file)
+{
+	if (baseline.getMode() == CoherenceBaseline::CAPTURE || baseline.getNumSegments() == 0)
+	{
+		return false;
+	}
+	return baseline.save(file);
+}
+
+bool CoherenceNode::loadBaseline(const File& file)
+{
+	// Baseline is used by the coherence thread during acquisition
+	if (CoreServices::getAcquisitionStatus())
+	{
+		return false;
+	}
+	return baseline.load(file);
+}
+
+bool CoherenceNode::setFrequencyGrid(FrequencyGrid grid, float perOctave, const String& list)
+{
+	StringArray tokens;
+	tokens.addTokens(list, " ,", "");
+	tokens.removeEmptyStrings();
+	for (const String& token : tokens)
+	{
+		if (!token.containsOnly("0123456789.") || token.getDoubleValue() <= 0)
+		{
+			return false;
+		}
+	}
+	if (grid == GRID_LIST && tokens.size() == 0)
+	{
+		return false;
+	}
+
+	freqGrid = grid;
+	freqsPerOctave = perOctave;
+	freqList = tokens.joinIntoString(", ");
+	updateGridSize();
+	return true;
+}
+
+std::vector<double> CoherenceNode::computeFrequencies() const
+{
+	std::vector<double> freqs;
+
+	if (freqGrid == GRID_LOG && freqsPerOctave > 0)
+	{
+		// small tolerance so freqEnd itself is included when it's on the grid
+		int nOctaveSteps = int(std::floor(std::log2(double(freqEnd) / freqStart) * freqsPerOctave + 1e-6));
+		for (int k = 0; k <= nOctaveSteps; k++)
 		{
-			TFR = new CumulativeTFR(nGroup1Chans, nGroup2Chans, nFreqs, nTimes, Fs, winLen, stepLen,
-				freqStep, freqStart, segLen, alpha);
+			freqs.push_back(freqStart * std::pow(2.0, k / double(freqsPerOctave)));
 		}
-		else if (WhatisIT == 0)
+	}
+	else if (freqGrid == GRID_LIST)
+	{
+		StringArray tokens;
+		tokens.addTokens(freqList, " ,", "");
+		tokens.removeEmptyStrings();
+		for (const String& token : tokens)
 		{
-			int NumOfChanChan = (TotalNumofChannels).size();
-			TFR = new CumulativeTFR(NumOfChanChan, 0, nFreqs, nTimes, Fs, winLen, stepLen,
-				freqStep, freqStart, segLen, alpha);
+			freqs.push_back(token.getDoubleValue());
 		}
+		std::sort(freqs.begin(), freqs.end());
+		freqs.erase(std::unique(freqs.begin(), freqs.end()), freqs.end());
 	}
 	else
 	{
-		ready = false;
+		int nLinear = int((freqEnd - freqStart) / freqStep) + 1;
+		for (int f = 0; f < nLinear; f++)
+		{
+			freqs.push_back(freqStart + f * freqStep);
+		}
 	}
+
+	return freqs;
+}
+
+void CoherenceNode::updateGridSize()
+{
+	nGridFreqs = int(computeFrequencies().size());
+}
+
+void CoherenceNode::updateFrequencies()
+{
+	frequencies = computeFrequencies();
+	nFreqs = int(frequencies.size());
+}
+
+std::vector<double> CoherenceNode::getFrequencies() const
+{
+	return frequencies;
+}
+
+void CoherenceNode::getFreqRange(const FrequencyBand& band, int& start, int& count) const
+{
+	start = int(std::lower_bound(frequencies.begin(), frequencies.end(), band.low) - frequencies.begin());
+	int end = int(std::upper_bound(frequencies.begin(), frequencies.end(), band.high) - frequencies.begin());
+	count = jmax(0, end - start);
+}
+
+bool CoherenceNode::setPACRanges(const String& phaseRange, const String& ampRange)
+{
+	std::vector<FrequencyBand> phase, amp;
+	if (!FrequencyBands::parse("phase " + phaseRange.trim(), phase) || phase.size() != 1
+		|| !FrequencyBands::parse("amplitude " + ampRange.trim(), amp) || amp.size() != 1)
+	{
+		return false;
+	}
+
+	pacPhaseBand = phase[0];
+	pacAmpBand = amp[0];
+	return true;
+}
+
+void CoherenceNode::setPACEnabled(bool enabled)
+{
+	pacEnabled = enabled;
+}
+
+void CoherenceNode::setSurrogates(bool enabled, SurrogateCoherence::Method method, int count,
+	int historySegments, float cpuPercent)
+{
+	surrogatesEnabled = enabled;
+	surrogateMethod = method;
+	nSurrogates = count;
+	surrogateHistory = historySegments;
+	surrogateCpu = cpuPercent;
+}
+
+bool CoherenceNode::setEventLocked(bool enabled, int ttlChannel, float preSeconds, float postSeconds)
+{
+	// The window length sizes the data buffers and the ring, which only change between runs
+	if (CoreServices::getAcquisitionStatus() || isThreadRunning())
+	{
+		return false;
+	}
+
+	eventLocked = enabled;
+	eventChannel = ttlChannel;
+	eventPre = preSeconds;
+	eventPost = postSeconds;
+	return true;
+}
+
+float CoherenceNode::getSegmentSeconds() const
+{
+	return eventLocked ? eventPre + eventPost : float(segLen);
+}
+
+float CoherenceNode::getAnalysisRate() const
+{
+	float rate = 0;
+	for (int slot = 0; slot < montage.getNumInputs(); slot++)
+	{
+		int chan = montage.getInputChannel(slot);
+		if (chan < getNumInputs())
+		{
+			float chanRate = getDataChannel(chan)->getSampleRate();
+			rate = rate > 0 ? jmin(rate, chanRate) : chanRate;
+		}
+	}
+	return rate;
+}
+
+void CoherenceNode::updateResamplers()
+{
+	std::vector<double> slotRates;
+	for (int slot = 0; slot < montage.getNumInputs(); slot++)
+	{
+		int chan = montage.getInputChannel(slot);
+		slotRates.push_back(chan < getNumInputs() ? getDataChannel(chan)->getSampleRate() : Fs);
+	}
+	ingest.reset(slotRates, Fs);
 }
 
-void CoherenceNode::discardCurBuffer(int nSamples)
+int CoherenceNode::getWindowSamples() const
 {
-	numArtifacts += float(nSamples) / (segLen * Fs);
-	nSamplesWait = 1 * Fs * -1; // Wait a bit after artifact before we start taking in new data (1sec to be exact)
-	nSamplesAdded = 0;
-	nSamplesWaited = 0;
+	// same rounding as the TFR's segment length
+	return int(double(getSegmentSeconds()) * Fs);
+}
+
+void CoherenceNode::setSegmentHop(float seconds)
+{
+	segmentHop = jmax(0.0f, seconds);
+}
+
+int CoherenceNode::getHopSamples() const
+{
+	return jmax(1, segmentHop > 0 ? int(double(segmentHop) * Fs) : getWindowSamples());
+}
+
+void CoherenceNode::updateComputeLoad(double seconds)
+{
+	float load = float(seconds / getWindowBudget());
+	float previous = computeLoad;
+	computeLoad = previous > 0 ? previous + LOAD_SMOOTHING * (load - previous) : load;
+}
+
+float CoherenceNode::getWindowBudget() const
+{
+	return float((eventLocked ? getWindowSamples() : getHopSamples()) / jmax(1.0f, Fs));
+}
+
+float CoherenceNode::getDataUsed() const
+{
+	float nComputed = numTrials + numArtifacts;
+	float nWindows = nComputed + skippedWindows;
+	return nWindows > 0 ? nComputed / nWindows : 1.0f;
+}
+
+void CoherenceNode::setKeepUp(bool enabled)
+{
+	keepUp = enabled;
+}
+
+int CoherenceNode::getRingCapacity() const
+{
+	// Event windows are read as soon as they're complete. Segments can start up to a hop apart.
+	// Then another window (at least a second) for the coherence thread to fall behind by
+	// before blocks get dropped.
+	int hopSamples = eventLocked ? 0 : getHopSamples();
+	return 2 * getWindowSamples() + hopSamples + int(Fs) + getMaxAlignment();
+}
+
+bool CoherenceNode::setBands(const String& spec)
+{
+	return FrequencyBands::parse(spec, bands);
+}
+
+void CoherenceNode::setRecordOutput(RecordOutput output)
+{
+	recordOutput = output;
+}
+
+int CoherenceNode::finishSegmentMask(const SegmentBuffer& segment)
+{
+	int nValid = 0;
+	for (const ChannelRoute& route : getRouting())
+	{
+		if (segment.valid[route.slot])
+		{
+			nValid++;
+		}
+		else
+		{
+			maskedSegments[route.slot]++;
+		}
+	}
+	return nValid;
 }
 
 
@@ -465,9 +1159,27 @@ bool CoherenceNode::enable()
 {
 	if (isEnabled)
 	{
+		// The last run's thread owns everything cleared below until it has exited
+		// (a segment can outlast the wait in disable)
+		waitForThreadToExit(-1);
+
 		// Start coherence calculation thread
 		numTrials = 0;
 		numArtifacts = 0;
+		for (std::atomic<int>& nMasked : maskedSegments)
+		{
+			nMasked = 0;
+		}
+
+		skippedWindows = 0;
+		computeLoad = 0;
+
+		// Samples are numbered from the start of acquisition
+		sampleRing.clear();
+		ingest.clear();
+		triggers.clear();
+		nextSegmentStart = 0;
+
 		startThread(COH_PRIORITY);
 	}
 	return isEnabled;
@@ -479,6 +1191,9 @@ bool CoherenceNode::disable()
 	editor->disable();
 
 	signalThreadShouldExit();
+	// don't wait out the timeout
+	ingest.wakeReader();
+	waitForThreadToExit(STOP_TIMEOUT_MS);
 
 	return true;
 }
@@ -553,6 +1268,16 @@ void CoherenceNode::saveCustomParametersToXml(XmlElement* parentElement)
 		group2Node->setAttribute("Chan" + String(i), group2Channels[i]);
 	}
 
+	mainNode->setAttribute("pairs", pairSpec);
+	mainNode->setAttribute("montage", montageSpec);
+	mainNode->setAttribute("detectors", detectorSpec);
+	mainNode->setAttribute("eventLocked", eventLocked);
+	mainNode->setAttribute("eventChannel", eventChannel);
+	mainNode->setAttribute("eventPre", eventPre);
+	mainNode->setAttribute("eventPost", eventPost);
+	mainNode->setAttribute("segmentHop", segmentHop);
+	mainNode->setAttribute("keepUp", keepUp.load());
+
 }
 
 void CoherenceNode::loadCustomParametersFromXml()
@@ -562,6 +1287,16 @@ void CoherenceNode::loadCustomParametersFromXml()
 	{
 		forEachXmlChildElementWithTagName(*parametersAsXml, mainNode, "COHERENCENODE")
 		{
+			pairSpec = mainNode->getStringAttribute("pairs");
+			setMontageSpec(mainNode->getStringAttribute("montage"));
+			setDetectorSpec(mainNode->getStringAttribute("detectors", "step"));
+			setEventLocked(mainNode->getBoolAttribute("eventLocked", false),
+				mainNode->getIntAttribute("eventChannel", 0),
+				float(mainNode->getDoubleAttribute("eventPre", 1)),
+				float(mainNode->getDoubleAttribute("eventPost", 3)));
+			setSegmentHop(float(mainNode->getDoubleAttribute("segmentHop", 0)));
+			setKeepUp(mainNode->getBoolAttribute("keepUp", false));
+
 			// Load group 1 channels
 			forEachXmlChildElementWithTagName(*mainNode, node, "Group1")
 			{
@@ -598,8 +1333,14 @@ void CoherenceNode::loadCustomParametersFromXml()
 			}
 		}
 
+		// Pairs from the loaded groups or spec
+		if (!setPairSpec(pairSpec))
+		{
+			setPairSpec(String());
+		}
+
 		//Start TFR
-		if (group1Channels.size() > 0 && group2Channels.size() > 0)
+		if (nGroupCombs > 0)
 		{
 			resetTFR();
 		}
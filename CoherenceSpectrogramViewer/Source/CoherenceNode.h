@@ -40,6 +40,16 @@ in units of z-score.
 //
 #include "AtomicSynchronizer.h"
 #include "CumulativeTFR.h"
+#include "CoherenceBaseline.h"
+#include "FrequencyBands.h"
+#include "ChannelPairs.h"
+#include "Montage.h"
+#include "PhaseAmplitudeCoupling.h"
+#include "SurrogateCoherence.h"
+#include "SampleRing.h"
+#include "SampleIngest.h"
+#include "PolyphaseResampler.h"
+#include "ArtifactDetectors.h"
 
 #include <time.h>
 #include <vector>
@@ -47,6 +57,44 @@ in units of z-score.
 #include <ctime> 
 #include <iostream>
 #include<fstream>
+#include <atomic>
+#include <memory>
+#include <limits>
+#include <deque>
+
+// One window of data taken from the sample ring by the coherence thread
+struct SegmentBuffer
+{
+	// # data buffer slots, each the segment zero-padded to the FFT length
+	Array<FFTWArrayType> channels;
+	// # data buffer slots, false if the slot had an artifact (or no data) in this segment
+	std::vector<bool> valid;
+};
+
+// Output of the coherence thread for one segment
+struct CoherenceResults
+{
+	// # combinations x # freqs
+	std::vector<std::vector<double>> coherence;
+	// # combinations x # bands
+	std::vector<std::vector<double>> bandCoherence;
+	// # combinations x # bands, phase-slope index and group delay (s), positive if the first channel leads
+	std::vector<std::vector<double>> phaseSlope;
+	std::vector<std::vector<double>> groupDelay;
+	// # combinations x # freqs, significance threshold from surrogates, empty if they're off
+	std::vector<std::vector<double>> coherenceThreshold;
+	// # combinations x # freqs, amplitude envelope correlation
+	std::vector<std::vector<double>> envelopeCorrelation;
+	// # extra alphas x # combinations x # freqs, coherence with each extra exponential average
+	std::vector<std::vector<std::vector<double>>> extraCoherence;
+	// # spectrogram channels x # freqs
+	std::vector<std::vector<float>> power;
+	// # spectrogram channels x # bands
+	std::vector<std::vector<float>> bandPower;
+	// # spectrogram channels x (# phase freqs x # amp freqs), empty if PAC is off
+	std::vector<std::vector<double>> pacMI;
+	std::vector<std::vector<double>> pacMVL;
+};
 
 class CoherenceNode : public GenericProcessor, public Thread
 {
@@ -64,8 +112,12 @@ public:
 
 	void setParameter(int parameterIndex, float newValue) override;
 
+	// Real-time safe: no allocation, locks or file access (see appendBlock)
 	void process(AudioSampleBuffer& continuousBuffer) override;
 
+	// Collects TTL triggers for the event-locked mode
+	void handleEvent(const EventChannel* eventInfo, const MidiMessage& event, int samplePosition = 0) override;
+
 	bool isReady() override;
 	bool enable() override;
 	bool disable() override;
@@ -86,18 +138,25 @@ public:
 	void saveCustomParametersToXml(XmlElement* parentElement) override;
 	void loadCustomParametersFromXml();
 
-	// Variable to store Power across all channels 
-	// ttlpwr[1] corresponds to channel 1 power across frequency
-	std::vector<std::vector<float>> ttlpwr;
+	// Channels shown in the spectrogram
 	Array<int> TotalNumofChannels;
 
 
 
 private:
 
-	AtomicallyShared<Array<FFTWArrayType>> dataBuffer;
-	// # Freqs x # Combinations
-	AtomicallyShared<std::vector<std::vector<double>>> meanCoherence;
+	// Raw samples of each data buffer slot, appended by process() and read by run()
+	SampleRing sampleRing;
+	// Resampling, alignment and artifact checks on the way into the ring
+	SampleIngest ingest;
+	// The current block of each input channel, filled by process()
+	std::vector<SampleIngest::ChannelBlock> channelBlocks;
+	// TTL events of the current block, collected by handleEvent during process()
+	SampleIngest::BlockEvent blockEvents[SampleIngest::MAX_PENDING_EVENTS];
+	int nBlockEvents;
+	// Current window, only used by the coherence thread
+	SegmentBuffer segment;
+	AtomicallyShared<CoherenceResults> results;
 
 	ScopedPointer<CumulativeTFR> TFR;
 	Array<bool> CHANNEL_READY;
@@ -122,18 +181,47 @@ private:
 
 	uint32 validSubProcFullID;
 
-	// returns the region for the requested channel
-	int getChanGroup(int chan);
-
-	// Append FFTWArrays to data buffer
+	// Pairs coherence is computed for, built from the groups unless pairSpec is set
+	ChannelPairs pairs;
+	// Regions or pair list read by ChannelPairs::parse, empty to use group 1 x group 2
+	String pairSpec;
+	// Returns false (pairs unchanged) if the spec can't be parsed or acquisition is running
+	bool setPairSpec(const String& spec);
+
+	// Re-referencing applied to the spectra of the pair channels (or all channels for the spectrogram)
+	Montage montage;
+	// Spec read by Montage::parse, empty for none
+	String montageSpec;
+	// Takes effect on the next resetTFR. Returns false (montage unchanged) if the spec can't be parsed.
+	bool setMontageSpec(const String& spec);
+	// Rebuild the montage for the channels the TFR reports on
+	void updateMontage();
+	// TFR slot of each spectrogram channel (TotalNumofChannels)
+	std::vector<int> spectrogramSlots;
+
+	// Returns the data buffer/TFR input slot of the requested channel, or -1 if it isn't used
+	int getChanSlot(int chan);
+
+	// Data buffer slot of each active channel the TFR decomposes, in channel order
+	using ChannelRoute = SampleIngest::Route;
+	using RoutingTable = std::vector<ChannelRoute>;
+	// process() and run() read the current table through a plain atomic pointer, so the hot paths
+	// don't allocate, lock (as std::atomic_load of a shared_ptr does), go through the editor or search
+	// the montage. Tables are never modified once published, and retired ones are only freed while
+	// acquisition is stopped, so a thread can keep using the table it loaded.
+	std::atomic<const RoutingTable*> routing;
+	// current table last, message thread only
+	std::vector<std::unique_ptr<const RoutingTable>> routingTables;
+	const RoutingTable& getRouting() const;
+	// Rebuild the table from the editor's active channels and the montage, then swap it in.
+	// Called on the message thread whenever either changes.
+	void updateRouting();
+
+	// Size the sample ring and the window buffers (newSize samples each) for the montage inputs
 	void updateDataBufferSize(int newSize);
 	void updateMeanCoherenceSize();
 
 	///// TFR vars
-	// Number of channels for region 1
-	int nGroup1Chans;
-	// Number of channels for region 2
-	int nGroup2Chans;
 	// Number of freq of interest
 	int nFreqs;
 	float freqStep;
@@ -141,47 +229,203 @@ private:
 	int freqEnd;
 	// Number of times of interest
 	int nTimes;
-	// Fs (sampling rate?)
+	// Analysis rate: the lowest sample rate of the channels the TFR decomposes. Faster channels
+	// are resampled to it as they come in.
 	float Fs;
+	// Lowest sample rate of the montage inputs, 0 if there are none
+	float getAnalysisRate() const;
 
-	float alpha;
-
-	int nSamplesAdded; // holds how many samples were added for each channel
-	AudioBuffer<float> channelData; // Holds the segment buffer for each channel.
-	int nSamplesWait; // How many seconds to wait after an artifact is seen.
-	int nSamplesWaited; // Holds how many samples we've waited after an artifact. (wait 1 second before getting data again)
+	// Rebuild the ingest's resamplers (one per data buffer slot) for the montage inputs
+	void updateResamplers();
+	// Samples a source can lead the others by (see SampleIngest::MAX_ALIGNMENT_SECONDS)
+	int getMaxAlignment() const;
 
-	// Total Combinations
+	float alpha;
+	// Sliding window length in segments (0 = cumulative/exponential averaging)
+	int windowSize;
+	// Exponential averages computed alongside the main one from the same cross-spectra
+	std::vector<double> extraAlphas;
+	static const int MAX_EXTRA_ALPHAS = 4;
+	// Comma or space separated alphas in (0, 1]. Takes effect on the next resetTFR.
+	// Returns false (alphas unchanged) if the spec can't be read.
+	bool setExtraAlphas(const String& spec);
+
+	// Total Combinations (channel pairs)
 	int nGroupCombs;
 
 	// from 0 to 10
 	static const int COH_PRIORITY = 5;
 	const char * path;
 
-	// Get iterator for this channel in it's respective group
-	int getGroupIt(int group, int chan);
-
 	void updateGroup(Array<int> group1Channels, Array<int> group2Channels);
 	void updateAlpha(float alpha);
+	void updateWindowSize(int windowSize);
+	// Bytes a sliding window of this many segments would add to the TFR, with current settings
+	int64 getWindowMemoryEstimate(int windowSize);
+	// Number of times of interest in a segment, with current settings
+	int getNumTimes() const;
 	void resetTFR();
 	void updateReady(bool isReady);
 
-	// Artifact checking
-	void discardCurBuffer(int nSamples);
-	float artifactThreshold;
+	// Memory limit for the TFR state. resetTFR averages accumulators over time if the
+	// full plan doesn't fit, and refuses (not ready) if that doesn't fit either.
+	float memoryBudget; // MB
+	TFRMemoryPlan memoryPlan; // from the last resetTFR
+	String tfrStatus; // why the last resetTFR failed or what it had to give up
+	void setMemoryBudget(float megabytes);
+	// Fills memoryPlan for the current settings. Returns false if it can't fit the budget.
+	bool planMemory();
+
+	// Baseline capture and z-scored output
+	CoherenceBaseline baseline;
+	// Returns false if z-scoring was requested but the baseline doesn't match the current settings
+	bool setBaselineMode(CoherenceBaseline::Mode mode);
+	// Can't load while acquiring or save while capturing
+	bool saveBaseline(const File& file);
+	bool loadBaseline(const File& file);
+
+	// Spacing of the frequencies of interest
+	enum FrequencyGrid
+	{
+		GRID_LINEAR = 0, // freqStart to freqEnd every freqStep
+		GRID_LOG,        // freqStart to freqEnd, freqsPerOctave per doubling
+		GRID_LIST        // freqList
+	};
+	int freqGrid;
+	float freqsPerOctave;
+	String freqList; // comma or space separated Hz
+	// Takes effect on the next resetTFR. Returns false (grid unchanged) if the list can't be parsed.
+	bool setFrequencyGrid(FrequencyGrid grid, float perOctave, const String& list);
+	// Frequencies the current settings give, ascending
+	std::vector<double> computeFrequencies() const;
+	// How many there are, kept by the setters so the visualizer can ask every frame
+	int nGridFreqs;
+	void updateGridSize();
+	// Frequencies of interest (Hz) of the current TFR
+	std::vector<double> frequencies;
+	void updateFrequencies();
+	std::vector<double> getFrequencies() const;
+	// First index and number of frequencies of interest inside a band
+	void getFreqRange(const FrequencyBand& band, int& start, int& count) const;
+
+	// Phase-amplitude coupling on the spectrogram channels
+	PhaseAmplitudeCoupling pac;
+	bool pacEnabled;
+	FrequencyBand pacPhaseBand;
+	FrequencyBand pacAmpBand;
+	// Take effect on the next resetTFR. Returns false (ranges unchanged) if a range can't be parsed.
+	bool setPACRanges(const String& phaseRange, const String& ampRange);
+	void setPACEnabled(bool enabled);
+
+	// Surrogate null distribution of coherence for each pair, computed on a thread pool
+	SurrogateCoherence surrogates;
+	bool surrogatesEnabled;
+	SurrogateCoherence::Method surrogateMethod;
+	int nSurrogates;
+	int surrogateHistory; // segments
+	float surrogateCpu; // percent of cores
+	// Takes effect on the next resetTFR
+	void setSurrogates(bool enabled, SurrogateCoherence::Method method, int count, int historySegments, float cpuPercent);
+
+	// Event-locked mode: each rising TTL on eventChannel gives one trial, from eventPre s before
+	// the trigger to eventPost s after it, instead of back-to-back segments
+	bool eventLocked;
+	int eventChannel; // TTL line
+	float eventPre;
+	float eventPost;
+	// Takes effect on the next resetTFR. Returns false (settings unchanged) during acquisition.
+	bool setEventLocked(bool enabled, int ttlChannel, float preSeconds, float postSeconds);
+	// Length of each trial given to the TFR: the segment length, or the event window
+	float getSegmentSeconds() const;
+	int getWindowSamples() const;
+
+	// Seconds from the start of one segment to the next, 0 for back-to-back segments.
+	// Shorter than the segment length gives overlapping segments. Takes effect on the next resetTFR.
+	float segmentHop;
+	void setSegmentHop(float seconds);
+	int getHopSamples() const;
+
+	// Ring sample numbers of the triggers decoded from them, coherence thread only
+	std::deque<int64> triggers;
+	// Decode the pending events, keeping the rising edges on eventChannel as triggers
+	void takeTriggers();
+
+	// Start of the next back-to-back segment in the ring, coherence thread only
+	int64 nextSegmentStart;
+	// Samples the ring needs: a window, the hop to the next one, slack for the coherence
+	// thread to fall behind by and for sources to lead each other by
+	int getRingCapacity() const;
+	// Find the next window whose samples are all in the ring (the next segment or the oldest
+	// pending trigger). Returns false if there isn't one yet, with samplesNeeded the write index
+	// at which to look again (max if it's waiting for a trigger).
+	bool takeNextWindow(int64& windowStart, int64& samplesNeeded);
+	// Sleep until process() has written samplesNeeded samples, a trigger arrives, the ring is half
+	// used (so the read index keeps moving) or WAKE_TIMEOUT_MS passes
+	void waitForSamples(int64 samplesNeeded);
+	static const int WAKE_TIMEOUT_MS = 100;
+	// How long disable waits for the thread to finish its segment
+	static const int STOP_TIMEOUT_MS = 2000;
+	// Copy a window of each routed slot out of the ring into segment. Slots with an artifact
+	// mark in the window are left invalid.
+	void readWindow(int64 windowStart);
+
+	// Backpressure. Windows the coherence thread never computed: skipped to keep up, or with
+	// dropped blocks inside them.
+	std::atomic<int> skippedWindows;
+	// Coherence thread time per window over the data time it has for it (see getWindowBudget),
+	// smoothed. Above 1 it's falling behind.
+	std::atomic<float> computeLoad;
+	static constexpr float LOAD_SMOOTHING = 0.2f;
+	void updateComputeLoad(double seconds);
+	// Seconds between windows: the hop, or the window length when event-locked
+	float getWindowBudget() const;
+	// Fraction of the windows since acquisition started that were computed (1 if none yet)
+	float getDataUsed() const;
+	// Jump to the newest complete segment instead of working through a backlog, so the plot
+	// stays current (and the ring never fills) at the cost of the skipped segments
+	std::atomic<bool> keepUp;
+	void setKeepUp(bool enabled);
+
+	// Bands that coherence and power are reduced to inside the TFR
+	std::vector<FrequencyBand> bands;
+	// Takes effect on the next resetTFR. Returns false if the spec can't be parsed.
+	bool setBands(const String& spec);
+
+	// What goes into the coherence file, one line per combination
+	enum RecordOutput
+	{
+		RECORD_BINS = 0,       // coherence at each frequency of interest
+		RECORD_BANDS,          // band averages only
+		RECORD_BINS_AND_BANDS  // frequencies, then bands on the same line
+	};
+	std::atomic<int> recordOutput;
+	void setRecordOutput(RecordOutput output);
+
+	// Artifact checking. A block with an artifact goes into the ring as NaN, and masks its channel
+	// in every window it's part of; a window is only discarded if every channel is masked.
+	float artifactThreshold; // for step detectors without their own threshold
+	// Detector chains run on each block of each channel
+	ArtifactDetectors artifactDetectors;
+	// Spec read by ArtifactDetectors::parse
+	String detectorSpec;
+	// Takes effect on the next resetTFR. Returns false (detectors unchanged) if the spec can't be parsed.
+	bool setDetectorSpec(const String& spec);
 	int numTrials;
 	float numArtifacts;
+	// # data buffer slots, segments each slot was masked in since acquisition started
+	// (counted on the coherence thread, read by the visualizer)
+	std::vector<std::atomic<int>> maskedSegments;
+	// Count the masked routed slots of a window. Returns the number of slots left valid.
+	int finishSegmentMask(const SegmentBuffer& segment);
 
+	// Only touched by the coherence thread, so the audio thread never does file I/O
 	std::ofstream cohFile;
 	void checkCohFile();
 
-	// This is to store data in case of switch and we wish to retrive old data
-	AtomicallyShared<Array<FFTWArrayType>> dataBufferII;
-	// Int variable can occupy two values 1 and 0. 
+	// Which view is shown, both are always computed.
 	// 1 means Coherence
 	// 0 means Spectrogram
-	// This seperates coherence and spectrogram logically
-    int WhatisIT; // MOVED TO .cpp when created. = 1;//1-Coherence & 0-Spectrogram
+	int WhatisIT;
 	/*End*/
 
 	enum Parameter
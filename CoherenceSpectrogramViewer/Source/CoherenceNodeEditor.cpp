@@ -195,6 +195,7 @@ void CoherenceEditor::channelChanged(int chan, bool newState)
 {
     CoherenceVisualizer* cohCanvas = static_cast<CoherenceVisualizer*>(canvas.get());
     cohCanvas->channelChanged(chan, newState);
+    processor->updateRouting();
 }
 
 Visualizer* CoherenceEditor::createNewCanvas()
@@ -30,6 +30,7 @@ CoherenceVisualizer::CoherenceVisualizer(CoherenceNode* n)
 	, freqStart(processor->freqStart)
 	, freqEnd(processor->freqEnd)
 	, canvasBounds(0, 0, 1, 1)
+	, shownWindowMemory(-1)
 {
 	refreshRate = 2;
 	;
@@ -112,6 +113,9 @@ CoherenceVisualizer::CoherenceVisualizer(CoherenceNode* n)
 
 	static const String linearTip = "Linear weighting of coherence & spectrogram.";
 	static const String expTip = "Exponential weighting of coherence & spectrogram. Set alpha using -1/alpha weighting.";
+	static const String windowTip = "Exact average over the last N segments. Costs N values per accumulator.";
+	static const String extraAlphaTip = "Up to 4 more alphas (e.g. \"0.5, 0.05\"), each plotted as its own line. "
+		"They share the cross-spectra of the main average, so each only adds its accumulators.";
 	static const String resetTip = "Clears and resets the algorithm. Must be done after changes are made on this page!";
 
 
@@ -184,7 +188,57 @@ CoherenceVisualizer::CoherenceVisualizer(CoherenceNode* n)
 	canvas->addAndMakeVisible(alphaE);
 	canvasBounds = canvasBounds.getUnion(bounds);
 
-	columnTwoSet->addGroup({ linearButton, expButton, alpha, alphaE });
+	// ------- Sliding Window ------- //
+	yPos += 20;
+	windowButton = new ToggleButton("Sliding Window");
+	windowButton->setBounds(bounds = { ColumnII, yPos, 120, TEXT_HT });
+	windowButton->setToggleState(false, dontSendNotification);
+	windowButton->addListener(this);
+	windowButton->setTooltip(windowTip);
+	canvas->addAndMakeVisible(windowButton);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	windowLabel = new Label("windowLabel", "Segments: ");
+	windowLabel->setBounds(bounds = { ColumnII + 15, yPos, 70, TEXT_HT });
+	canvas->addAndMakeVisible(windowLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	windowE = new Label("windowE", "10");
+	windowE->setEditable(true);
+	windowE->addListener(this);
+	windowE->setBounds(bounds = { ColumnII + 85, yPos, 30, TEXT_HT });
+	windowE->setColour(Label::backgroundColourId, Colours::grey);
+	windowE->setColour(Label::textColourId, Colours::white);
+	canvas->addAndMakeVisible(windowE);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	windowMemory = new Label("windowMemory", "");
+	windowMemory->setBounds(bounds = { ColumnII + 15, yPos, 150, TEXT_HT });
+	windowMemory->setTooltip(windowTip);
+	canvas->addAndMakeVisible(windowMemory);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	extraAlphaLabel = new Label("extraAlphaLabel", "Also alphas: ");
+	extraAlphaLabel->setBounds(bounds = { ColumnII, yPos, 80, TEXT_HT });
+	extraAlphaLabel->setTooltip(extraAlphaTip);
+	canvas->addAndMakeVisible(extraAlphaLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	extraAlphaE = new Label("extraAlphaE", "");
+	extraAlphaE->setEditable(true);
+	extraAlphaE->addListener(this);
+	extraAlphaE->setBounds(bounds = { ColumnII + 80, yPos, 85, TEXT_HT });
+	extraAlphaE->setColour(Label::backgroundColourId, Colours::grey);
+	extraAlphaE->setColour(Label::textColourId, Colours::white);
+	extraAlphaE->setTooltip(extraAlphaTip);
+	canvas->addAndMakeVisible(extraAlphaE);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	columnTwoSet->addGroup({ linearButton, expButton, alpha, alphaE, windowButton, windowLabel, windowE, windowMemory,
+		extraAlphaLabel, extraAlphaE });
 
 	// ------- Artifact Threshold ------- //
 	static const String artifactTip = "Checks the current power value minus the last power value. If the change is too large it is considered an artifact and the current buffer will be reset.";
@@ -228,7 +282,30 @@ CoherenceVisualizer::CoherenceVisualizer(CoherenceNode* n)
 	canvasBounds = canvasBounds.getUnion(bounds);
 	//canvas->addAndMakeVisible(artifactDesc);
 
-	columnTwoSet->addGroup({ artifactDesc, artifactEq, artifactE });
+	static const String detectorsTip = "Artifact detector chain, e.g. \"step, clip 5000, rms 6, line 200\". "
+		"step [uV]: jump between samples (the threshold above if none given), clip: |x| limit, "
+		"rms: block RMS z-score vs its running mean, line: mean jump per sample. "
+		"Per channel chains after ';', e.g. \"step; 1-4: clip 4000, rms 5\".";
+
+	yPos += 20;
+	detectorsLabel = new Label("detectorsLabel", "Detectors:");
+	detectorsLabel->setBounds(bounds = { ColumnII, yPos, 65, TEXT_HT });
+	detectorsLabel->setTooltip(detectorsTip);
+	canvas->addAndMakeVisible(detectorsLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	detectorsE = new Label("detectorsE", processor->detectorSpec);
+	detectorsE->setEditable(true);
+	detectorsE->addListener(this);
+	detectorsE->setBounds(bounds = { ColumnII + 65, yPos, 100, TEXT_HT });
+	detectorsE->setFont(Font(12, Font::plain));
+	detectorsE->setColour(Label::backgroundColourId, Colours::grey);
+	detectorsE->setColour(Label::textColourId, Colours::white);
+	detectorsE->setTooltip(detectorsTip);
+	canvas->addAndMakeVisible(detectorsE);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	columnTwoSet->addGroup({ artifactDesc, artifactEq, artifactE, detectorsLabel, detectorsE });
 
 	// ------- Frequencies of Interest ------- //
 	yPos += 20;
@@ -301,7 +378,480 @@ CoherenceVisualizer::CoherenceVisualizer(CoherenceNode* n)
 	canvasBounds = canvasBounds.getUnion(bounds);
 	//xPos -= freqLabelWidth + 10;
 
-	columnTwoSet->addGroup({ foiLabel, fstartLabel, fstartEditable, fendLabel, fendEditable, fstepLabel, fstepEditable });
+	// Spacing
+	static const String gridTip = "Linear: every Freq Step. Log: a fixed number of frequencies per octave between start and end. "
+		"List: only the listed frequencies (Hz). Each frequency costs one wavelet convolution per channel.";
+
+	yPos += 20;
+	fgridLabel = new Label("fgridLabel", "Spacing:");
+	fgridLabel->setBounds(bounds = { ColumnII, yPos, freqLabelWidth, TEXT_HT });
+	fgridLabel->setTooltip(gridTip);
+	canvas->addAndMakeVisible(fgridLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	fgridBox = new ComboBox("Frequency Grid Box");
+	fgridBox->addItem("Linear", CoherenceNode::GRID_LINEAR + 1);
+	fgridBox->addItem("Log", CoherenceNode::GRID_LOG + 1);
+	fgridBox->addItem("List", CoherenceNode::GRID_LIST + 1);
+	fgridBox->setSelectedId(processor->freqGrid + 1, dontSendNotification);
+	fgridBox->setBounds(bounds = { ColumnII + freqLabelWidth + 10, yPos, 70, TEXT_HT });
+	fgridBox->setTooltip(gridTip);
+	fgridBox->addListener(this);
+	canvas->addAndMakeVisible(fgridBox);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	foctaveLabel = new Label("foctaveLabel", "Per Octave:");
+	foctaveLabel->setBounds(bounds = { ColumnII, yPos, freqLabelWidth, TEXT_HT });
+	canvas->addAndMakeVisible(foctaveLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	foctaveEditable = new Label("foctaveEditable", String(processor->freqsPerOctave));
+	foctaveEditable->setEditable(true);
+	foctaveEditable->addListener(this);
+	foctaveEditable->setBounds(bounds = { ColumnII + freqLabelWidth + 10, yPos, 40, TEXT_HT });
+	foctaveEditable->setColour(Label::backgroundColourId, Colours::grey);
+	foctaveEditable->setColour(Label::textColourId, Colours::white);
+	canvas->addAndMakeVisible(foctaveEditable);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	flistLabel = new Label("flistLabel", "List (Hz):");
+	flistLabel->setBounds(bounds = { ColumnII, yPos, freqLabelWidth, TEXT_HT });
+	canvas->addAndMakeVisible(flistLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	flistEditable = new Label("flistEditable", processor->freqList);
+	flistEditable->setEditable(true);
+	flistEditable->addListener(this);
+	flistEditable->setBounds(bounds = { ColumnII, yPos, freqLabelWidth + 50, TEXT_HT });
+	flistEditable->setFont(Font(12, Font::plain));
+	flistEditable->setColour(Label::backgroundColourId, Colours::grey);
+	flistEditable->setColour(Label::textColourId, Colours::white);
+	canvas->addAndMakeVisible(flistEditable);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	columnTwoSet->addGroup({ foiLabel, fstartLabel, fstartEditable, fendLabel, fendEditable, fstepLabel, fstepEditable,
+		fgridLabel, fgridBox, foctaveLabel, foctaveEditable, flistLabel, flistEditable });
+
+	// ------- Baseline ------- //
+	static const String captureTip = "Collect the mean and variance of coherence over the following segments as a baseline. Restarts the baseline.";
+	static const String zScoreTip = "Show and record coherence as a z-score relative to the captured or loaded baseline.";
+
+	int ColumnIII = 945;
+	yPos = 60;
+	columnThreeSet = new VerticalGroupSet("Column 3");
+	canvas->addAndMakeVisible(columnThreeSet, 0);
+
+	baselineTitle = new Label("baselineTitle", "Baseline");
+	baselineTitle->setBounds(bounds = { ColumnIII, yPos, 165, TEXT_HT });
+	baselineTitle->setFont(Font(14, Font::bold));
+	canvas->addAndMakeVisible(baselineTitle);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	captureBaselineButton = new ToggleButton("Capture Baseline");
+	captureBaselineButton->setBounds(bounds = { ColumnIII, yPos, 165, TEXT_HT });
+	captureBaselineButton->addListener(this);
+	captureBaselineButton->setTooltip(captureTip);
+	canvas->addAndMakeVisible(captureBaselineButton);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	zScoreButton = new ToggleButton("Z-Score vs Baseline");
+	zScoreButton->setBounds(bounds = { ColumnIII, yPos, 165, TEXT_HT });
+	zScoreButton->addListener(this);
+	zScoreButton->setTooltip(zScoreTip);
+	canvas->addAndMakeVisible(zScoreButton);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 25;
+	saveBaselineButton = new TextButton("Save");
+	saveBaselineButton->setBounds(bounds = { ColumnIII, yPos, 80, TEXT_HT });
+	saveBaselineButton->addListener(this);
+	canvas->addAndMakeVisible(saveBaselineButton);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	loadBaselineButton = new TextButton("Load");
+	loadBaselineButton->setBounds(bounds = { ColumnIII + 85, yPos, 80, TEXT_HT });
+	loadBaselineButton->addListener(this);
+	canvas->addAndMakeVisible(loadBaselineButton);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 25;
+	baselineStatus = new Label("baselineStatus", "No baseline");
+	baselineStatus->setBounds(bounds = { ColumnIII, yPos, 165, TEXT_HT });
+	canvas->addAndMakeVisible(baselineStatus);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	columnThreeSet->addGroup({ baselineTitle, captureBaselineButton, zScoreButton,
+		saveBaselineButton, loadBaselineButton, baselineStatus });
+
+	// ------- Memory ------- //
+	static const String budgetTip = "Most memory the TFR may use. If needed, values are averaged over time to fit; if that doesn't fit either, reset is refused.";
+
+	yPos += 40;
+	memoryTitle = new Label("memoryTitle", "Memory");
+	memoryTitle->setBounds(bounds = { ColumnIII, yPos, 165, TEXT_HT });
+	memoryTitle->setFont(Font(14, Font::bold));
+	canvas->addAndMakeVisible(memoryTitle);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	budgetLabel = new Label("budgetLabel", "Budget (MB):");
+	budgetLabel->setBounds(bounds = { ColumnIII, yPos, 100, TEXT_HT });
+	budgetLabel->setTooltip(budgetTip);
+	canvas->addAndMakeVisible(budgetLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	budgetE = new Label("budgetE", String(processor->memoryBudget, 0));
+	budgetE->setEditable(true);
+	budgetE->addListener(this);
+	budgetE->setBounds(bounds = { ColumnIII + 105, yPos, 60, TEXT_HT });
+	budgetE->setColour(Label::backgroundColourId, Colours::grey);
+	budgetE->setColour(Label::textColourId, Colours::white);
+	budgetE->setTooltip(budgetTip);
+	canvas->addAndMakeVisible(budgetE);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	memoryPlanLabel = new Label("memoryPlanLabel", "");
+	memoryPlanLabel->setBounds(bounds = { ColumnIII, yPos, 165, 130 });
+	memoryPlanLabel->setFont(Font(12, Font::plain));
+	canvas->addAndMakeVisible(memoryPlanLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	columnThreeSet->addGroup({ memoryTitle, budgetLabel, budgetE, memoryPlanLabel });
+
+	// ------- Bands ------- //
+	static const String bandsTip = "Bands computed by the TFR, as \"name low-high\" separated by commas. Each is a weighted average of the frequencies it overlaps.";
+	static const String recordTip = "What the coherence file holds for each combination: every frequency, the bands, or both (frequencies first).";
+
+	yPos += 140;
+	bandsTitle = new Label("bandsTitle", "Bands");
+	bandsTitle->setBounds(bounds = { ColumnIII, yPos, 165, TEXT_HT });
+	bandsTitle->setFont(Font(14, Font::bold));
+	canvas->addAndMakeVisible(bandsTitle);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	bandsE = new Label("bandsE", FrequencyBands::toString(processor->bands));
+	bandsE->setEditable(true);
+	bandsE->addListener(this);
+	bandsE->setBounds(bounds = { ColumnIII, yPos, 165, TEXT_HT });
+	bandsE->setFont(Font(12, Font::plain));
+	bandsE->setColour(Label::backgroundColourId, Colours::grey);
+	bandsE->setColour(Label::textColourId, Colours::white);
+	bandsE->setTooltip(bandsTip);
+	canvas->addAndMakeVisible(bandsE);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 25;
+	recordLabel = new Label("recordLabel", "Record:");
+	recordLabel->setBounds(bounds = { ColumnIII, yPos, 60, TEXT_HT });
+	recordLabel->setTooltip(recordTip);
+	canvas->addAndMakeVisible(recordLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	recordBox = new ComboBox("Record Output Box");
+	recordBox->addItem("Frequencies", CoherenceNode::RECORD_BINS + 1);
+	recordBox->addItem("Bands", CoherenceNode::RECORD_BANDS + 1);
+	recordBox->addItem("Both", CoherenceNode::RECORD_BINS_AND_BANDS + 1);
+	recordBox->setSelectedId(processor->recordOutput + 1, dontSendNotification);
+	recordBox->setBounds(bounds = { ColumnIII + 65, yPos, 100, TEXT_HT });
+	recordBox->setTooltip(recordTip);
+	recordBox->addListener(this);
+	canvas->addAndMakeVisible(recordBox);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 25;
+	bandValues = new Label("bandValues", "");
+	bandValues->setBounds(bounds = { ColumnIII, yPos, 165, 80 });
+	bandValues->setFont(Font(11, Font::plain));
+	canvas->addAndMakeVisible(bandValues);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	columnThreeSet->addGroup({ bandsTitle, bandsE, recordLabel, recordBox, bandValues });
+
+	// ------- Pairs ------- //
+	static const String pairsTip = "Channel pairs to compute coherence for. Empty uses every group 1 channel with every group 2 channel. "
+		"Regions: \"HPC: 1-4; PFC: 5 6 | HPC-PFC, HPC-HPC\". List: \"1-5, 2-6\".";
+
+	yPos += 90;
+	pairsTitle = new Label("pairsTitle", "Pairs");
+	pairsTitle->setBounds(bounds = { ColumnIII, yPos, 165, TEXT_HT });
+	pairsTitle->setFont(Font(14, Font::bold));
+	canvas->addAndMakeVisible(pairsTitle);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	pairsE = new Label("pairsE", processor->pairSpec);
+	pairsE->setEditable(true);
+	pairsE->addListener(this);
+	pairsE->setBounds(bounds = { ColumnIII, yPos, 165, TEXT_HT });
+	pairsE->setFont(Font(12, Font::plain));
+	pairsE->setColour(Label::backgroundColourId, Colours::grey);
+	pairsE->setColour(Label::textColourId, Colours::white);
+	pairsE->setTooltip(pairsTip);
+	canvas->addAndMakeVisible(pairsE);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	pairsInfo = new Label("pairsInfo", "");
+	pairsInfo->setBounds(bounds = { ColumnIII, yPos, 165, TEXT_HT });
+	pairsInfo->setFont(Font(12, Font::plain));
+	canvas->addAndMakeVisible(pairsInfo);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	static const String montageTip = "Re-reference channels using their spectra (no extra FFTs). "
+		"\"CAR\": minus the average of all channels in use, \"CAR: 1-16\": minus the average of 1-16, \"1-2, 3-4\": bipolar.";
+
+	yPos += 20;
+	montageLabel = new Label("montageLabel", "Reference:");
+	montageLabel->setBounds(bounds = { ColumnIII, yPos, 70, TEXT_HT });
+	montageLabel->setTooltip(montageTip);
+	canvas->addAndMakeVisible(montageLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	montageE = new Label("montageE", processor->montageSpec);
+	montageE->setEditable(true);
+	montageE->addListener(this);
+	montageE->setBounds(bounds = { ColumnIII + 75, yPos, 90, TEXT_HT });
+	montageE->setFont(Font(12, Font::plain));
+	montageE->setColour(Label::backgroundColourId, Colours::grey);
+	montageE->setColour(Label::textColourId, Colours::white);
+	montageE->setTooltip(montageTip);
+	canvas->addAndMakeVisible(montageE);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	columnThreeSet->addGroup({ pairsTitle, pairsE, pairsInfo, montageLabel, montageE });
+
+	// ------- Phase-Amplitude Coupling ------- //
+	static const String pacTip = "Modulation index and mean vector length between the phase of the phase frequencies "
+		"and the amplitude of the amplitude frequencies, for each spectrogram channel. Uses the existing spectra.";
+
+	yPos += 40;
+	pacButton = new ToggleButton("Phase-Amplitude Coupling");
+	pacButton->setBounds(bounds = { ColumnIII, yPos, 165, TEXT_HT });
+	pacButton->setToggleState(processor->pacEnabled, dontSendNotification);
+	pacButton->addListener(this);
+	pacButton->setTooltip(pacTip);
+	canvas->addAndMakeVisible(pacButton);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	pacPhaseLabel = new Label("pacPhaseLabel", "Phase (Hz):");
+	pacPhaseLabel->setBounds(bounds = { ColumnIII, yPos, 100, TEXT_HT });
+	canvas->addAndMakeVisible(pacPhaseLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	pacPhaseE = new Label("pacPhaseE", String(processor->pacPhaseBand.low) + "-" + String(processor->pacPhaseBand.high));
+	pacPhaseE->setEditable(true);
+	pacPhaseE->addListener(this);
+	pacPhaseE->setBounds(bounds = { ColumnIII + 105, yPos, 60, TEXT_HT });
+	pacPhaseE->setColour(Label::backgroundColourId, Colours::grey);
+	pacPhaseE->setColour(Label::textColourId, Colours::white);
+	canvas->addAndMakeVisible(pacPhaseE);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	pacAmpLabel = new Label("pacAmpLabel", "Amplitude (Hz):");
+	pacAmpLabel->setBounds(bounds = { ColumnIII, yPos, 100, TEXT_HT });
+	canvas->addAndMakeVisible(pacAmpLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	pacAmpE = new Label("pacAmpE", String(processor->pacAmpBand.low) + "-" + String(processor->pacAmpBand.high));
+	pacAmpE->setEditable(true);
+	pacAmpE->addListener(this);
+	pacAmpE->setBounds(bounds = { ColumnIII + 105, yPos, 60, TEXT_HT });
+	pacAmpE->setColour(Label::backgroundColourId, Colours::grey);
+	pacAmpE->setColour(Label::textColourId, Colours::white);
+	canvas->addAndMakeVisible(pacAmpE);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	pacValues = new Label("pacValues", "");
+	pacValues->setBounds(bounds = { ColumnIII, yPos, 165, 80 });
+	pacValues->setFont(Font(12, Font::plain));
+	canvas->addAndMakeVisible(pacValues);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	columnThreeSet->addGroup({ pacButton, pacPhaseLabel, pacPhaseE, pacAmpLabel, pacAmpE, pacValues });
+
+	// ------- Surrogates ------- //
+	static const String surrogateTip = "Builds a null distribution of coherence over the last segments by circularly "
+		"shifting or shuffling the second channel of each pair, on worker threads. The 95th percentile is plotted in red.";
+
+	yPos += 90;
+	surrogateButton = new ToggleButton("Surrogate Significance");
+	surrogateButton->setBounds(bounds = { ColumnIII, yPos, 165, TEXT_HT });
+	surrogateButton->setToggleState(processor->surrogatesEnabled, dontSendNotification);
+	surrogateButton->addListener(this);
+	surrogateButton->setTooltip(surrogateTip);
+	canvas->addAndMakeVisible(surrogateButton);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	surrogateMethodBox = new ComboBox("Surrogate Method Box");
+	surrogateMethodBox->addItem("Circular shift", SurrogateCoherence::CIRCULAR_SHIFT + 1);
+	surrogateMethodBox->addItem("Trial shuffle", SurrogateCoherence::TRIAL_SHUFFLE + 1);
+	surrogateMethodBox->setSelectedId(processor->surrogateMethod + 1, dontSendNotification);
+	surrogateMethodBox->setBounds(bounds = { ColumnIII, yPos, 165, TEXT_HT });
+	surrogateMethodBox->setTooltip(surrogateTip);
+	surrogateMethodBox->addListener(this);
+	canvas->addAndMakeVisible(surrogateMethodBox);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	surrogateCountLabel = new Label("surrogateCountLabel", "Surrogates:");
+	surrogateCountLabel->setBounds(bounds = { ColumnIII, yPos, 100, TEXT_HT });
+	canvas->addAndMakeVisible(surrogateCountLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	surrogateCountE = new Label("surrogateCountE", String(processor->nSurrogates));
+	surrogateCountE->setEditable(true);
+	surrogateCountE->addListener(this);
+	surrogateCountE->setBounds(bounds = { ColumnIII + 105, yPos, 60, TEXT_HT });
+	surrogateCountE->setColour(Label::backgroundColourId, Colours::grey);
+	surrogateCountE->setColour(Label::textColourId, Colours::white);
+	canvas->addAndMakeVisible(surrogateCountE);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	surrogateHistoryLabel = new Label("surrogateHistoryLabel", "History (segs):");
+	surrogateHistoryLabel->setBounds(bounds = { ColumnIII, yPos, 100, TEXT_HT });
+	canvas->addAndMakeVisible(surrogateHistoryLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	surrogateHistoryE = new Label("surrogateHistoryE", String(processor->surrogateHistory));
+	surrogateHistoryE->setEditable(true);
+	surrogateHistoryE->addListener(this);
+	surrogateHistoryE->setBounds(bounds = { ColumnIII + 105, yPos, 60, TEXT_HT });
+	surrogateHistoryE->setColour(Label::backgroundColourId, Colours::grey);
+	surrogateHistoryE->setColour(Label::textColourId, Colours::white);
+	canvas->addAndMakeVisible(surrogateHistoryE);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	surrogateCpuLabel = new Label("surrogateCpuLabel", "CPU (%):");
+	surrogateCpuLabel->setBounds(bounds = { ColumnIII, yPos, 100, TEXT_HT });
+	canvas->addAndMakeVisible(surrogateCpuLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	surrogateCpuE = new Label("surrogateCpuE", String(processor->surrogateCpu));
+	surrogateCpuE->setEditable(true);
+	surrogateCpuE->addListener(this);
+	surrogateCpuE->setBounds(bounds = { ColumnIII + 105, yPos, 60, TEXT_HT });
+	surrogateCpuE->setColour(Label::backgroundColourId, Colours::grey);
+	surrogateCpuE->setColour(Label::textColourId, Colours::white);
+	canvas->addAndMakeVisible(surrogateCpuE);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	columnThreeSet->addGroup({ surrogateButton, surrogateMethodBox, surrogateCountLabel, surrogateCountE,
+		surrogateHistoryLabel, surrogateHistoryE, surrogateCpuLabel, surrogateCpuE });
+
+	// ------- Segment Hop ------- //
+	static const String hopTip = "Seconds from the start of one segment to the next. 0 gives back-to-back "
+		"segments; less than the segment length gives overlapping segments, for more frequent updates.";
+
+	yPos += 30;
+	segmentHopLabel = new Label("segmentHopLabel", "Segment hop (s):");
+	segmentHopLabel->setBounds(bounds = { ColumnIII, yPos, 100, TEXT_HT });
+	segmentHopLabel->setTooltip(hopTip);
+	canvas->addAndMakeVisible(segmentHopLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	segmentHopE = new Label("segmentHopE", String(processor->segmentHop));
+	segmentHopE->setEditable(true);
+	segmentHopE->addListener(this);
+	segmentHopE->setBounds(bounds = { ColumnIII + 105, yPos, 60, TEXT_HT });
+	segmentHopE->setColour(Label::backgroundColourId, Colours::grey);
+	segmentHopE->setColour(Label::textColourId, Colours::white);
+	segmentHopE->setTooltip(hopTip);
+	canvas->addAndMakeVisible(segmentHopE);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	keepUpButton = new ToggleButton("Keep up (skip backlog)");
+	keepUpButton->setBounds(bounds = { ColumnIII, yPos, 165, TEXT_HT });
+	keepUpButton->setToggleState(processor->keepUp, dontSendNotification);
+	keepUpButton->addListener(this);
+	keepUpButton->setTooltip("If the calculation falls behind, skip to the newest segment instead of working "
+		"through the backlog. The plot stays current, but skipped segments are left out of the averages.");
+	canvas->addAndMakeVisible(keepUpButton);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	loadLabel = new Label("loadLabel", "Load: -");
+	loadLabel->setBounds(bounds = { ColumnIII, yPos, 165, TEXT_HT });
+	loadLabel->setFont(Font(12, Font::plain));
+	canvas->addAndMakeVisible(loadLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	columnThreeSet->addGroup({ segmentHopLabel, segmentHopE, keepUpButton, loadLabel });
+
+	// ------- Event-Locked ------- //
+	static const String eventTip = "Use one trial per rising TTL edge on this line, from Pre seconds before the "
+		"trigger to Post seconds after it, instead of back-to-back segments.";
+
+	yPos += 30;
+	eventButton = new ToggleButton("Event-Locked");
+	eventButton->setBounds(bounds = { ColumnIII, yPos, 165, TEXT_HT });
+	eventButton->setToggleState(processor->eventLocked, dontSendNotification);
+	eventButton->addListener(this);
+	eventButton->setTooltip(eventTip);
+	canvas->addAndMakeVisible(eventButton);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	eventChannelLabel = new Label("eventChannelLabel", "TTL line:");
+	eventChannelLabel->setBounds(bounds = { ColumnIII, yPos, 100, TEXT_HT });
+	canvas->addAndMakeVisible(eventChannelLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	eventChannelE = new Label("eventChannelE", String(processor->eventChannel + 1));
+	eventChannelE->setEditable(true);
+	eventChannelE->addListener(this);
+	eventChannelE->setBounds(bounds = { ColumnIII + 105, yPos, 60, TEXT_HT });
+	eventChannelE->setColour(Label::backgroundColourId, Colours::grey);
+	eventChannelE->setColour(Label::textColourId, Colours::white);
+	canvas->addAndMakeVisible(eventChannelE);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	eventPreLabel = new Label("eventPreLabel", "Pre (s):");
+	eventPreLabel->setBounds(bounds = { ColumnIII, yPos, 100, TEXT_HT });
+	canvas->addAndMakeVisible(eventPreLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	eventPreE = new Label("eventPreE", String(processor->eventPre));
+	eventPreE->setEditable(true);
+	eventPreE->addListener(this);
+	eventPreE->setBounds(bounds = { ColumnIII + 105, yPos, 60, TEXT_HT });
+	eventPreE->setColour(Label::backgroundColourId, Colours::grey);
+	eventPreE->setColour(Label::textColourId, Colours::white);
+	canvas->addAndMakeVisible(eventPreE);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	yPos += 20;
+	eventPostLabel = new Label("eventPostLabel", "Post (s):");
+	eventPostLabel->setBounds(bounds = { ColumnIII, yPos, 100, TEXT_HT });
+	canvas->addAndMakeVisible(eventPostLabel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	eventPostE = new Label("eventPostE", String(processor->eventPost));
+	eventPostE->setEditable(true);
+	eventPostE->addListener(this);
+	eventPostE->setBounds(bounds = { ColumnIII + 105, yPos, 60, TEXT_HT });
+	eventPostE->setColour(Label::backgroundColourId, Colours::grey);
+	eventPostE->setColour(Label::textColourId, Colours::white);
+	canvas->addAndMakeVisible(eventPostE);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	columnThreeSet->addGroup({ eventButton, eventChannelLabel, eventChannelE, eventPreLabel, eventPreE,
+		eventPostLabel, eventPostE });
+
 	// ------- Plot ------- //
 	int col3 = 330;
 	cohPlot = new MatlabLikePlot();
@@ -345,6 +895,7 @@ CoherenceVisualizer::CoherenceVisualizer(CoherenceNode* n)
 	channelGroupSet->setBounds(canvasBounds);
 	combinationGroupSet->setBounds(canvasBounds);
 	columnTwoSet->setBounds(canvasBounds);
+	columnThreeSet->setBounds(canvasBounds);
 	viewport->setViewedComponent(canvas, false);
 	viewport->setScrollBarsShown(true, true);
 	addAndMakeVisible(viewport);
@@ -378,6 +929,19 @@ void CoherenceVisualizer::update()
 		expButton->setToggleState(true, dontSendNotification);
 		alphaE->setText(String(alpha), dontSendNotification);
 	}
+	else if (processor->windowSize > 0)
+	{
+		linearButton->setToggleState(false, dontSendNotification);
+
+		windowButton->setToggleState(true, dontSendNotification);
+		windowE->setText(String(processor->windowSize), dontSendNotification);
+	}
+
+	pairsE->setText(processor->pairSpec, dontSendNotification);
+	montageE->setText(processor->montageSpec, dontSendNotification);
+	detectorsE->setText(processor->detectorSpec, dontSendNotification);
+	segmentHopE->setText(String(processor->segmentHop), dontSendNotification);
+	keepUpButton->setToggleState(processor->keepUp, dontSendNotification);
 }
 
 void CoherenceVisualizer::updateElectrodeButtons(int numInputs, int numButtons)
@@ -416,15 +980,12 @@ void CoherenceVisualizer::updateCombList()
 {
 	combinationBox->clear(dontSendNotification);
 	combinationBox->addItem("Average across all combinations", 1);
-	for (int i = 0, comb = 2; i < group1Channels.size(); i++)
+	for (int comb = 0; comb < processor->pairs.getNumPairs(); comb++)
 	{
-		for (int j = 0; j < group2Channels.size(); j++, ++comb)
-		{
-			// using 1-based comb ids since 0 is reserved for "nothing selected"
-			combinationBox->addItem(String(group1Channels[i] + 1) + " x " + String(group2Channels[j] + 1), comb);
-		}
+		// using 1-based comb ids since 0 is reserved for "nothing selected"
+		combinationBox->addItem(processor->pairs.getPairName(comb), comb + 2);
 	}
-	if (group1Channels.size() > 0 && group2Channels.size() > 0)
+	if (processor->pairs.getNumPairs() > 0)
 	{
 		combinationBox->setSelectedId(1);
 	}
@@ -466,10 +1027,29 @@ void CoherenceVisualizer::paint(Graphics& g)
 
 void CoherenceVisualizer::refresh()
 {
+	// Channels masked for artifacts, and how often
+	String maskedText;
+	int nMaskedChans = 0;
+	for (int slot = 0; slot < processor->maskedSegments.size() && slot < processor->montage.getNumInputs(); slot++)
+	{
+		int nMasked = processor->maskedSegments[slot];
+		if (nMasked > 0)
+		{
+			maskedText += "CH" + String(processor->montage.getInputChannel(slot) + 1) + ": masked in "
+				+ String(nMasked) + " segments\n";
+			nMaskedChans++;
+		}
+	}
+
 	// If we have any artifacts let the user know
-	if (processor->numArtifacts > 0)
+	if (processor->numArtifacts > 0 || nMaskedChans > 0)
 	{
-		artifactCount->setText(String("Buffers Handled: " + String(processor->numTrials) + " & Buffers Discarded: " + String(ceil(processor->numArtifacts))), dontSendNotification);
+		artifactCount->setText(String("Buffers Handled: " + String(processor->numTrials) + " & Buffers Discarded: " + String(ceil(processor->numArtifacts)))
+			+ " & Channels Masked: " + String(nMaskedChans), dontSendNotification);
+		if (nMaskedChans > 0)
+		{
+			artifactCount->setTooltip(maskedText.trimEnd());
+		}
 		if (!viewport->isParentOf(artifactCount))
 		{
             canvas->addAndMakeVisible(artifactCount);
@@ -480,18 +1060,59 @@ void CoherenceVisualizer::refresh()
 		canvas->removeChildComponent(canvas->getIndexOfChildComponent(artifactCount));
 	}
 
-	// Update plot if frequency has changed.
-	if (freqStart != processor->freqStart || freqEnd != processor->freqEnd)
+	updateLoadStatus();
+
+	// Update plot if frequency has changed. A list can lie anywhere, so go by the frequencies themselves.
+	const std::vector<double>& freqs = processor->frequencies;
+	int newFreqStart = freqs.empty() ? processor->freqStart : int(std::floor(freqs.front()));
+	int newFreqEnd = freqs.empty() ? processor->freqEnd : int(std::ceil(freqs.back()));
+	if (freqStart != newFreqStart || freqEnd != newFreqEnd)
 	{
-		freqStart = processor->freqStart;
-		freqEnd = processor->freqEnd;
+		freqStart = newFreqStart;
+		freqEnd = newFreqEnd;
 
 		int NumOfChanChan = (processor->getActiveInputs()).size();
 		for (int i = 0; i < NumOfChanChan; ++i)
 		{
 			plotHoldingVect[i]->setRange(freqStart, freqEnd, -100, 20000, true);
 		}
-		cohPlot->setRange(freqStart, freqEnd, 0.0, 100, true);
+		updateCohPlotRange();
+	}
+
+	// Switch plot between raw coherence and z-score
+	bool zScore = processor->baseline.getMode() == CoherenceBaseline::ZSCORE;
+	if (zScore != showingZScore)
+	{
+		showingZScore = zScore;
+		zScoreButton->setToggleState(zScore, dontSendNotification);
+		updateCohPlotRange();
+	}
+	if (processor->baseline.getMode() == CoherenceBaseline::CAPTURE || processor->baseline.getNumSegments() > 0)
+	{
+		baselineStatus->setText("Baseline: " + String(processor->baseline.getNumSegments()) + " segments", dontSendNotification);
+	}
+
+	pairsInfo->setText(String(processor->pairs.getNumPairs()) + " pairs of " + String(processor->pairs.getNumChannels()) + " channels",
+		dontSendNotification);
+
+	// Memory the window would take, so it's known before resetting
+	int64 windowBytes = processor->getWindowMemoryEstimate(windowE->getText().getIntValue());
+	if (windowBytes != shownWindowMemory)
+	{
+		shownWindowMemory = windowBytes;
+		windowMemory->setText("Window memory: " + String(windowBytes / 1048576.0, 1) + " MB", dontSendNotification);
+	}
+
+	// Plan of the last reset, or why it was refused
+	if (processor->tfrStatus.isEmpty())
+	{
+		memoryPlanLabel->setText(processor->memoryPlan.describe(), dontSendNotification);
+		memoryPlanLabel->setColour(Label::textColourId, Colours::black);
+	}
+	else
+	{
+		memoryPlanLabel->setText(processor->tfrStatus, dontSendNotification);
+		memoryPlanLabel->setColour(Label::textColourId, Colours::red);
 	}
 
 	freqStep = processor->freqStep;
@@ -499,38 +1120,128 @@ void CoherenceVisualizer::refresh()
 	resetTFR->setColour(TextButton::buttonColourId, col);
 
 	// Get data from processor thread, then plot
-	if (processor->meanCoherence.hasUpdate())
+	if (processor->results.hasUpdate())
 	{
-		AtomicScopedReadPtr<std::vector<std::vector<double>>> coherenceReader(processor->meanCoherence);
+		AtomicScopedReadPtr<CoherenceResults> coherenceReader(processor->results);
 		coherenceReader.pullUpdate();
 
-		coh.resize(coherenceReader->size());
+		plotFreqs.assign(processor->frequencies.begin(), processor->frequencies.end());
+		coh.resize(coherenceReader->coherence.size());
+		bandCoh.resize(coherenceReader->bandCoherence.size());
+		envCorr.resize(coherenceReader->envelopeCorrelation.size());
+		cohThreshold.resize(coherenceReader->coherenceThreshold.size());
+		bandPsi.resize(coherenceReader->phaseSlope.size());
+		bandDelay.resize(coherenceReader->groupDelay.size());
+
+		// extra alphas aren't z-scored, so always 0-100
+		const auto& extraSrc = coherenceReader->extraCoherence;
+		extraCoh.resize(extraSrc.size());
+		for (int k = 0; k < extraSrc.size(); k++)
+		{
+			extraCoh[k].resize(extraSrc[k].size());
+			for (int comb = 0; comb < extraSrc[k].size(); comb++)
+			{
+				extraCoh[k][comb].assign(extraSrc[k][comb].begin(), extraSrc[k][comb].end());
+				for (float& value : extraCoh[k][comb])
+				{
+					value *= 100;
+				}
+			}
+		}
 
-		for (int comb = 0; comb < processor->nGroup1Chans * processor->nGroup2Chans; comb++)
+		// z-scores are shown unscaled
+		float scale = showingZScore ? 1 : 100;
+		for (int comb = 0; comb < processor->nGroupCombs; comb++)
 		{
-			int vecSize = coherenceReader->at(comb).size();
+			int vecSize = coherenceReader->coherence[comb].size();
 			coh[comb].resize(vecSize);
 	
 			for (int i = 0; i < vecSize; i++)
 			{
-				coh[comb][i] = coherenceReader->at(comb)[i] * 100;
+				coh[comb][i] = coherenceReader->coherence[comb][i] * scale;
+			}
+
+			int nBands = coherenceReader->bandCoherence[comb].size();
+			bandCoh[comb].resize(nBands);
+
+			for (int b = 0; b < nBands; b++)
+			{
+				bandCoh[comb][b] = coherenceReader->bandCoherence[comb][b] * scale;
+			}
+
+			const std::vector<double>& psiSrc = coherenceReader->phaseSlope[comb];
+			bandPsi[comb].assign(psiSrc.begin(), psiSrc.end());
+			bandDelay[comb].resize(nBands);
+			for (int b = 0; b < nBands; b++)
+			{
+				bandDelay[comb][b] = coherenceReader->groupDelay[comb][b] * 1000;
+			}
+
+			const std::vector<double>& thresholdSrc = coherenceReader->coherenceThreshold[comb];
+			cohThreshold[comb].resize(thresholdSrc.size());
+			for (int i = 0; i < thresholdSrc.size(); i++)
+			{
+				cohThreshold[comb][i] = thresholdSrc[i] * 100;
+			}
+
+			// correlation is shown on the coherence scale
+			const std::vector<double>& envSrc = coherenceReader->envelopeCorrelation[comb];
+			envCorr[comb].assign(envSrc.begin(), envSrc.end());
+			for (float& value : envCorr[comb])
+			{
+				value *= 100;
+			}
+		}
+
+		pwr.resize(coherenceReader->power.size());
+		for (int chan = 0; chan < pwr.size(); chan++)
+		{
+			pwr[chan] = coherenceReader->power[chan];
+		}
+
+		// Strongest coupling of each channel
+		String pacText;
+		for (int chan = 0; chan < coherenceReader->pacMI.size() && chan < processor->TotalNumofChannels.size(); chan++)
+		{
+			const std::vector<double>& mi = coherenceReader->pacMI[chan];
+			if (mi.empty())
+			{
+				break;
 			}
+			int best = std::max_element(mi.begin(), mi.end()) - mi.begin();
+			pacText += "CH" + String(processor->TotalNumofChannels[chan] + 1) + "  MI " + String(mi[best], 4)
+				+ "  MVL " + String(coherenceReader->pacMVL[chan][best], 3) + "\n";
 		}
+		pacValues->setText(pacText, dontSendNotification);
+
+		updateBandValues();
 	}
 	// Condition modified for inclusion of case where we have a mismatch in data and plot data
 	// This occurs when one changes the number of active channels
 	if (coh.size() > 0 && IsSpectrogram == false && coh.size() == (processor->nGroupCombs))
 	{
 		XYline cohLine(0, 1, 1, Colours::yellow);
+		std::vector<float> envLine;
+		std::vector<float> thresholdLine;
+		std::vector<std::vector<float>> extraLines(extraCoh.size());
 		if (curComb >= 0)
 		{
-			cohLine = XYline(freqStart, freqStep, coh[curComb], 1, Colours::yellow);
+			cohLine = getFrequencyLine(coh[curComb], Colours::yellow);
+			envLine = envCorr[curComb];
+			thresholdLine = cohThreshold[curComb];
+			for (int k = 0; k < extraCoh.size(); k++)
+			{
+				if (curComb < extraCoh[k].size())
+				{
+					extraLines[k] = extraCoh[k][curComb];
+				}
+			}
 		}
 		else
 		{
 			// Average across all combinations
 			std::vector<float> averageCoh(coh[0].size());
-			for (int comb = 0; comb < processor->nGroup1Chans * processor->nGroup2Chans; comb++)
+			for (int comb = 0; comb < processor->nGroupCombs; comb++)
 			{
 				for (int i = 0; i < averageCoh.size(); i++)
 				{
@@ -541,21 +1252,69 @@ void CoherenceVisualizer::refresh()
 			{
 				averageCoh[i] /= coh.size();
 			}
-			cohLine = XYline(freqStart, freqStep, averageCoh, 1, Colours::yellow);
+			cohLine = getFrequencyLine(averageCoh, Colours::yellow);
+
+			envLine.assign(envCorr[0].size(), 0);
+			for (int comb = 0; comb < envCorr.size(); comb++)
+			{
+				for (int i = 0; i < envLine.size(); i++)
+				{
+					envLine[i] += envCorr[comb][i] / envCorr.size();
+				}
+			}
+
+			thresholdLine.assign(cohThreshold[0].size(), 0);
+			for (int comb = 0; comb < cohThreshold.size(); comb++)
+			{
+				for (int i = 0; i < thresholdLine.size(); i++)
+				{
+					thresholdLine[i] += cohThreshold[comb][i] / cohThreshold.size();
+				}
+			}
+
+			for (int k = 0; k < extraCoh.size(); k++)
+			{
+				extraLines[k].assign(extraCoh[k].empty() ? 0 : extraCoh[k][0].size(), 0);
+				for (int comb = 0; comb < extraCoh[k].size(); comb++)
+				{
+					for (int i = 0; i < extraLines[k].size(); i++)
+					{
+						extraLines[k][i] += extraCoh[k][comb][i] / extraCoh[k].size();
+					}
+				}
+			}
 		}
 
 
 		cohPlot->clearplot();
 		cohPlot->plotxy(cohLine);
+		// z-scores have their own scale, so envelope correlation is only overlaid on raw coherence
+		if (!showingZScore && !envLine.empty())
+		{
+			cohPlot->plotxy(getFrequencyLine(envLine, Colours::cyan));
+		}
+		if (!showingZScore && !thresholdLine.empty())
+		{
+			cohPlot->plotxy(getFrequencyLine(thresholdLine, Colours::red));
+		}
+		static const Colour extraColours[CoherenceNode::MAX_EXTRA_ALPHAS] =
+			{ Colours::orange, Colours::magenta, Colours::lime, Colours::white };
+		for (int k = 0; k < extraLines.size() && k < CoherenceNode::MAX_EXTRA_ALPHAS; k++)
+		{
+			if (!showingZScore && !extraLines[k].empty())
+			{
+				cohPlot->plotxy(getFrequencyLine(extraLines[k], extraColours[k]));
+			}
+		}
 		cohPlot->repaint();
 	}
 
-	if ((processor->ttlpwr).size() != 0 && IsSpectrogram == true)
+	if (pwr.size() != 0 && IsSpectrogram == true)
 	{
 		int NumOfChanChan = (processor->TotalNumofChannels).size();
 		for (int i = 0; i < NumOfChanChan; ++i)
 		{
-			if (processor->ttlpwr.size() == NumOfChanChan)
+			if (pwr.size() == NumOfChanChan)
 			{
 				int k = processor->TotalNumofChannels.getReference(i);
 				canvas->addAndMakeVisible(plotHoldingVect[i]);
@@ -563,7 +1322,7 @@ void CoherenceVisualizer::refresh()
 				plotHoldingVect[i]->clearplot();
 				String Idchn = "#" + std::to_string(k + 1);
 				plotHoldingVect[i]->setTitle("Power vs Frequency: CH" + Idchn);
-				plotHoldingVect[i]->plotxy(XYline(freqStart, freqStep, processor->ttlpwr[i], 1, Colours::yellow));
+				plotHoldingVect[i]->plotxy(getFrequencyLine(pwr[i], Colours::yellow));
                 plotHoldingVect[i]->setAutoRescale(true);
 				plotHoldingVect[i]->repaint();
 			}
@@ -593,17 +1352,133 @@ void CoherenceVisualizer::labelTextChanged(Label* labelThatHasChanged)
 		processor->updateReady(false);
 	}
 
-
-
-	if (labelThatHasChanged == alphaE)
+
+
+	if (labelThatHasChanged == alphaE)
+	{
+		float newVal;
+		if (updateFloatLabel(labelThatHasChanged, 0, FLT_MAX, .3, &newVal))
+		{
+			if (expButton->getState())
+			{
+				processor->updateAlpha(newVal);
+				processor->updateReady(false);
+			}
+		}
+	}
+
+	if (labelThatHasChanged == budgetE)
+	{
+		float newVal;
+		if (updateFloatLabel(labelThatHasChanged, 1, FLT_MAX, 2048, &newVal))
+		{
+			processor->setMemoryBudget(newVal);
+		}
+	}
+
+	if (labelThatHasChanged == pairsE)
+	{
+		if (CoreServices::getAcquisitionStatus())
+		{
+			CoreServices::sendStatusMessage("Pairs can't be changed during acquisition");
+		}
+		else if (!processor->setPairSpec(pairsE->getText()))
+		{
+			CoreServices::sendStatusMessage("Invalid pairs, use e.g. \"HPC: 1-4; PFC: 5-8 | HPC-PFC\" or \"1-5, 2-6\"");
+		}
+		pairsE->setText(processor->pairSpec, dontSendNotification);
+		updateCombList();
+	}
+
+	if (labelThatHasChanged == detectorsE)
+	{
+		if (!processor->setDetectorSpec(detectorsE->getText()))
+		{
+			CoreServices::sendStatusMessage("Invalid detectors, use e.g. \"step, clip 5000, rms 6\" or \"step; 1-4: line 200\"");
+		}
+		detectorsE->setText(processor->detectorSpec, dontSendNotification);
+	}
+
+	if (labelThatHasChanged == montageE)
+	{
+		if (!processor->setMontageSpec(montageE->getText()))
+		{
+			CoreServices::sendStatusMessage("Invalid reference, use \"CAR\", \"CAR: 1-16\" or e.g. \"1-2, 3-4\"");
+		}
+		montageE->setText(processor->montageSpec, dontSendNotification);
+	}
+
+	if (labelThatHasChanged == pacPhaseE || labelThatHasChanged == pacAmpE)
+	{
+		if (!processor->setPACRanges(pacPhaseE->getText(), pacAmpE->getText()))
+		{
+			CoreServices::sendStatusMessage("Invalid PAC range, use e.g. \"4-8\"");
+		}
+		pacPhaseE->setText(String(processor->pacPhaseBand.low) + "-" + String(processor->pacPhaseBand.high), dontSendNotification);
+		pacAmpE->setText(String(processor->pacAmpBand.low) + "-" + String(processor->pacAmpBand.high), dontSendNotification);
+	}
+
+	if (labelThatHasChanged == surrogateCountE || labelThatHasChanged == surrogateHistoryE
+		|| labelThatHasChanged == surrogateCpuE)
+	{
+		int newCount, newHistory;
+		float newCpu;
+		updateIntLabel(surrogateCountE, 20, 100000, 200, &newCount);
+		updateIntLabel(surrogateHistoryE, 2, 10000, 20, &newHistory);
+		updateFloatLabel(surrogateCpuE, 1, 100, 25, &newCpu);
+		updateSurrogateSettings();
+	}
+
+	if (labelThatHasChanged == segmentHopE)
+	{
+		float newHop;
+		if (updateFloatLabel(segmentHopE, 0, 600, 0, &newHop))
+		{
+			processor->setSegmentHop(newHop);
+		}
+	}
+
+	if (labelThatHasChanged == eventChannelE || labelThatHasChanged == eventPreE || labelThatHasChanged == eventPostE)
+	{
+		int newChannel;
+		float newPre, newPost;
+		updateIntLabel(eventChannelE, 1, 256, 1, &newChannel);
+		updateFloatLabel(eventPreE, 0, 60, 1, &newPre);
+		updateFloatLabel(eventPostE, 0, 60, 3, &newPost);
+		updateEventSettings();
+	}
+
+	if (labelThatHasChanged == extraAlphaE)
+	{
+		if (!processor->setExtraAlphas(extraAlphaE->getText()))
+		{
+			CoreServices::sendStatusMessage("Invalid alphas, use up to 4 values in (0, 1], e.g. \"0.5, 0.05\"");
+		}
+		StringArray alphaTexts;
+		for (double extraAlpha : processor->extraAlphas)
+		{
+			alphaTexts.add(String(extraAlpha));
+		}
+		extraAlphaE->setText(alphaTexts.joinIntoString(", "), dontSendNotification);
+	}
+
+	if (labelThatHasChanged == bandsE)
+	{
+		if (!processor->setBands(bandsE->getText()))
+		{
+			CoreServices::sendStatusMessage("Invalid bands, use e.g. \"theta 4-8, beta 13-30\"");
+		}
+		bandsE->setText(FrequencyBands::toString(processor->bands), dontSendNotification);
+	}
+
+	if (labelThatHasChanged == windowE)
 	{
-		float newVal;
-		if (updateFloatLabel(labelThatHasChanged, 0, FLT_MAX, .3, &newVal))
+		int newVal;
+		if (updateIntLabel(labelThatHasChanged, 1, 10000, 10, &newVal))
 		{
-			if (expButton->getState())
+			if (windowButton->getToggleState())
 			{
-				processor->updateAlpha(newVal);
-				processor->updateReady(false);
+				processor->updateWindowSize(newVal);
 			}
 		}
 	}
@@ -617,6 +1492,18 @@ void CoherenceVisualizer::labelTextChanged(Label* labelThatHasChanged)
 		}
 	}
 
+	if (labelThatHasChanged == foctaveEditable)
+	{
+		float newVal;
+		updateFloatLabel(labelThatHasChanged, 1, 96, 8, &newVal);
+		updateFrequencyGrid();
+	}
+
+	if (labelThatHasChanged == flistEditable)
+	{
+		updateFrequencyGrid();
+	}
+
 	if (labelThatHasChanged == fstartEditable)
 	{
 		int newVal;
@@ -641,11 +1528,152 @@ void CoherenceVisualizer::comboBoxChanged(ComboBox* comboBoxThatHasChanged)
 	if (comboBoxThatHasChanged == combinationBox)
 	{
 		curComb = static_cast<int>(combinationBox->getSelectedId() - 2);
+		updateBandValues();
+	}
+	else if (comboBoxThatHasChanged == recordBox)
+	{
+		processor->setRecordOutput(CoherenceNode::RecordOutput(recordBox->getSelectedId() - 1));
+	}
+	else if (comboBoxThatHasChanged == surrogateMethodBox)
+	{
+		updateSurrogateSettings();
+	}
+	else if (comboBoxThatHasChanged == fgridBox)
+	{
+		updateFrequencyGrid();
+		processor->updateReady(false);
+	}
+}
+
+void CoherenceVisualizer::updateFrequencyGrid()
+{
+	if (!processor->setFrequencyGrid(CoherenceNode::FrequencyGrid(fgridBox->getSelectedId() - 1),
+		foctaveEditable->getText().getFloatValue(), flistEditable->getText()))
+	{
+		CoreServices::sendStatusMessage("Invalid frequency list, use e.g. \"4, 6, 8, 12.5, 40\"");
+	}
+	fgridBox->setSelectedId(processor->freqGrid + 1, dontSendNotification);
+	flistEditable->setText(processor->freqList, dontSendNotification);
+}
+
+XYline CoherenceVisualizer::getFrequencyLine(const std::vector<float>& values, Colour colour) const
+{
+	if (values.size() != plotFreqs.size() || values.empty())
+	{
+		return XYline(0, 1, 1, colour);
+	}
+	return XYline(plotFreqs, values, 1, colour);
+}
+
+void CoherenceVisualizer::updateLoadStatus()
+{
+	float load = processor->computeLoad;
+	float dataUsed = processor->getDataUsed();
+
+	String status = "Load: " + String(roundToInt(load * 100)) + "% of real time";
+	if (dataUsed < 1)
+	{
+		status += ", " + String(roundToInt(dataUsed * 100)) + "% of data";
+	}
+	loadLabel->setText(status, dontSendNotification);
+	loadLabel->setColour(Label::textColourId, load > 1 || dataUsed < 1 ? Colours::red : Colours::black);
+
+	String details = "Segments computed: " + String(processor->numTrials + int(ceil(processor->numArtifacts)))
+		+ "\nSegments skipped: " + String(processor->skippedWindows.load())
+		+ "\nSamples dropped (calculation too far behind): " + String(processor->ingest.getDroppedSamples());
+	float worstBlock = processor->ingest.getWorstBlockSeconds();
+	if (worstBlock > 0)
+	{
+		details += "\nLongest audio callback: " + String(worstBlock * 1000, 3) + " ms, for a block of "
+			+ String(processor->ingest.getWorstBlockDuration() * 1000, 1) + " ms";
+	}
+	if (load > 1)
+	{
+		details += "\nFewer frequencies or channels, a longer step or a longer hop would bring the load down.";
+	}
+	loadLabel->setTooltip(details);
+}
+
+void CoherenceVisualizer::updateEventSettings()
+{
+	if (!processor->setEventLocked(eventButton->getToggleState(),
+		eventChannelE->getText().getIntValue() - 1,
+		eventPreE->getText().getFloatValue(),
+		eventPostE->getText().getFloatValue()))
+	{
+		CoreServices::sendStatusMessage("Event-locking can't be changed during acquisition");
+		eventButton->setToggleState(processor->eventLocked, dontSendNotification);
+		eventChannelE->setText(String(processor->eventChannel + 1), dontSendNotification);
+		eventPreE->setText(String(processor->eventPre), dontSendNotification);
+		eventPostE->setText(String(processor->eventPost), dontSendNotification);
+	}
+}
+
+void CoherenceVisualizer::updateSurrogateSettings()
+{
+	processor->setSurrogates(surrogateButton->getToggleState(),
+		SurrogateCoherence::Method(surrogateMethodBox->getSelectedId() - 1),
+		surrogateCountE->getText().getIntValue(),
+		surrogateHistoryE->getText().getIntValue(),
+		surrogateCpuE->getText().getFloatValue());
+}
+
+void CoherenceVisualizer::updateBandValues()
+{
+	if (bandCoh.size() == 0 || bandCoh.size() != processor->nGroupCombs
+		|| bandPsi.size() != bandCoh.size() || bandDelay.size() != bandCoh.size())
+	{
+		bandValues->setText("", dontSendNotification);
+		return;
+	}
+
+	// Current combination, or average across all of them
+	int nBands = jmin(int(bandCoh[0].size()), int(processor->bands.size()));
+	String text;
+	for (int b = 0; b < nBands; b++)
+	{
+		float value = 0;
+		float psi = 0;
+		float delay = 0;
+		if (curComb >= 0 && curComb < bandCoh.size())
+		{
+			value = bandCoh[curComb][b];
+			psi = bandPsi[curComb][b];
+			delay = bandDelay[curComb][b];
+		}
+		else
+		{
+			for (int comb = 0; comb < bandCoh.size(); comb++)
+			{
+				value += bandCoh[comb][b];
+				psi += bandPsi[comb][b];
+				delay += bandDelay[comb][b];
+			}
+			value /= bandCoh.size();
+			psi /= bandCoh.size();
+			delay /= bandCoh.size();
+		}
+		text += processor->bands[b].name + ": " + String(value, 2)
+			+ "  PSI " + String(psi, 3) + "  " + String(delay, 1) + " ms\n";
 	}
+	bandValues->setText(text, dontSendNotification);
 }
 
 void CoherenceVisualizer::buttonClicked(Button* buttonClicked)
 {
+	// Baseline and view don't change the TFR settings, no reset needed
+	if (baselineButtonClicked(buttonClicked) || viewButtonClicked(buttonClicked))
+	{
+		return;
+	}
+
+	// Neither does keeping up, it applies from the next segment
+	if (buttonClicked == keepUpButton)
+	{
+		processor->setKeepUp(keepUpButton->getToggleState());
+		return;
+	}
+
 	if (buttonClicked == resetTFR)
 	{
 		processor->resetTFR();
@@ -676,108 +1704,38 @@ void CoherenceVisualizer::buttonClicked(Button* buttonClicked)
 	if (buttonClicked == linearButton)
 	{
 		expButton->setToggleState(false, dontSendNotification);
+		windowButton->setToggleState(false, dontSendNotification);
 
 		processor->updateAlpha(0);
+		processor->updateWindowSize(0);
 	}
-	if (buttonClicked == SpectrogramViewer)
+	if (buttonClicked == windowButton)
 	{
-		processor->WhatisIT = 0;
-		if (!group1Channels.isEmpty())
-			group1ChannelsCoh2Spec = group1Channels;
-		if (!group2Channels.isEmpty())
-			group2ChannelsCoh2Spec = group2Channels;
-
-
-		UpdateElectrodeOnTransition();
-
-		processor->resetTFR();
-		IsSpectrogram = true;
-		combinationLabel->setEnabled(false);
-		combinationBox->setEnabled(false);
-		//resetTFR->setEnabled(false);
-		clearGroups->setEnabled(false);
-		defaultGroups->setEnabled(false);
-		group1Title->setEnabled(false);
-		CoherenceViewer->setToggleState(false, dontSendNotification);
-
+		linearButton->setToggleState(false, dontSendNotification);
+		expButton->setToggleState(false, dontSendNotification);
 
-		// allow things to change again
-		for (int i = 0; i < group1Buttons.size(); i++)
-		{
-			group1Buttons[i]->setEnabled(false);
-		}
-		for (int i = 0; i < group2Buttons.size(); i++)
-		{
-			group2Buttons[i]->setEnabled(false);
-		}
-		for (int i = 0; i < (processor->TotalNumofChannels).size(); ++i)
-		{
-			plotHoldingVect[i]->setVisible(true);
-		}
-		cohPlot->setVisible(false);
+		processor->updateAlpha(0);
+		processor->updateWindowSize(windowButton->getToggleState() ? windowE->getText().getIntValue() : 0);
 	}
-
-	if (buttonClicked == CoherenceViewer)
+	if (buttonClicked == pacButton)
 	{
-		// This has to done before reset TFR
-		processor->WhatisIT = 1;
-		// Code to identify whether we have data from coherence.
-		if (!ChanNumChange)
-		{
-			group1Channels.clear();
-			group2Channels.clear();
-			for (int i = 0; i < group1ChannelsCoh2Spec.size(); ++i)
-			{
-				if ((processor->TotalNumofChannels.contains(group1ChannelsCoh2Spec.getReference(i))))
-				{
-					group1Channels.add(group1ChannelsCoh2Spec.getReference(i));
-				}
-
-			}
-			for (int i = 0; i < group2ChannelsCoh2Spec.size(); ++i)
-			{
-				if ((processor->TotalNumofChannels.contains(group2ChannelsCoh2Spec.getReference(i))))
-					group2Channels.add(group2ChannelsCoh2Spec.getReference(i));
-			}
-			processor->updateGroup(group1Channels, group2Channels);
-			updateGroupState();
-			updateCombList();
-		}
-		else
-		{
-			ChanNumChange = false;
-		}
-		processor->resetTFR();
-		IsSpectrogram = false;
-		combinationLabel->setEnabled(true);
-		combinationBox->setEnabled(true);
-		group1Title->setEnabled(true);
-		resetTFR->setEnabled(true);
-		clearGroups->setEnabled(true);
-		defaultGroups->setEnabled(true);
-		SpectrogramViewer->setToggleState(false, dontSendNotification);
-
-		for (int i = 0; i < group1Buttons.size(); i++)
-		{
-			group1Buttons[i]->setEnabled(true);
-		}
-		for (int i = 0; i < group2Buttons.size(); i++)
-		{
-			group2Buttons[i]->setEnabled(true);
-		}
-
-		for (int i = 0; i < (processor->TotalNumofChannels).size(); ++i)
-		{
-			plotHoldingVect[i]->setVisible(false);
-		}
-		cohPlot->setVisible(true);
-
+		processor->setPACEnabled(pacButton->getToggleState());
 	}
-	/*End*/
+	if (buttonClicked == surrogateButton)
+	{
+		updateSurrogateSettings();
+	}
+	if (buttonClicked == eventButton)
+	{
+		updateEventSettings();
+	}
+
 	if (buttonClicked == expButton)
 	{
 		linearButton->setToggleState(false, dontSendNotification);
+		windowButton->setToggleState(false, dontSendNotification);
 		processor->updateAlpha(alphaE->getText().getFloatValue());
+		processor->updateWindowSize(0);
 	}
 
 	if (group1Buttons.contains((ElectrodeButton*)buttonClicked))
@@ -837,6 +1795,142 @@ void CoherenceVisualizer::buttonClicked(Button* buttonClicked)
 	resetTFR->setColour(TextButton::buttonColourId, col);
 }
 
+bool CoherenceVisualizer::baselineButtonClicked(Button* buttonClicked)
+{
+	if (buttonClicked == captureBaselineButton)
+	{
+		if (captureBaselineButton->getToggleState())
+		{
+			zScoreButton->setToggleState(false, dontSendNotification);
+			processor->setBaselineMode(CoherenceBaseline::CAPTURE);
+			baselineStatus->setText("Capturing baseline...", dontSendNotification);
+		}
+		else
+		{
+			processor->setBaselineMode(CoherenceBaseline::OFF);
+		}
+	}
+	else if (buttonClicked == zScoreButton)
+	{
+		if (zScoreButton->getToggleState())
+		{
+			if (processor->setBaselineMode(CoherenceBaseline::ZSCORE))
+			{
+				captureBaselineButton->setToggleState(false, dontSendNotification);
+			}
+			else
+			{
+				zScoreButton->setToggleState(false, dontSendNotification);
+				baselineStatus->setText("Baseline doesn't match settings", dontSendNotification);
+			}
+		}
+		else
+		{
+			processor->setBaselineMode(CoherenceBaseline::OFF);
+		}
+	}
+	else if (buttonClicked == saveBaselineButton)
+	{
+		FileChooser chooser("Save baseline", File::getSpecialLocation(File::userHomeDirectory), "*.cohb");
+		if (chooser.browseForFileToSave(true))
+		{
+			bool saved = processor->saveBaseline(chooser.getResult().withFileExtension("cohb"));
+			baselineStatus->setText(saved ? "Baseline saved" : "Nothing to save (stop capture first)", dontSendNotification);
+		}
+	}
+	else if (buttonClicked == loadBaselineButton)
+	{
+		FileChooser chooser("Load baseline", File::getSpecialLocation(File::userHomeDirectory), "*.cohb");
+		if (chooser.browseForFileToOpen())
+		{
+			bool loaded = processor->loadBaseline(chooser.getResult());
+			baselineStatus->setText(loaded ? "Baseline: " + String(processor->baseline.getNumSegments()) + " segments"
+				: "Load failed (stop acquisition first)", dontSendNotification);
+		}
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+bool CoherenceVisualizer::viewButtonClicked(Button* buttonClicked)
+{
+	// Coherence and spectrogram are both computed all the time, switching only changes what's shown
+	if (buttonClicked == SpectrogramViewer)
+	{
+		processor->WhatisIT = 0;
+		IsSpectrogram = true;
+		combinationLabel->setEnabled(false);
+		combinationBox->setEnabled(false);
+		clearGroups->setEnabled(false);
+		defaultGroups->setEnabled(false);
+		group1Title->setEnabled(false);
+		CoherenceViewer->setToggleState(false, dontSendNotification);
+
+		for (int i = 0; i < group1Buttons.size(); i++)
+		{
+			group1Buttons[i]->setEnabled(false);
+		}
+		for (int i = 0; i < group2Buttons.size(); i++)
+		{
+			group2Buttons[i]->setEnabled(false);
+		}
+		for (int i = 0; i < (processor->TotalNumofChannels).size(); ++i)
+		{
+			plotHoldingVect[i]->setVisible(true);
+		}
+		cohPlot->setVisible(false);
+		return true;
+	}
+
+	if (buttonClicked == CoherenceViewer)
+	{
+		processor->WhatisIT = 1;
+		IsSpectrogram = false;
+		combinationLabel->setEnabled(true);
+		combinationBox->setEnabled(true);
+		group1Title->setEnabled(true);
+		clearGroups->setEnabled(true);
+		defaultGroups->setEnabled(true);
+		SpectrogramViewer->setToggleState(false, dontSendNotification);
+
+		// allow things to change again
+		for (int i = 0; i < group1Buttons.size(); i++)
+		{
+			group1Buttons[i]->setEnabled(true);
+		}
+		for (int i = 0; i < group2Buttons.size(); i++)
+		{
+			group2Buttons[i]->setEnabled(true);
+		}
+		for (int i = 0; i < (processor->TotalNumofChannels).size(); ++i)
+		{
+			plotHoldingVect[i]->setVisible(false);
+		}
+		cohPlot->setVisible(true);
+		return true;
+	}
+
+	return false;
+}
+
+void CoherenceVisualizer::updateCohPlotRange()
+{
+	if (showingZScore)
+	{
+		cohPlot->setTitle("Coherence z-score vs Frequency");
+		cohPlot->setRange(freqStart, freqEnd, -5, 5, true);
+	}
+	else
+	{
+		cohPlot->setTitle("Coherence vs Frequency");
+		cohPlot->setRange(freqStart, freqEnd, 0.0, 100, true);
+	}
+}
+
 void CoherenceVisualizer::channelChanged(int chan, bool newState)
 {
 	int buttonChan = chan + 1;
@@ -914,7 +2008,6 @@ void CoherenceVisualizer::channelChanged(int chan, bool newState)
 		}
 	}
 	processor->resetTFR();
-	ChanNumChange = true;
 
 }
 
@@ -1185,7 +2278,13 @@ void CoherenceVisualizer::UpdateVisualizerStateOntransition(bool flag)
 	resetTFR->setEnabled(flag);
 	linearButton->setEnabled(flag);
 	expButton->setEnabled(flag);
+	windowButton->setEnabled(flag);
 	alphaE->setEditable(false);
+	pairsE->setEditable(flag);
+	eventButton->setEnabled(flag);
+	eventChannelE->setEditable(flag);
+	eventPreE->setEditable(flag);
+	eventPostE->setEditable(flag);
 	CoherenceViewer->setEnabled(flag);
 	SpectrogramViewer->setEnabled(flag);
 }
@@ -1195,9 +2294,26 @@ void CoherenceVisualizer::saveVisualizerParameters(XmlElement* xml)
 {
 	XmlElement* visValues = xml->createNewChildElement("VISUALIZER");
 	visValues->setAttribute("alpha", alphaE->getText().getFloatValue());
+	visValues->setAttribute("window", windowE->getText().getIntValue());
+	visValues->setAttribute("windowOn", windowButton->getToggleState());
+	visValues->setAttribute("extraAlphas", extraAlphaE->getText());
+	visValues->setAttribute("memoryBudget", budgetE->getText().getFloatValue());
+	visValues->setAttribute("bands", bandsE->getText());
+	visValues->setAttribute("recordOutput", recordBox->getSelectedId() - 1);
+	visValues->setAttribute("pacOn", pacButton->getToggleState());
+	visValues->setAttribute("pacPhase", pacPhaseE->getText());
+	visValues->setAttribute("pacAmp", pacAmpE->getText());
+	visValues->setAttribute("surrogatesOn", surrogateButton->getToggleState());
+	visValues->setAttribute("surrogateMethod", surrogateMethodBox->getSelectedId() - 1);
+	visValues->setAttribute("surrogates", surrogateCountE->getText().getIntValue());
+	visValues->setAttribute("surrogateHistory", surrogateHistoryE->getText().getIntValue());
+	visValues->setAttribute("surrogateCpu", surrogateCpuE->getText().getFloatValue());
 	visValues->setAttribute("fstart", fstartEditable->getText().getIntValue());
 	visValues->setAttribute("fend", fendEditable->getText().getIntValue());
 	visValues->setAttribute("fstep", fstepEditable->getText().getFloatValue());
+	visValues->setAttribute("fgrid", fgridBox->getSelectedId() - 1);
+	visValues->setAttribute("fperOctave", foctaveEditable->getText().getFloatValue());
+	visValues->setAttribute("flist", flistEditable->getText());
 }
 
 
@@ -1206,7 +2322,29 @@ void CoherenceVisualizer::loadVisualizerParameters(XmlElement* xml)
 	forEachXmlChildElementWithTagName(*xml, xmlNode, "VISUALIZER")
 	{
 		alphaE->setText(String(xmlNode->getDoubleAttribute("alpha", alphaE->getText().getFloatValue())), sendNotificationSync);
+		windowE->setText(String(xmlNode->getIntAttribute("window", windowE->getText().getIntValue())), sendNotificationSync);
+		extraAlphaE->setText(xmlNode->getStringAttribute("extraAlphas", extraAlphaE->getText()), sendNotificationSync);
+		budgetE->setText(String(xmlNode->getDoubleAttribute("memoryBudget", budgetE->getText().getFloatValue())), sendNotificationSync);
+		bandsE->setText(xmlNode->getStringAttribute("bands", bandsE->getText()), sendNotificationSync);
+		recordBox->setSelectedId(xmlNode->getIntAttribute("recordOutput", CoherenceNode::RECORD_BINS) + 1, sendNotificationSync);
+		pacPhaseE->setText(xmlNode->getStringAttribute("pacPhase", pacPhaseE->getText()), sendNotificationSync);
+		pacAmpE->setText(xmlNode->getStringAttribute("pacAmp", pacAmpE->getText()), sendNotificationSync);
+		pacButton->setToggleState(xmlNode->getBoolAttribute("pacOn", false), sendNotificationSync);
+		surrogateMethodBox->setSelectedId(xmlNode->getIntAttribute("surrogateMethod", SurrogateCoherence::CIRCULAR_SHIFT) + 1, dontSendNotification);
+		surrogateCountE->setText(String(xmlNode->getIntAttribute("surrogates", processor->nSurrogates)), dontSendNotification);
+		surrogateHistoryE->setText(String(xmlNode->getIntAttribute("surrogateHistory", processor->surrogateHistory)), dontSendNotification);
+		surrogateCpuE->setText(String(xmlNode->getDoubleAttribute("surrogateCpu", processor->surrogateCpu)), dontSendNotification);
+		surrogateButton->setToggleState(xmlNode->getBoolAttribute("surrogatesOn", false), dontSendNotification);
+		updateSurrogateSettings();
+		if (xmlNode->getBoolAttribute("windowOn", false))
+		{
+			windowButton->setToggleState(true, sendNotificationSync);
+		}
 		fstepEditable->setText(String(xmlNode->getDoubleAttribute("fstep", fstepEditable->getText().getFloatValue())), sendNotificationSync);
+		fgridBox->setSelectedId(xmlNode->getIntAttribute("fgrid", CoherenceNode::GRID_LINEAR) + 1, dontSendNotification);
+		foctaveEditable->setText(String(xmlNode->getDoubleAttribute("fperOctave", processor->freqsPerOctave)), dontSendNotification);
+		flistEditable->setText(xmlNode->getStringAttribute("flist", processor->freqList), dontSendNotification);
+		updateFrequencyGrid();
 		fstartEditable->setText(String(xmlNode->getIntAttribute("fstart", fstartEditable->getText().getIntValue())), sendNotificationSync);
 		fendEditable->setText(String(xmlNode->getIntAttribute("fend", fendEditable->getText().getIntValue())), sendNotificationSync);
 		processor->resetTFR();
@@ -88,6 +88,12 @@ private:
 	void updateElectrodeButtons(int numInputs, int numButtons);
 	// creates a button for both group 1 and 2
 	void createElectrodeButton(int index);
+	// Handle the baseline column. Returns false if the button isn't one of its buttons.
+	bool baselineButtonClicked(Button* buttonClick);
+	// Switch between coherence and spectrogram view. Returns false if it isn't a view button.
+	bool viewButtonClicked(Button* buttonClick);
+	// Set coherence plot y range for raw coherence (0-100) or z-score
+	void updateCohPlotRange();
 
 	CoherenceNode* processor;
 
@@ -116,11 +122,21 @@ private:
 	ScopedPointer<ToggleButton> expButton;
 	ScopedPointer<Label> alpha;
 	ScopedPointer<Label> alphaE;
+	ScopedPointer<ToggleButton> windowButton;
+	ScopedPointer<Label> windowLabel;
+	ScopedPointer<Label> windowE;
+	ScopedPointer<Label> windowMemory;
+	// Estimate windowMemory shows, so its text is only rebuilt when the settings change it
+	int64 shownWindowMemory;
+	ScopedPointer<Label> extraAlphaLabel;
+	ScopedPointer<Label> extraAlphaE;
 
 	ScopedPointer<Label> artifactDesc;
 	ScopedPointer<Label> artifactEq;
 	ScopedPointer<Label> artifactE;
 	ScopedPointer<Label> artifactCount;
+	ScopedPointer<Label> detectorsLabel;
+	ScopedPointer<Label> detectorsE;
 
 	ScopedPointer<TextButton> resetTFR;
 	ScopedPointer<TextButton> clearGroups;
@@ -133,17 +149,26 @@ private:
 	ScopedPointer<Label> fendEditable;
 	ScopedPointer<Label> fstepLabel;
 	ScopedPointer<Label> fstepEditable;
+	ScopedPointer<Label> fgridLabel;
+	ScopedPointer<ComboBox> fgridBox;
+	ScopedPointer<Label> foctaveLabel;
+	ScopedPointer<Label> foctaveEditable;
+	ScopedPointer<Label> flistLabel;
+	ScopedPointer<Label> flistEditable;
+	// Pass the grid controls to the processor
+	void updateFrequencyGrid();
+
+	// Frequencies of the latest results, the x values of every plot
+	std::vector<float> plotFreqs;
+	// Line of values over plotFreqs (empty if the sizes don't match, e.g. just after a reset)
+	XYline getFrequencyLine(const std::vector<float>& values, Colour colour) const;
 
-	bool ChanNumChange = false;
 	int lastDelElement;
 	int lastAddElement;
 
 	Array<int> group1Channels;
 	Array<int> group2Channels;
 
-	Array<int> group1ChannelsCoh2Spec;
-	Array<int> group2ChannelsCoh2Spec;
-
 	float freqStep;
 	int nCombs;
 	int curComb;
@@ -151,9 +176,85 @@ private:
 	int freqStart;
 	int freqEnd;
 
+	ScopedPointer<VerticalGroupSet> columnThreeSet;
+
+	ScopedPointer<Label> baselineTitle;
+	ScopedPointer<ToggleButton> captureBaselineButton;
+	ScopedPointer<ToggleButton> zScoreButton;
+	ScopedPointer<TextButton> saveBaselineButton;
+	ScopedPointer<TextButton> loadBaselineButton;
+	ScopedPointer<Label> baselineStatus;
+
+	ScopedPointer<Label> memoryTitle;
+	ScopedPointer<Label> budgetLabel;
+	ScopedPointer<Label> budgetE;
+	ScopedPointer<Label> memoryPlanLabel;
+	bool showingZScore = false;
+
+	ScopedPointer<Label> bandsTitle;
+	ScopedPointer<Label> bandsE;
+	ScopedPointer<Label> recordLabel;
+	ScopedPointer<ComboBox> recordBox;
+	ScopedPointer<Label> bandValues;
+
+	ScopedPointer<Label> pairsTitle;
+	ScopedPointer<Label> pairsE;
+	ScopedPointer<Label> pairsInfo;
+	ScopedPointer<Label> montageLabel;
+	ScopedPointer<Label> montageE;
+
+	ScopedPointer<ToggleButton> pacButton;
+	ScopedPointer<Label> pacPhaseLabel;
+	ScopedPointer<Label> pacPhaseE;
+	ScopedPointer<Label> pacAmpLabel;
+	ScopedPointer<Label> pacAmpE;
+	ScopedPointer<Label> pacValues;
+
+	ScopedPointer<ToggleButton> surrogateButton;
+	ScopedPointer<ComboBox> surrogateMethodBox;
+	ScopedPointer<Label> surrogateCountLabel;
+	ScopedPointer<Label> surrogateCountE;
+	ScopedPointer<Label> surrogateHistoryLabel;
+	ScopedPointer<Label> surrogateHistoryE;
+	ScopedPointer<Label> surrogateCpuLabel;
+	ScopedPointer<Label> surrogateCpuE;
+	// Pass the surrogate controls to the processor
+	void updateSurrogateSettings();
+
+	ScopedPointer<Label> segmentHopLabel;
+	ScopedPointer<Label> segmentHopE;
+	ScopedPointer<ToggleButton> keepUpButton;
+	ScopedPointer<Label> loadLabel;
+	// Compute load and how much of the data went into the averages
+	void updateLoadStatus();
+
+	ScopedPointer<ToggleButton> eventButton;
+	ScopedPointer<Label> eventChannelLabel;
+	ScopedPointer<Label> eventChannelE;
+	ScopedPointer<Label> eventPreLabel;
+	ScopedPointer<Label> eventPreE;
+	ScopedPointer<Label> eventPostLabel;
+	ScopedPointer<Label> eventPostE;
+	// Pass the event-locked controls to the processor
+	void updateEventSettings();
+	// Band averages shown for the current combination
+	void updateBandValues();
+
 	ScopedPointer<MatlabLikePlot> cohPlot;
 	std::vector<double> coherence;
 	std::vector<std::vector<float>> coh;
+	std::vector<std::vector<float>> bandCoh;
+	// phase-slope index and group delay (ms), same layout as bandCoh
+	std::vector<std::vector<float>> bandPsi;
+	std::vector<std::vector<float>> bandDelay;
+	// significance threshold, same layout as coh (empty without surrogates)
+	std::vector<std::vector<float>> cohThreshold;
+	// amplitude envelope correlation, same layout as coh
+	std::vector<std::vector<float>> envCorr;
+	// coherence of each extra alpha, # extra alphas x (same layout as coh), 0-100
+	std::vector<std::vector<std::vector<float>>> extraCoh;
+	// # spectrogram channels x # freqs
+	std::vector<std::vector<float>> pwr;
 
 	bool IsSpectrogram = false;
 	ScopedPointer<ToggleButton> CoherenceViewer;
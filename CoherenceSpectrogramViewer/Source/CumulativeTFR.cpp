@@ -23,33 +23,66 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 // Hello
 #include "CumulativeTFR.h"
 #include <cmath>
+#include <algorithm>
 
 
-CumulativeTFR::CumulativeTFR(int ng1, int ng2, int nf, int nt, int Fs, float winLen, float stepLen, float freqStep,
-	int freqStart, double fftSec, double alpha)
-	: nFreqs(nf)
+CumulativeTFR::CumulativeTFR(int nChans, int nPairs, const std::vector<double>& freqs, int nt, double Fs, float winLen,
+	float stepLen, double fftSec, double alpha, int windowSize, bool collapseTime,
+	const std::vector<double>& extraAlphas)
+	: freqs(freqs)
+	, nFreqs(int(freqs.size()))
 	, Fs(Fs)
 	, stepLen(stepLen)
 	, nTimes(nt)
-	, nfft(int(fftSec * Fs))
+	, nSegmentSamples(int(fftSec * Fs))
+	, nfft(getFFTLength(fftSec, Fs))
 	, ifftBuffer(nfft)
 	, alpha(alpha)
-	, pxys(ng1 * ng2,
-		vector<vector<ComplexWeightedAccum>>(nf,
-			vector<ComplexWeightedAccum>(nt, ComplexWeightedAccum(alpha))))
+	, windowSize(windowSize)
+	, collapseTime(collapseTime)
+	, nAccumTimes(collapseTime ? 1 : nt)
+	, pxys(nPairs,
+		vector<vector<ComplexWeightedAccum>>(nFreqs,
+			vector<ComplexWeightedAccum>(nAccumTimes, ComplexWeightedAccum(windowSize > 0 ? 0 : alpha))))
 	, windowLen(winLen)
-	, waveletArray(nf, vector<std::complex<double>>(nfft))
-	, spectrumBuffer(ng1 + ng2,
-		vector<vector<std::complex<double>>>(nf,
+	, waveletArray(nFreqs, vector<std::complex<double>>(nfft))
+	, spectrumBuffer(nChans,
+		vector<vector<std::complex<double>>>(nFreqs,
 			vector<std::complex<double>>(nt)))
-	, powBuffer(ng1 + ng2,
-		vector<vector<RealWeightedAccum>>(nf,
-			vector<RealWeightedAccum>(nt, RealWeightedAccum(alpha))))
-	, freqStep(freqStep)
-	, freqStart(freqStart)
+	, powBuffer(nChans,
+		vector<vector<RealWeightedAccum>>(nFreqs,
+			vector<RealWeightedAccum>(nAccumTimes, RealWeightedAccum(windowSize > 0 ? 0 : alpha))))
+	, envelopes(nPairs, vector<EnvelopeAccum>(nFreqs, EnvelopeAccum(windowSize > 0 ? 0 : alpha)))
+	, extraAlphas(extraAlphas)
+	, baseline(nullptr)
+	, pac(nullptr)
+	, pacWindowLen(0)
+	, bandWeights(nFreqs)
+	, nBands(0)
+	, channelValid(nChans, true)
+	, historyPos(-1)
+	, nHistory(0)
+	, segmentCoherence(nFreqs)
 {
+	if (windowSize > 0)
+	{
+		pxyHistory.resize(size_t(windowSize) * nPairs * nFreqs * nAccumTimes);
+		envelopeHistory.resize(size_t(windowSize) * nPairs * nFreqs * ENVELOPE_MOMENTS);
+		powHistory.resize(size_t(windowSize) * nChans * nFreqs * nAccumTimes);
+		pairHistoryValid.resize(size_t(windowSize) * nPairs);
+		chanHistoryValid.resize(size_t(windowSize) * nChans);
+	}
+
+	for (double extraAlpha : extraAlphas)
+	{
+		extraPxys.emplace_back(nPairs, vector<vector<ComplexWeightedAccum>>(nFreqs,
+			vector<ComplexWeightedAccum>(nAccumTimes, ComplexWeightedAccum(extraAlpha))));
+		extraPow.emplace_back(nChans, vector<vector<RealWeightedAccum>>(nFreqs,
+			vector<RealWeightedAccum>(nAccumTimes, RealWeightedAccum(extraAlpha))));
+	}
+
 	// Create array of wavelets
-	generateWavelet();
+	generateWavelets(freqs, windowLen, waveletArray);
 
 	// Trim time close to edge
 	trimTime = windowLen / 2;
@@ -57,12 +90,20 @@ CumulativeTFR::CumulativeTFR(int ng1, int ng2, int nf, int nt, int Fs, float win
 
 void CumulativeTFR::addTrial(FFTWArrayType& fftBuffer, int chanIt)
 {
-	float winsPerSegment = (segmentLen - windowLen) / stepLen;
+	// Re-referenced channels are built from the inputs in finishTrial
+	auto& spectra = montageTerms.empty() ? spectrumBuffer : inputSpectrumBuffer;
+
+	// Zero-pad the segment (the buffer still holds the last transform past it)
+	jassert(fftBuffer.getLength() == nfft);
+	for (int n = nSegmentSamples; n < nfft; n++)
+	{
+		fftBuffer.set(n, 0.0);
+	}
 
 	//// Execute fft ////
 	fftBuffer.fftReal();
 	float nWindow = Fs * windowLen;
-	//// Use freqData to find generate spectrum and get power ////
+	//// Use freqData to find generate spectrum ////
 	for (int freq = 0; freq < nFreqs; freq++)
 	{
 		// Multiple fft data by wavelet
@@ -76,30 +117,453 @@ void CumulativeTFR::addTrial(FFTWArrayType& fftBuffer, int chanIt)
 		// Loop over time of interest
 		for (int t = 0; t < nTimes; t++)
 		{
-			int tIndex = int(((t * stepLen) + trimTime)  * Fs); // get index of time of interest
+			int tIndex = getTimeIndex(t); // get index of time of interest
 			std::complex<double> complex = ifftBuffer.getAsComplex(tIndex);
 			complex *= sqrt(2.0 / nWindow) / double(nfft); // divide by nfft from matlab ifft
 														   // sqrt(2/nWindow) from ft_specest_mtmconvol.m 
-			// Save convOutput for crss later
-			spectrumBuffer[chanIt][freq][t] = complex;
-			// Get power
-			double power = std::norm(complex);
+			// Save convOutput for crss and power later
+			spectra[chanIt][freq][t] = complex;
+		}
+
+		// PAC phase, from the same transform on PAC's time grid
+		int p = pac && !pacInputSpectra[chanIt].empty() ? freq - pac->getPhaseStart() : -1;
+		if (p >= 0 && p < pac->getNumPhaseFreqs())
+		{
+			std::complex<double>* dest = pacInputSpectra[chanIt][p].data();
+			for (int t = 0; t < int(pacTimes.size()); t++)
+			{
+				dest[t] = ifftBuffer.getAsComplex(pacTimes[t]) * (sqrt(2.0 / nWindow) / double(nfft));
+			}
+		}
+	}
+
+	// PAC amplitude, from the short wavelets
+	if (pac && !pacInputSpectra[chanIt].empty())
+	{
+		int nPhase = pac->getNumPhaseFreqs();
+		double scale = sqrt(2.0 / (Fs * pacWindowLen)) / double(nfft);
+		for (int a = 0; a < int(pacWavelets.size()); a++)
+		{
+			for (int n = 0; n < nfft; n++)
+			{
+				ifftBuffer.set(n, fftBuffer.getAsComplex(n) * pacWavelets[a][n]);
+			}
+			ifftBuffer.ifft();
+
+			std::complex<double>* dest = pacInputSpectra[chanIt][nPhase + a].data();
+			for (int t = 0; t < int(pacTimes.size()); t++)
+			{
+				dest[t] = ifftBuffer.getAsComplex(pacTimes[t]) * scale;
+			}
+		}
+	}
+}
+
+void CumulativeTFR::finishTrial(const std::vector<bool>& inputValid)
+{
+	int nChans = spectrumBuffer.size();
+
+	// Masks, through the montage if there is one. A masked input in the common average masks every channel.
+	bool averageValid = true;
+	if (!inputValid.empty())
+	{
+		for (const auto& term : montageAverage)
+		{
+			averageValid = averageValid && inputValid[term.first];
+		}
+	}
+	for (int chan = 0; chan < nChans; chan++)
+	{
+		channelValid[chan] = averageValid && isMontageValid(chan, inputValid);
+	}
+
+	// Montage: each channel is a weighted sum of input spectra
+	if (!montageTerms.empty())
+	{
+		applyMontage(inputSpectrumBuffer, montageChans, spectrumBuffer);
+	}
+
+	// The oldest segment leaves the sliding window
+	if (windowSize > 0)
+	{
+		advanceWindow();
+	}
+
+	// Get power, once for every average
+	int nExtra = int(extraAlphas.size());
+	for (int chan = 0; chan < nChans; chan++)
+	{
+		if (!channelValid[chan])
+		{
+			continue;
+		}
+
+		double* history = nullptr;
+		if (windowSize > 0)
+		{
+			chanHistoryValid[size_t(historyPos) * nChans + chan] = true;
+			history = getPowHistory(historyPos, chan);
+		}
+
+		for (int freq = 0; freq < nFreqs; freq++)
+		{
+			double powerSum = 0;
+			for (int t = 0; t < nTimes; t++)
+			{
+				double power = std::norm(spectrumBuffer[chan][freq][t]);
+
+				if (collapseTime)
+				{
+					powerSum += power;
+				}
+				else
+				{
+					powBuffer[chan][freq][t].addValue(power);
+					for (int k = 0; k < nExtra; k++)
+					{
+						extraPow[k][chan][freq][t].addValue(power);
+					}
+					if (history)
+					{
+						history[freq * nAccumTimes + t] = power;
+					}
+				}
+			}
+
+			if (collapseTime)
+			{
+				powBuffer[chan][freq][0].addValue(powerSum / nTimes);
+				for (int k = 0; k < nExtra; k++)
+				{
+					extraPow[k][chan][freq][0].addValue(powerSum / nTimes);
+				}
+				if (history)
+				{
+					history[freq] = powerSum / nTimes;
+				}
+			}
+		}
+	}
+
+	if (pac)
+	{
+		// PAC channels through the montage, like the spectra above
+		for (int c = 0; c < int(pacSlots.size()); c++)
+		{
+			pacValid[c] = channelValid[pacSlots[c]];
+			if (montageTerms.empty())
+			{
+				pacSpectra[c] = pacInputSpectra[pacSlots[c]];
+			}
+		}
+		if (!montageTerms.empty())
+		{
+			applyMontage(pacInputSpectra, pacSlots, pacSpectra);
+		}
+
+		pac->addSegment(pacSpectra, pacValid);
+	}
+}
+
+bool CumulativeTFR::isChannelValid(int chan) const
+{
+	return channelValid[chan];
+}
+
+bool CumulativeTFR::allChannelsValid() const
+{
+	return std::find(channelValid.begin(), channelValid.end(), false) == channelValid.end();
+}
+
+const std::vector<std::vector<std::vector<std::complex<double>>>>& CumulativeTFR::getSpectra() const
+{
+	return spectrumBuffer;
+}
+
+void CumulativeTFR::setPAC(PhaseAmplitudeCoupling* p, const std::vector<int>& slots)
+{
+	pac = p;
+	pacSlots = slots;
+	pacTimes.clear();
+	pacWavelets.clear();
+	pacInputSpectra.clear();
+	pacSpectra.clear();
+	pacValid.clear();
+
+	if (!pac || pac->getNumPhaseFreqs() == 0 || pac->getNumAmpFreqs() == 0)
+	{
+		pac = nullptr;
+		return;
+	}
+
+	int nPhase = pac->getNumPhaseFreqs();
+	int nAmp = pac->getNumAmpFreqs();
+	double maxPhaseFreq = freqs[pac->getPhaseStart() + nPhase - 1];
+
+	// Dense time grid over the same span as the times of interest
+	int step = PhaseAmplitudeCoupling::getTimeStep(maxPhaseFreq, Fs);
+	for (int index = getTimeIndex(0); index <= getTimeIndex(nTimes - 1); index += step)
+	{
+		pacTimes.push_back(index);
+	}
+
+	// Short amplitude wavelets, which fit inside the phase wavelets' trimmed edges
+	pacWindowLen = float(PhaseAmplitudeCoupling::getAmpWindowSeconds(maxPhaseFreq, windowLen));
+	vector<double> ampFreqs(freqs.begin() + pac->getAmpStart(), freqs.begin() + pac->getAmpStart() + nAmp);
+	generateWavelets(ampFreqs, pacWindowLen, pacWavelets);
+
+	// Spectra only for the addTrial slots the PAC channels are built from
+	int nSlots = montageTerms.empty() ? int(spectrumBuffer.size()) : int(inputSpectrumBuffer.size());
+	vector<vector<std::complex<double>>> slotSpectra(nPhase + nAmp, vector<std::complex<double>>(pacTimes.size()));
+	pacInputSpectra.resize(nSlots);
+	for (int chan : pacSlots)
+	{
+		if (montageTerms.empty())
+		{
+			pacInputSpectra[chan] = slotSpectra;
+			continue;
+		}
+		for (const auto& term : montageTerms[chan])
+		{
+			if (pacInputSpectra[term.first].empty())
+			{
+				pacInputSpectra[term.first] = slotSpectra;
+			}
+		}
+		for (const auto& term : montageAverage)
+		{
+			if (pacInputSpectra[term.first].empty())
+			{
+				pacInputSpectra[term.first] = slotSpectra;
+			}
+		}
+	}
+	pacSpectra.assign(pacSlots.size(), slotSpectra);
+	pacValid.assign(pacSlots.size(), true);
+	if (!montageAverage.empty() && averageSpectrum.size() < pacTimes.size())
+	{
+		averageSpectrum.resize(pacTimes.size());
+	}
+}
+
+int64 CumulativeTFR::getPACMemory(int nSlots, int nPACChans, int nPhase, int nAmp, double maxPhaseFreq,
+	int nt, double Fs, float winLen, float stepLen, double fftSec)
+{
+	int64 nPACTimes = int64(((nt - 1) * stepLen) * Fs) / PhaseAmplitudeCoupling::getTimeStep(maxPhaseFreq, Fs) + 1;
+	int64 nfft = getFFTLength(fftSec, Fs);
+	// spectra of every slot and PAC channel, and the amplitude wavelets
+	return int64(nSlots + nPACChans) * (nPhase + nAmp) * nPACTimes * sizeof(std::complex<double>)
+		+ nAmp * nfft * sizeof(std::complex<double>);
+}
+
+void CumulativeTFR::setMontage(int nInputs, const std::vector<Montage::Terms>& terms,
+	const Montage::Terms& averageTerms)
+{
+	montageTerms = terms;
+	montageAverage = terms.empty() ? Montage::Terms() : averageTerms;
+	averageSpectrum.assign(montageAverage.empty() ? 0 : nTimes, std::complex<double>());
+	montageChans.clear();
+
+	if (montageTerms.empty())
+	{
+		inputSpectrumBuffer.clear();
+	}
+	else
+	{
+		jassert(montageTerms.size() == spectrumBuffer.size());
+		inputSpectrumBuffer.assign(nInputs,
+			vector<vector<std::complex<double>>>(nFreqs, vector<std::complex<double>>(nTimes)));
+		for (int chan = 0; chan < int(montageTerms.size()); chan++)
+		{
+			montageChans.push_back(chan);
+		}
+	}
+}
+
+void CumulativeTFR::applyMontage(const vector<vector<vector<std::complex<double>>>>& inputs,
+	const vector<int>& chans, vector<vector<vector<std::complex<double>>>>& dest)
+{
+	if (chans.empty())
+	{
+		return;
+	}
 
-			powBuffer[chanIt][freq][t].addValue(power);
+	int nRows = int(dest[0].size());
+	int nT = int(dest[0][0].size());
+	for (int row = 0; row < nRows; row++)
+	{
+		if (!montageAverage.empty())
+		{
+			std::fill(averageSpectrum.begin(), averageSpectrum.begin() + nT, std::complex<double>());
+			for (const auto& term : montageAverage)
+			{
+				const std::complex<double>* src = inputs[term.first][row].data();
+				for (int t = 0; t < nT; t++)
+				{
+					averageSpectrum[t] += term.second * src[t];
+				}
+			}
+		}
+
+		for (int i = 0; i < int(chans.size()); i++)
+		{
+			const Montage::Terms& terms = montageTerms[chans[i]];
+			std::complex<double>* out = dest[i][row].data();
+			const std::complex<double>* src = inputs[terms[0].first][row].data();
+			for (int t = 0; t < nT; t++)
+			{
+				out[t] = terms[0].second * src[t];
+			}
+
+			for (int term = 1; term < terms.size(); term++)
+			{
+				src = inputs[terms[term].first][row].data();
+				double weight = terms[term].second;
+				for (int t = 0; t < nT; t++)
+				{
+					out[t] += weight * src[t];
+				}
+			}
+
+			if (!montageAverage.empty())
+			{
+				for (int t = 0; t < nT; t++)
+				{
+					out[t] -= averageSpectrum[t];
+				}
+			}
 		}
 	}
 }
 
-void CumulativeTFR::getMeanCoherence(int itX, int itY, double* meanDest, int comb)
+bool CumulativeTFR::isMontageValid(int chan, const std::vector<bool>& inputValid) const
 {
-	// Cross spectra
+	if (inputValid.empty())
+	{
+		return true;
+	}
+	if (montageTerms.empty())
+	{
+		return inputValid[chan];
+	}
+
+	for (const auto& term : montageTerms[chan])
+	{
+		if (!inputValid[term.first])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void CumulativeTFR::getMeanCoherence(int itX, int itY, double* meanDest, int comb, double* bandDest,
+	double* envelopeDest)
+{
+	if (bandDest)
+	{
+		std::fill(bandDest, bandDest + nBands, 0.0);
+	}
+
+	// A masked pair adds nothing this segment, its output is the average so far (0 if z-scored)
+	bool pairValid = channelValid[itX] && channelValid[itY];
+
+	CoherenceBaseline::Mode baselineMode = baseline ? baseline->getMode() : CoherenceBaseline::OFF;
+	bool capturing = baselineMode == CoherenceBaseline::CAPTURE && pairValid;
+	if (capturing)
+	{
+		baseline->beginSegment(comb);
+	}
+
+	std::complex<double>* pxyHist = nullptr;
+	double* envelopeHist = nullptr;
+	if (windowSize > 0 && pairValid)
+	{
+		pairHistoryValid[size_t(historyPos) * pxys.size() + comb] = true;
+		pxyHist = getPxyHistory(historyPos, comb);
+		envelopeHist = getEnvelopeHistory(historyPos, comb);
+	}
+
+	// Cross spectra (once for every average) and amplitude envelope moments
+	int nExtra = int(extraAlphas.size());
 	for (int f = 0; f < nFreqs; ++f)
 	{
+		if (!pairValid)
+		{
+			if (envelopeDest)
+			{
+				envelopeDest[f] = envelopes[comb][f].getCorrelation();
+			}
+			continue;
+		}
+
 		// Get crss from specturm of both chanX and chanY
+		std::complex<double> crssSum = 0;
+		double sumX = 0, sumY = 0, sumXX = 0, sumYY = 0, sumXY = 0;
 		for (int t = 0; t < nTimes; t++)
 		{
-			std::complex<double> crss = spectrumBuffer[itX][f][t] * std::conj(spectrumBuffer[itY][f][t]);
-			pxys[comb][f][t].addValue(crss);
+			const std::complex<double>& specX = spectrumBuffer[itX][f][t];
+			const std::complex<double>& specY = spectrumBuffer[itY][f][t];
+
+			double ampX = std::abs(specX);
+			double ampY = std::abs(specY);
+			sumX += ampX;
+			sumY += ampY;
+			sumXX += ampX * ampX;
+			sumYY += ampY * ampY;
+			sumXY += ampX * ampY;
+
+			std::complex<double> crss = specX * std::conj(specY);
+			crssSum += crss;
+			if (!collapseTime)
+			{
+				pxys[comb][f][t].addValue(crss);
+				for (int k = 0; k < nExtra; k++)
+				{
+					extraPxys[k][comb][f][t].addValue(crss);
+				}
+				if (pxyHist)
+				{
+					pxyHist[f * nAccumTimes + t] = crss;
+				}
+			}
+		}
+
+		if (collapseTime)
+		{
+			pxys[comb][f][0].addValue(crssSum / double(nTimes));
+			for (int k = 0; k < nExtra; k++)
+			{
+				extraPxys[k][comb][f][0].addValue(crssSum / double(nTimes));
+			}
+			if (pxyHist)
+			{
+				pxyHist[f] = crssSum / double(nTimes);
+			}
+		}
+
+		// This segment's own coherence, pooled over its times of interest
+		segmentCoherence[f] = sumXX > 0 && sumYY > 0 ? std::norm(crssSum) / (sumXX * sumYY) : 0;
+
+		EnvelopeAccum& envelope = envelopes[comb][f];
+		envelope.x.addValue(sumX / nTimes);
+		envelope.y.addValue(sumY / nTimes);
+		envelope.xx.addValue(sumXX / nTimes);
+		envelope.yy.addValue(sumYY / nTimes);
+		envelope.xy.addValue(sumXY / nTimes);
+		if (envelopeHist)
+		{
+			double* moments = envelopeHist + f * ENVELOPE_MOMENTS;
+			moments[0] = sumX / nTimes;
+			moments[1] = sumY / nTimes;
+			moments[2] = sumXX / nTimes;
+			moments[3] = sumYY / nTimes;
+			moments[4] = sumXY / nTimes;
+		}
+
+		if (envelopeDest)
+		{
+			envelopeDest[f] = envelope.getCorrelation();
 		}
 	}
 
@@ -110,7 +574,7 @@ void CumulativeTFR::getMeanCoherence(int itX, int itY, double* meanDest, int com
 		// compute coherence at each time
 		RealAccum coh;
 
-		for (int t = 0; t < nTimes; t++)
+		for (int t = 0; t < nAccumTimes; t++)
 		{
 			coh.addValue(singleCoherence(
 				powBuffer[itX][f][t].getAverage(),
@@ -119,64 +583,477 @@ void CumulativeTFR::getMeanCoherence(int itX, int itY, double* meanDest, int com
 		}
 
 		meanDest[f] = coh.getAverage();
-		if (nTimes < 2)
+
+		// The baseline is of single segments: the running average is autocorrelated from one
+		// segment to the next, so its spread would understate the variance
+		if (capturing)
+		{
+			baseline->addValue(comb, f, segmentCoherence[f]);
+		}
+		else if (baselineMode == CoherenceBaseline::ZSCORE)
+		{
+			meanDest[f] = pairValid ? baseline->getZScore(comb, f, segmentCoherence[f]) : 0;
+		}
+
+		if (bandDest)
+		{
+			for (const auto& bandWeight : bandWeights[f])
+			{
+				bandDest[bandWeight.first] += bandWeight.second * meanDest[f];
+			}
+		}
+
+		if (nAccumTimes < 2)
 		{
 			stdDest[f] = 0;
 		}
 		else
 		{
-			stdDest[f] = std::sqrt(coh.getVariance() * nTimes / (nTimes - 1));
+			stdDest[f] = std::sqrt(coh.getVariance() * nAccumTimes / (nAccumTimes - 1));
 		}
 	}
 
 	return;
 }
 
-std::vector<std::vector<float>> CumulativeTFR::getPowerForChannels()
+void CumulativeTFR::getExtraCoherence(int itX, int itY, int comb, int k, double* dest)
+{
+	for (int f = 0; f < nFreqs; ++f)
+	{
+		dest[f] = getAccumCoherence(extraPow[k][itX][f], extraPow[k][itY][f], extraPxys[k][comb][f]);
+	}
+}
+
+int CumulativeTFR::getNumExtraAlphas() const
+{
+	return int(extraAlphas.size());
+}
+
+double CumulativeTFR::getAccumCoherence(const vector<RealWeightedAccum>& powX,
+	const vector<RealWeightedAccum>& powY, const vector<ComplexWeightedAccum>& pxy) const
+{
+	RealAccum coh;
+	for (int t = 0; t < nAccumTimes; t++)
+	{
+		coh.addValue(singleCoherence(powX[t].getAverage(), powY[t].getAverage(), pxy[t].getAverage()));
+	}
+	return coh.getAverage();
+}
+
+TFRMemoryPlan CumulativeTFR::planMemory(int nChans, int nPairs, int nf, int nt, double Fs, double fftSec,
+	int windowSize, bool collapseTime, int nInputs, int nExtraAlphas)
+{
+	const int64 vecSize = sizeof(vector<int>);
+	int64 nfft = getFFTLength(fftSec, Fs);
+	int64 nAccumTimes = collapseTime ? 1 : nt;
+
+	TFRMemoryPlan plan;
+	plan.collapseTime = collapseTime;
+	plan.nfft = int(nfft);
+	plan.rawNfft = int(fftSec * Fs);
+
+	// the sliding window history is counted with the accumulators it feeds
+	plan.pxys = vecSize + int64(nPairs) * (vecSize + nf * (vecSize + nAccumTimes * sizeof(ComplexWeightedAccum)))
+		+ windowSize * (int64(nPairs) * nf * nAccumTimes * sizeof(std::complex<double>) + nPairs / 8 + 1);
+
+	plan.powBuffer = vecSize + int64(nChans) * (vecSize + nf * (vecSize + nAccumTimes * sizeof(RealWeightedAccum)))
+		+ windowSize * (int64(nChans) * nf * nAccumTimes * sizeof(double) + nChans / 8 + 1);
+
+	// extra alphas are exponential only, so without window history
+	plan.pxys += vecSize + nExtraAlphas * (vecSize + int64(nPairs) * (vecSize + nf * (vecSize + nAccumTimes * sizeof(ComplexWeightedAccum))));
+	plan.powBuffer += vecSize + nExtraAlphas * (vecSize + int64(nChans) * (vecSize + nf * (vecSize + nAccumTimes * sizeof(RealWeightedAccum))));
+
+	plan.envelopes = vecSize + int64(nPairs) * (vecSize + nf * sizeof(EnvelopeAccum))
+		+ int64(windowSize) * nPairs * nf * ENVELOPE_MOMENTS * sizeof(double);
+
+	plan.spectrumBuffer = vecSize + int64(nChans + nInputs) * (vecSize + nf * (vecSize + nt * sizeof(std::complex<double>)));
+	plan.waveletArray = vecSize + nf * (vecSize + nfft * sizeof(std::complex<double>));
+
+	// ifftBuffer, plus hann/sin/cos and the wavelet fft buffer in generateWavelet
+	plan.fftBuffers = nfft * sizeof(std::complex<double>) * 2 + nfft * sizeof(double) * 3;
+
+	return plan;
+}
+
+int CumulativeTFR::getFFTLength(double fftSec, double Fs)
+{
+	return getSmoothLength(int(fftSec * Fs));
+}
+
+int CumulativeTFR::getSmoothLength(int n)
+{
+	for (int length = jmax(1, n); ; length++)
+	{
+		int rest = length;
+		for (int factor : { 2, 3, 5, 7 })
+		{
+			while (rest % factor == 0)
+			{
+				rest /= factor;
+			}
+		}
+		if (rest == 1)
+		{
+			return length;
+		}
+	}
+}
+
+double CumulativeTFR::estimateFFTCost(int n)
+{
+	// Mixed-radix FFTs do about n * p work for each prime factor p; large primes fall back
+	// to much slower algorithms, which this still underestimates
+	double factorSum = 0;
+	int rest = n;
+	for (int factor = 2; factor * factor <= rest; factor++)
+	{
+		while (rest % factor == 0)
+		{
+			factorSum += factor;
+			rest /= factor;
+		}
+	}
+	if (rest > 1)
+	{
+		factorSum += rest;
+	}
+	return double(n) * jmax(1.0, factorSum);
+}
+
+int64 CumulativeTFR::getWindowMemory(int nChans, int nPairs, int nf, int nt, int windowSize)
+{
+	int64 nAccums = int64(nf) * nt;
+	int64 nEnvelopeMoments = int64(nf) * nPairs * ENVELOPE_MOMENTS;
+	return windowSize * (nAccums * (int64(nPairs) * sizeof(std::complex<double>) + int64(nChans) * sizeof(double))
+		+ nEnvelopeMoments * sizeof(double) + (int64(nPairs) + nChans) / 8 + 2);
+}
+
+std::complex<double>* CumulativeTFR::getPxyHistory(int slot, int comb)
+{
+	return pxyHistory.data() + (slot * pxys.size() + comb) * nFreqs * nAccumTimes;
+}
+
+double* CumulativeTFR::getPowHistory(int slot, int chan)
+{
+	return powHistory.data() + (slot * powBuffer.size() + chan) * nFreqs * nAccumTimes;
+}
+
+double* CumulativeTFR::getEnvelopeHistory(int slot, int comb)
+{
+	return envelopeHistory.data() + (slot * envelopes.size() + comb) * nFreqs * ENVELOPE_MOMENTS;
+}
+
+void CumulativeTFR::advanceWindow()
+{
+	size_t nPairs = pxys.size();
+	size_t nChans = powBuffer.size();
+	historyPos = (historyPos + 1) % windowSize;
+
+	if (nHistory < windowSize)
+	{
+		nHistory++;
+	}
+	else if (historyPos == 0)
+	{
+		// Rebuild the sums from the segments that stay, oldest first
+		for (auto& pairPxys : pxys)
+		{
+			for (auto& freqPxys : pairPxys)
+			{
+				for (auto& accum : freqPxys)
+				{
+					accum.clear();
+				}
+			}
+		}
+		for (auto& chanPow : powBuffer)
+		{
+			for (auto& freqPow : chanPow)
+			{
+				for (auto& accum : freqPow)
+				{
+					accum.clear();
+				}
+			}
+		}
+		for (auto& pairEnvelopes : envelopes)
+		{
+			for (auto& envelope : pairEnvelopes)
+			{
+				envelope.clear();
+			}
+		}
+
+		for (int slot = 1; slot < windowSize; slot++)
+		{
+			addHistory(slot);
+		}
+	}
+	else
+	{
+		removeHistory(historyPos);
+	}
+
+	std::fill(pairHistoryValid.begin() + historyPos * nPairs,
+		pairHistoryValid.begin() + (historyPos + 1) * nPairs, false);
+	std::fill(chanHistoryValid.begin() + historyPos * nChans,
+		chanHistoryValid.begin() + (historyPos + 1) * nChans, false);
+}
+
+void CumulativeTFR::addHistory(int slot)
+{
+	int nChans = int(powBuffer.size());
+	int nPairs = int(pxys.size());
+
+	for (int chan = 0; chan < nChans; chan++)
+	{
+		if (chanHistoryValid[size_t(slot) * nChans + chan])
+		{
+			const double* history = getPowHistory(slot, chan);
+			for (int f = 0; f < nFreqs; f++)
+			{
+				for (int t = 0; t < nAccumTimes; t++)
+				{
+					powBuffer[chan][f][t].addValue(history[f * nAccumTimes + t]);
+				}
+			}
+		}
+	}
+
+	for (int comb = 0; comb < nPairs; comb++)
+	{
+		if (pairHistoryValid[size_t(slot) * nPairs + comb])
+		{
+			const std::complex<double>* history = getPxyHistory(slot, comb);
+			const double* moments = getEnvelopeHistory(slot, comb);
+			for (int f = 0; f < nFreqs; f++)
+			{
+				for (int t = 0; t < nAccumTimes; t++)
+				{
+					pxys[comb][f][t].addValue(history[f * nAccumTimes + t]);
+				}
+				envelopes[comb][f].addValue(moments + f * ENVELOPE_MOMENTS);
+			}
+		}
+	}
+}
+
+void CumulativeTFR::removeHistory(int slot)
 {
-	int channels = powBuffer.size();
-	int Frequency = powBuffer[0].size();
-	int Time = powBuffer[0][0].size();
+	int nChans = int(powBuffer.size());
+	int nPairs = int(pxys.size());
+
+	for (int chan = 0; chan < nChans; chan++)
+	{
+		if (chanHistoryValid[size_t(slot) * nChans + chan])
+		{
+			const double* history = getPowHistory(slot, chan);
+			for (int f = 0; f < nFreqs; f++)
+			{
+				for (int t = 0; t < nAccumTimes; t++)
+				{
+					powBuffer[chan][f][t].removeValue(history[f * nAccumTimes + t]);
+				}
+			}
+		}
+	}
 
-	std::vector<std::vector<std::vector<float>>> Totalpower(channels, std::vector<std::vector<float>>(Frequency, std::vector<float>(Time, 0)));
-	std::vector<std::vector<float>> PwrIndFreqAvg(channels, std::vector<float>(Frequency, 0));
-	for (int chn = 0; chn < channels; ++chn)
+	for (int comb = 0; comb < nPairs; comb++)
 	{
-		for (int frq = 0; frq < Frequency; ++frq)
+		if (pairHistoryValid[size_t(slot) * nPairs + comb])
+		{
+			const std::complex<double>* history = getPxyHistory(slot, comb);
+			const double* moments = getEnvelopeHistory(slot, comb);
+			for (int f = 0; f < nFreqs; f++)
+			{
+				for (int t = 0; t < nAccumTimes; t++)
+				{
+					pxys[comb][f][t].removeValue(history[f * nAccumTimes + t]);
+				}
+				envelopes[comb][f].removeValue(moments + f * ENVELOPE_MOMENTS);
+			}
+		}
+	}
+}
+
+void CumulativeTFR::getPhaseSlope(int itX, int itY, int comb, double* psiDest, double* delayDest)
+{
+	std::fill(psiDest, psiDest + nBands, 0.0);
+	std::fill(delayDest, delayDest + nBands, 0.0);
+	if (nBands == 0)
+	{
+		return;
+	}
+
+	// Sum of conj(C(f)) * C(f + df) over adjacent frequencies that are both in the band,
+	// and of the steps df (which vary on a log or explicit grid)
+	std::vector<std::complex<double>> slopeSums(nBands);
+	std::vector<double> stepSums(nBands);
+	std::vector<int> stepCounts(nBands);
+	std::complex<double> coherency = getCoherency(itX, itY, comb, 0);
+	for (int f = 0; f + 1 < nFreqs; f++)
+	{
+		std::complex<double> nextCoherency = getCoherency(itX, itY, comb, f + 1);
+		std::complex<double> slope = std::conj(coherency) * nextCoherency;
+
+		for (const auto& bandWeight : bandWeights[f])
+		{
+			for (const auto& nextBandWeight : bandWeights[f + 1])
+			{
+				if (nextBandWeight.first == bandWeight.first)
+				{
+					slopeSums[bandWeight.first] += slope;
+					stepSums[bandWeight.first] += freqs[f + 1] - freqs[f];
+					stepCounts[bandWeight.first]++;
+				}
+			}
+		}
+		coherency = nextCoherency;
+	}
+
+	for (int b = 0; b < nBands; b++)
+	{
+		psiDest[b] = slopeSums[b].imag();
+		// mean phase step per frequency step is 2 * pi * df * delay
+		double meanStep = stepCounts[b] > 0 ? stepSums[b] / stepCounts[b] : 0;
+		delayDest[b] = std::abs(slopeSums[b]) > 0 && meanStep > 0 ? std::arg(slopeSums[b]) / (2 * double_Pi * meanStep) : 0;
+	}
+}
+
+void CumulativeTFR::setBaseline(CoherenceBaseline* b)
+{
+	baseline = b;
+}
+
+void CumulativeTFR::setBands(const std::vector<FrequencyBand>& bands)
+{
+	bandWeights = FrequencyBands::getWeights(bands, freqs);
+	nBands = int(bands.size());
+}
+
+int CumulativeTFR::getNumBands() const
+{
+	return nBands;
+}
+
+void CumulativeTFR::getPowerForChannels(const std::vector<int>& slots, std::vector<std::vector<float>>& dest,
+	std::vector<std::vector<float>>* bandDest)
+{
+	int Time = nAccumTimes;
+
+	for (int i = 0; i < slots.size(); ++i)
+	{
+		int chn = slots[i];
+		if (bandDest)
+		{
+			std::fill((*bandDest)[i].begin(), (*bandDest)[i].end(), 0.0f);
+		}
+
+		for (int frq = 0; frq < nFreqs; ++frq)
 		{
 			float avg = 0;
 			for (int pr = 0; pr < Time; ++pr)
 			{
-				Totalpower[chn][frq][pr] = Totalpower[chn][frq][pr] + (float)powBuffer[chn][frq][pr].getSum();
-				avg = avg + Totalpower[chn][frq][pr];
+				avg = avg + (float)powBuffer[chn][frq][pr].getSum();
+			}
+			dest[i][frq] = (avg / Time);
+
+			if (bandDest)
+			{
+				for (const auto& bandWeight : bandWeights[frq])
+				{
+					(*bandDest)[i][bandWeight.first] += float(bandWeight.second) * dest[i][frq];
+				}
 			}
-			PwrIndFreqAvg[chn][frq] = (avg / Time);
 		}
 	}
-	return PwrIndFreqAvg;
 }
 
 
 
+// > TFRMemoryPlan
+
+TFRMemoryPlan::TFRMemoryPlan()
+	: pxys(0)
+	, powBuffer(0)
+	, envelopes(0)
+	, spectrumBuffer(0)
+	, waveletArray(0)
+	, fftBuffers(0)
+	, dataBuffers(0)
+	, outputs(0)
+	, nfft(0)
+	, rawNfft(0)
+	, collapseTime(false)
+{}
+
+int64 TFRMemoryPlan::getTotal() const
+{
+	return pxys + powBuffer + envelopes + spectrumBuffer + waveletArray + fftBuffers + dataBuffers + outputs;
+}
+
+String TFRMemoryPlan::describe() const
+{
+	auto mb = [](int64 bytes) { return String(bytes / 1048576.0, 1) + " MB\n"; };
+
+	return "Cross-spectra: " + mb(pxys)
+		+ "Power: " + mb(powBuffer)
+		+ "Envelopes: " + mb(envelopes)
+		+ "Spectra: " + mb(spectrumBuffer)
+		+ "Wavelets: " + mb(waveletArray)
+		+ "FFT buffers: " + mb(fftBuffers)
+		+ "Input buffers: " + mb(dataBuffers)
+		+ "Outputs: " + mb(outputs)
+		+ "Total: " + mb(getTotal())
+		+ "FFT: " + String(nfft) + " points"
+		+ (nfft != rawNfft
+			? " (padded from " + String(rawNfft) + ", ~" + String(CumulativeTFR::estimateFFTCost(rawNfft)
+				/ CumulativeTFR::estimateFFTCost(nfft), 1) + "x faster)"
+			: String())
+		+ (collapseTime ? "\n(averaged over time to fit budget)" : "");
+}
+
 // > Private Methods
 
+std::complex<double> CumulativeTFR::getCoherency(int itX, int itY, int comb, int freq)
+{
+	std::complex<double> pxy = 0;
+	double pxx = 0;
+	double pyy = 0;
+	for (int t = 0; t < nAccumTimes; t++)
+	{
+		pxy += pxys[comb][freq][t].getAverage();
+		pxx += powBuffer[itX][freq][t].getAverage();
+		pyy += powBuffer[itY][freq][t].getAverage();
+	}
+
+	double norm = std::sqrt(pxx * pyy);
+	return norm > 0 ? pxy / norm : std::complex<double>();
+}
+
 double CumulativeTFR::singleCoherence(double pxx, double pyy, std::complex<double> pxy)
 {
 	return std::norm(pxy) / (pxx * pyy);
 }
 
 
-void CumulativeTFR::generateWavelet()
+int CumulativeTFR::getTimeIndex(int t) const
+{
+	return int(((t * stepLen) + trimTime) * Fs);
+}
+
+void CumulativeTFR::generateWavelets(const vector<double>& waveletFreqs, float windowSec,
+	vector<vector<std::complex<double>>>& dest)
 {
 	std::vector<double> hann(nfft);
 	std::vector<double> sinWave(nfft);
 	std::vector<double> cosWave(nfft);
 
-	waveletArray.resize(nFreqs);
+	dest.assign(waveletFreqs.size(), vector<std::complex<double>>(nfft));
 
 	// Hann window
 
-	float nSampWindow = Fs * windowLen;
+	float nSampWindow = Fs * windowSec;
 	for (int position = 0; position < nfft; position++)
 	{
 		//// Hann Window //// = sin^2(PI*n/N) where N=length of window
@@ -201,17 +1078,18 @@ void CumulativeTFR::generateWavelet()
 	}
 
 	// Wavelet
-	float freqNormalized = freqStart;
 	FFTWArrayType fftWaveletBuffer(nfft);
-	for (int freq = 0; freq < nFreqs; freq++)
+	for (int freq = 0; freq < int(waveletFreqs.size()); freq++)
 	{
 		for (int position = 0; position < nfft; position++)
 		{
-			// Make sin and cos wave.
-			sinWave[position] = std::sin(position * freqNormalized * (2 * double_Pi) / Fs);
-			cosWave[position] = std::cos(position * freqNormalized * (2 * double_Pi) / Fs);
+			// Make sin and cos wave. The second half of the window wraps around to before time 0,
+			// so its phase runs on from negative times; position itself would only line up with
+			// it if freq * nfft / Fs were a whole number of cycles.
+			int time = position > nfft / 2 ? position - nfft : position;
+			sinWave[position] = std::sin(time * waveletFreqs[freq] * (2 * double_Pi) / Fs);
+			cosWave[position] = std::cos(time * waveletFreqs[freq] * (2 * double_Pi) / Fs);
 		}
-		freqNormalized += freqStep;
 
 		//// Wavelet ////
 		// Put into fft input array
@@ -225,7 +1103,7 @@ void CumulativeTFR::generateWavelet()
 		// Save fft output for use later
 		for (int i = 0; i < nfft; i++)
 		{
-			waveletArray[freq][i] = fftWaveletBuffer.getAsComplex(i);
+			dest[freq][i] = fftWaveletBuffer.getAsComplex(i);
 		}
 	}
 }
@@ -27,6 +27,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //#include <FFTWWrapper.h>
 #include <OpenEphysFFTW.h>
 #include "CircularArray.h"
+#include "CoherenceBaseline.h"
+#include "FrequencyBands.h"
+#include "Montage.h"
+#include "PhaseAmplitudeCoupling.h"
 
 #include <vector>
 #include <complex>
@@ -34,6 +38,33 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 using FFTWArrayType = FFTWTransformableArrayUsing<0U>;
 // Changed to FFTW_MEASURE, slow start. Better performance?
 
+// Bytes taken by each structure of the TFR state, computed before anything is allocated.
+// Sizes include the vector bookkeeping of the nested containers, but not allocator overhead.
+struct TFRMemoryPlan
+{
+	TFRMemoryPlan();
+
+	int64 pxys;           // cross-spectrum accumulators (all alphas)
+	int64 powBuffer;      // power accumulators (all alphas)
+	int64 envelopes;      // amplitude envelope moment accumulators
+	int64 spectrumBuffer; // complex spectra of the latest segment (and of the inputs, if re-referenced)
+	int64 waveletArray;   // frequency-domain wavelets
+	int64 fftBuffers;     // ifft buffer and peak temporaries while generating wavelets
+	int64 dataBuffers;    // node input buffers (all copies)
+	int64 outputs;        // node coherence output (all copies)
+
+	int nfft;             // transform length, zero-padded up to a 2-3-5-7-smooth length
+	int rawNfft;          // samples in a segment
+
+	// Accumulators average over times of interest instead of keeping one per time
+	bool collapseTime;
+
+	int64 getTotal() const;
+
+	// One line per structure, in MB
+	String describe() const;
+};
+
 class CumulativeTFR
 {
 	// shorten some things
@@ -42,6 +73,12 @@ class CumulativeTFR
 
 	using RealAccum = StatisticsAccumulator<double>;
 
+	// Averaging of the accumulators below:
+	//  - alpha > 0: exponential decay
+	//  - otherwise: cumulative mean
+	// In sliding window mode (windowSize > 0) they're cumulative, and the TFR takes each segment's
+	// values back out with removeValue once it leaves the window (see advanceWindow).
+
 	struct ComplexWeightedAccum
 	{
 		ComplexWeightedAccum(double alpha)
@@ -50,9 +87,9 @@ class CumulativeTFR
 			, alpha(alpha)
 		{}
 
-		std::complex<double> getAverage()
+		std::complex<double> getAverage() const
 		{
-			return count > 0 ? sum / (double)count : std::complex<double>();
+			return count > 0 ? sum / count : std::complex<double>();
 		}
 
 		void addValue(std::complex<double> x)
@@ -61,9 +98,22 @@ class CumulativeTFR
 			count = 1 + (1 - alpha) * count;
 		}
 
+		// Cumulative mean only
+		void removeValue(std::complex<double> x)
+		{
+			sum -= x;
+			count -= 1;
+		}
+
+		void clear()
+		{
+			sum = 0;
+			count = 0;
+		}
+
 	private:
 		std::complex<double> sum;
-		size_t count;
+		double count;
 
 		const double alpha;
 	};
@@ -78,9 +128,9 @@ class CumulativeTFR
 			, alpha(alpha)
 		{}
 
-		double getAverage()
+		double getAverage() const
 		{
-			return count > 0 ? sum / (double)count : double();
+			return count > 0 ? sum / count : double();
 		}
 		double getSum()
 		{
@@ -93,59 +143,296 @@ class CumulativeTFR
 			count = 1 + (1 - alpha) * count;			
 		}
 
+		// Cumulative mean only
+		void removeValue(double x)
+		{
+			sum -= x;
+			count -= 1;
+		}
+
+		void clear()
+		{
+			sum = 0;
+			count = 0;
+		}
+
 	private:
 		double sum;
-		size_t count;
+		double count;
 		double spectSum;
 		const double alpha;
 	};
 
-public:
-	CumulativeTFR(int ng1, int ng2, int nf, int nt, int Fs,
-		float winLen = 2, float stepLen = 0.1, float freqStep = 0.25,
-		int freqStart = 1, double fftSec = 10.0, double alpha = 0);
+	// Moments of the amplitude envelopes of a pair at one frequency over times of interest,
+	// averaged over segments like the accumulators above, for their correlation
+	struct EnvelopeAccum
+	{
+		EnvelopeAccum(double alpha)
+			: x(alpha)
+			, y(alpha)
+			, xx(alpha)
+			, yy(alpha)
+			, xy(alpha)
+		{}
 
-	// Handle a new buffer of data. Preform FFT and create pxxs, pyys.
-	void addTrial(FFTWArrayType& fftBuffer, int chan);
+		double getCorrelation()
+		{
+			double meanX = x.getAverage();
+			double meanY = y.getAverage();
+			double varX = xx.getAverage() - meanX * meanX;
+			double varY = yy.getAverage() - meanY * meanY;
+			if (varX <= 0 || varY <= 0)
+			{
+				return 0;
+			}
+			return (xy.getAverage() - meanX * meanY) / std::sqrt(varX * varY);
+		}
 
-	// Function to get coherence between two channels
-	void getMeanCoherence(int chanX, int chanY, double* meanDest, int comb);
+		// moments: x, y, x^2, y^2 and xy of one segment
+		void addValue(const double* moments)
+		{
+			x.addValue(moments[0]);
+			y.addValue(moments[1]);
+			xx.addValue(moments[2]);
+			yy.addValue(moments[3]);
+			xy.addValue(moments[4]);
+		}
 
-	// Calculates power for all the input channels based on powerbuffer size. 
-	// Returns a vector of vector of float type i.e Vect[] corresponds to vector of power for different frequency
-	std::vector<std::vector<float>> getPowerForChannels();
+		void removeValue(const double* moments)
+		{
+			x.removeValue(moments[0]);
+			y.removeValue(moments[1]);
+			xx.removeValue(moments[2]);
+			yy.removeValue(moments[3]);
+			xy.removeValue(moments[4]);
+		}
+
+		void clear()
+		{
+			x.clear();
+			y.clear();
+			xx.clear();
+			yy.clear();
+			xy.clear();
+		}
+
+		// means of x, y, x^2, y^2 and xy
+		RealWeightedAccum x, y, xx, yy, xy;
+	};
+
+public:
+	// nChans channels are decomposed, and cross-spectra are kept for nPairs pairs of them,
+	// at each of freqs (Hz, ascending; any spacing). Each of extraAlphas gets its own exponentially
+	// averaged cross-spectra and power, fed from the same spectra as the main average.
+	CumulativeTFR(int nChans, int nPairs, const std::vector<double>& freqs, int nt, double Fs,
+		float winLen = 2, float stepLen = 0.1, double fftSec = 10.0, double alpha = 0, int windowSize = 0,
+		bool collapseTime = false, const std::vector<double>& extraAlphas = std::vector<double>());
+
+	// Memory needed by a TFR with these settings (dataBuffers and outputs are left at 0)
+	// nInputs is the number of decomposed channels if re-referencing (see setMontage), or 0
+	static TFRMemoryPlan planMemory(int nChans, int nPairs, int nf, int nt, double Fs, double fftSec,
+		int windowSize, bool collapseTime, int nInputs = 0, int nExtraAlphas = 0);
+
+	// Bytes taken by the sliding window history (0 if windowSize is 0),
+	// on top of what the TFR needs for cumulative/exponential averaging.
+	static int64 getWindowMemory(int nChans, int nPairs, int nf, int nt, int windowSize);
+
+	// Transform length for segments of fftSec at Fs: the segment, zero-padded to the next 2-3-5-7-smooth
+	// length. Buffers passed to addTrial must be this long; samples past the segment are zeroed there.
+	static int getFFTLength(double fftSec, double Fs);
+
+	// Smallest length >= n with no prime factors above 7, which FFTW transforms fastest
+	static int getSmoothLength(int n);
+
+	// Relative cost of a length-n FFT (n times the sum of its prime factors)
+	static double estimateFFTCost(int n);
+
+	// Handle a new buffer of data. Preform FFT and create the channel's spectra.
+	// chan is an input slot if a montage is set, otherwise a channel slot.
+	void addTrial(FFTWArrayType& fftBuffer, int chan);
+
+	// Call once all channels of a segment are added: applies the montage, accumulates power
+	// and adds the segment to the PAC statistics. inputValid (one per addTrial slot, empty for all
+	// valid) masks channels with artifacts: a channel is left out of every average for this
+	// segment if any input it's built from is masked, and so are its pairs in getMeanCoherence.
+	void finishTrial(const std::vector<bool>& inputValid = std::vector<bool>());
+
+	// Whether a channel slot contributed to the latest segment
+	bool isChannelValid(int chan) const;
+	bool allChannelsValid() const;
+
+	// Spectra of the latest segment (# channels x # freqs x # times), valid after finishTrial
+	const std::vector<std::vector<std::vector<std::complex<double>>>>& getSpectra() const;
+
+	// Phase-amplitude coupling fed from these channel slots (not owned, may be null). Their
+	// PAC spectra are computed alongside the others on PAC's own time grid, with short amplitude
+	// wavelets (see PhaseAmplitudeCoupling). Call after setMontage and p->reset.
+	void setPAC(PhaseAmplitudeCoupling* p, const std::vector<int>& slots);
+
+	// Bytes setPAC allocates for nPACChans channels built from nSlots addTrial slots, with the
+	// phase frequencies up to maxPhaseFreq
+	static int64 getPACMemory(int nSlots, int nPACChans, int nPhase, int nAmp, double maxPhaseFreq,
+		int nt, double Fs, float winLen, float stepLen, double fftSec);
+
+	// Re-reference outputs as sparse combinations of nInputs decomposed channels
+	// (# channels x (input slot, weight), see Montage), each minus the common average of
+	// averageTerms if given. Empty terms means no re-referencing.
+	void setMontage(int nInputs, const std::vector<Montage::Terms>& terms,
+		const Montage::Terms& averageTerms = Montage::Terms());
+
+	// Function to get coherence between two channels (slots passed to addTrial), for pair comb
+	// If a baseline is set, this also captures it or outputs z-scores, depending on its mode. Both
+	// use the coherence of the latest segment alone (pooled over its times of interest), not the average.
+	// If bandDest is given, it receives the band averages of meanDest (# bands, see setBands).
+	// If envelopeDest is given, it receives the correlation of the pair's amplitude envelopes at each frequency.
+	void getMeanCoherence(int chanX, int chanY, double* meanDest, int comb, double* bandDest = nullptr,
+		double* envelopeDest = nullptr);
+
+	// Phase-slope index and group delay of a pair in each band (# bands, see setBands), from the
+	// averaged cross-spectra of adjacent frequencies. Positive values mean chanX leads chanY;
+	// delayDest is in seconds. Call after getMeanCoherence has added the segment.
+	void getPhaseSlope(int chanX, int chanY, int comb, double* psiDest, double* delayDest);
+
+	// Coherence of a pair at each frequency from the accumulators of extra alpha k, without baseline
+	// or bands. Call after getMeanCoherence has added the segment.
+	void getExtraCoherence(int chanX, int chanY, int comb, int k, double* dest);
+	int getNumExtraAlphas() const;
+
+	// Baseline used by getMeanCoherence (not owned, may be null)
+	void setBaseline(CoherenceBaseline* b);
+
+	// Bands that coherence and power are reduced to, in addition to the per-frequency output
+	void setBands(const std::vector<FrequencyBand>& bands);
+	int getNumBands() const;
+
+	// Power of the latest segment for the channels in these slots, averaged over times of interest.
+	// dest[i] is the power of slots[i] at each frequency, bandDest[i] (if given) in each band.
+	// dest and bandDest must already be # slots x # freqs/bands.
+	void getPowerForChannels(const std::vector<int>& slots, std::vector<std::vector<float>>& dest,
+		std::vector<std::vector<float>>* bandDest = nullptr);
 
 
 private:
-	// Generate wavelet to multplied by the channel spectrum
-	void CumulativeTFR::generateWavelet();
+	// Generate the wavelets (Hann windows of windowSec) the channel spectrum is multiplied by
+	void generateWavelets(const vector<double>& waveletFreqs, float windowSec,
+		vector<vector<std::complex<double>>>& dest);
+
+	// Sample index in the segment of time of interest t
+	int getTimeIndex(int t) const;
+
+	// Builds dest[i] (# rows x # times) as channel chans[i] of the montage from the input spectra.
+	// The common average is summed once per row and time, and subtracted from every channel.
+	void applyMontage(const vector<vector<vector<std::complex<double>>>>& inputs, const vector<int>& chans,
+		vector<vector<vector<std::complex<double>>>>& dest);
+
+	// Whether every input in a channel's own terms is valid (all valid if inputValid is empty)
+	bool isMontageValid(int chan, const std::vector<bool>& inputValid) const;
 
 	const int nFreqs;
-	const int Fs;
+	const double Fs;
 	const int nTimes;
+	// samples in a segment, then zero-padding up to nfft
+	const int nSegmentSamples;
 	const int nfft;
 	int segmentLen;
 	float windowLen;
 	float stepLen;
 
-	float freqStep;
-	int freqStart;
-	int freqEnd;
+	// frequencies of interest (Hz)
+	const vector<double> freqs;
 
 	int trimTime;
 
 	// # channels x # frequencies x # times
 	vector<vector<vector<std::complex<double>>>> spectrumBuffer;
+	// # inputs x # frequencies x # times, only used with a montage
+	vector<vector<vector<std::complex<double>>>> inputSpectrumBuffer;
+	// # channels x (input slot, weight)
+	vector<Montage::Terms> montageTerms;
+	// (input slot, weight) of the common average, subtracted from every channel (empty if none)
+	Montage::Terms montageAverage;
+	// Common average of the inputs at one frequency, # times (or # PAC times)
+	vector<std::complex<double>> averageSpectrum;
+	// 0 to # channels - 1, the channels applyMontage builds for the main spectra
+	vector<int> montageChans;
+	// # channels, false if masked in the latest segment
+	vector<bool> channelValid;
 	vector<vector<std::complex<double>>> waveletArray;
 
 	FFTWArrayType ifftBuffer;
 
 	// For exponential average
 	double alpha;
-	// Store cross-spectra : # channel combinations x # frequencies x # times
+	// For sliding window average (# of segments, 0 if not used)
+	int windowSize;
+	// If true, accumulators hold the average over all times of interest (1 instead of nTimes each)
+	const bool collapseTime;
+	const int nAccumTimes;
+	// Store cross-spectra : # channel pairs x # frequencies x # times (or 1 if collapseTime)
 	vector<vector<vector<ComplexWeightedAccum>>> pxys;
-	// Store power : # channels x # frequencies x # times
+	// Store power : # channels x # frequencies x # times (or 1 if collapseTime)
 	vector<vector<vector<RealWeightedAccum>>> powBuffer;
+	// Store amplitude envelope moments : # channel pairs x # frequencies
+	vector<vector<EnvelopeAccum>> envelopes;
+
+	// Sliding window history, a ring of windowSize segments (all empty if windowSize is 0):
+	// the values each segment added to pxys, powBuffer and envelopes, and which pairs / channels
+	// it added them to. Flat, segment-major, in the same order as the accumulators.
+	static const int ENVELOPE_MOMENTS = 5;
+	vector<std::complex<double>> pxyHistory;
+	vector<double> powHistory;
+	vector<double> envelopeHistory;
+	vector<bool> pairHistoryValid;
+	vector<bool> chanHistoryValid;
+	// slot of the latest segment (-1 before the first), and # of segments in the window
+	int historyPos;
+	int nHistory;
+
+	// Coherence of the latest segment alone at each frequency, for the baseline
+	vector<double> segmentCoherence;
+
+	std::complex<double>* getPxyHistory(int slot, int comb);
+	double* getPowHistory(int slot, int chan);
+	double* getEnvelopeHistory(int slot, int comb);
+
+	// Moves to the next history slot, taking the segment that was there out of the accumulators.
+	// Every time the ring wraps the sums are rebuilt from the history instead, so that
+	// add/subtract rounding can't accumulate.
+	void advanceWindow();
+	void addHistory(int slot);
+	void removeHistory(int slot);
+
+	// Exponential averages kept alongside the one above
+	const vector<double> extraAlphas;
+	// # extra alphas x (same layout as pxys / powBuffer)
+	vector<vector<vector<vector<ComplexWeightedAccum>>>> extraPxys;
+	vector<vector<vector<vector<RealWeightedAccum>>>> extraPow;
+
+	CoherenceBaseline* baseline;
+
+	PhaseAmplitudeCoupling* pac;
+	vector<int> pacSlots;
+	// Sample index of each PAC time, between the first and last time of interest
+	vector<int> pacTimes;
+	// Amplitude wavelets, # amp freqs x nfft, and their window length
+	vector<vector<std::complex<double>>> pacWavelets;
+	float pacWindowLen;
+	// PAC spectra (phase freqs, then amp freqs) x # PAC times: of each addTrial slot a PAC channel
+	// uses (empty for the others), and of each PAC channel after the montage
+	vector<vector<vector<std::complex<double>>>> pacInputSpectra;
+	vector<vector<vector<std::complex<double>>>> pacSpectra;
+	vector<bool> pacValid;
+
+	// (band, weight) contributions of each frequency
+	vector<FrequencyBands::FreqWeights> bandWeights;
+	int nBands;
+
+	// complex coherency of a pair at one frequency, from accumulators averaged over times of interest
+	std::complex<double> getCoherency(int chanX, int chanY, int comb, int freq);
+
+	// mean over accumulated times of the coherence from these accumulators
+	double getAccumCoherence(const vector<RealWeightedAccum>& powX, const vector<RealWeightedAccum>& powY,
+		const vector<ComplexWeightedAccum>& pxy) const;
 
 	// calculate a single magnitude-squared coherence from cross spectrum and auto-power values
 	static double singleCoherence(double pxx, double pyy, std::complex<double> pxy);
@@ -0,0 +1,161 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "FrequencyBands.h"
+
+#include <cmath>
+
+const char* const FrequencyBands::TAPER_NAMES[] = { "flat", "hann", "triangle" };
+
+bool FrequencyBands::parse(const String& spec, std::vector<FrequencyBand>& bands)
+{
+	StringArray entries;
+	entries.addTokens(spec, ",;", "");
+	entries.trim();
+	entries.removeEmptyStrings();
+
+	std::vector<FrequencyBand> newBands;
+	for (const String& entry : entries)
+	{
+		// optional name, then "low-high", then an optional taper
+		FrequencyBand band;
+		band.taper = FrequencyBand::TAPER_FLAT;
+		String rest = entry;
+		String last = entry.fromLastOccurrenceOf(" ", false, false).trim();
+		for (int t = 0; t < NUM_TAPERS; t++)
+		{
+			if (rest.containsChar(' ') && last.equalsIgnoreCase(TAPER_NAMES[t]))
+			{
+				band.taper = FrequencyBand::Taper(t);
+				rest = entry.upToLastOccurrenceOf(" ", false, false).trim();
+			}
+		}
+
+		String range = rest.fromLastOccurrenceOf(" ", false, false).trim();
+		String name = rest.upToLastOccurrenceOf(" ", false, false).trim();
+
+		if (!range.containsChar('-') || !range.containsOnly("0123456789.-"))
+		{
+			return false;
+		}
+
+		band.low = range.upToFirstOccurrenceOf("-", false, false).getDoubleValue();
+		band.high = range.fromFirstOccurrenceOf("-", false, false).getDoubleValue();
+		band.name = name.isEmpty() ? range : name;
+
+		if (band.high <= band.low)
+		{
+			return false;
+		}
+
+		newBands.push_back(band);
+	}
+
+	bands.swap(newBands);
+	return true;
+}
+
+String FrequencyBands::toString(const std::vector<FrequencyBand>& bands)
+{
+	StringArray entries;
+	for (const FrequencyBand& band : bands)
+	{
+		String entry = band.name + " " + String(band.low) + "-" + String(band.high);
+		if (band.taper != FrequencyBand::TAPER_FLAT)
+		{
+			entry += String(" ") + TAPER_NAMES[band.taper];
+		}
+		entries.add(entry);
+	}
+	return entries.joinIntoString(", ");
+}
+
+std::vector<FrequencyBands::FreqWeights> FrequencyBands::getWeights(const std::vector<FrequencyBand>& bands,
+	const std::vector<double>& freqs)
+{
+	int nFreqs = int(freqs.size());
+	std::vector<FreqWeights> weights(nFreqs);
+
+	if (nFreqs == 0)
+	{
+		return weights;
+	}
+
+	// Bin edges halfway between neighbouring frequencies, mirrored at the ends
+	std::vector<double> edges(nFreqs + 1);
+	for (int f = 1; f < nFreqs; f++)
+	{
+		edges[f] = (freqs[f - 1] + freqs[f]) / 2;
+	}
+	double firstWidth = nFreqs > 1 ? freqs[1] - freqs[0] : 1;
+	double lastWidth = nFreqs > 1 ? freqs[nFreqs - 1] - freqs[nFreqs - 2] : 1;
+	edges[0] = freqs[0] - firstWidth / 2;
+	edges[nFreqs] = freqs[nFreqs - 1] + lastWidth / 2;
+
+	for (int b = 0; b < int(bands.size()); b++)
+	{
+		std::vector<double> overlap(nFreqs);
+		double total = 0;
+		for (int f = 0; f < nFreqs; f++)
+		{
+			const FrequencyBand& band = bands[b];
+			double lo = jmax(edges[f], band.low);
+			double hi = jmin(edges[f + 1], band.high);
+			if (hi > lo)
+			{
+				// the taper at the middle of the part of the bin in the band, never at an edge
+				double x = ((lo + hi) / 2 - band.low) / (band.high - band.low);
+				overlap[f] = (hi - lo) / (edges[f + 1] - edges[f]) * getTaperWeight(band.taper, x);
+			}
+			total += overlap[f];
+		}
+
+		if (total <= 0)
+		{
+			continue;
+		}
+
+		for (int f = 0; f < nFreqs; f++)
+		{
+			if (overlap[f] > 0)
+			{
+				weights[f].emplace_back(b, overlap[f] / total);
+			}
+		}
+	}
+
+	return weights;
+}
+
+double FrequencyBands::getTaperWeight(FrequencyBand::Taper taper, double x)
+{
+	switch (taper)
+	{
+	case FrequencyBand::TAPER_HANN:
+		return 0.5 - 0.5 * std::cos(2 * double_Pi * x);
+	case FrequencyBand::TAPER_TRIANGLE:
+		return 1 - std::abs(2 * x - 1);
+	default:
+		return 1;
+	}
+}
@@ -0,0 +1,86 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef FREQUENCY_BANDS_H_INCLUDED
+#define FREQUENCY_BANDS_H_INCLUDED
+
+/*
+
+Frequency Bands - user-defined bands (e.g. theta, beta, gamma) that per-frequency
+outputs are reduced to. Each band is a weighted average of the frequencies of interest,
+where a frequency's weight is the fraction of its bin (the span halfway to its neighbours)
+that lies inside the band, times the band's taper at the middle of that part of the bin,
+normalized so each band's weights sum to 1. The taper is flat unless the band asks for a
+Hann or triangular one, which weights the band's centre over its edges.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <vector>
+#include <utility>
+
+struct FrequencyBand
+{
+	// Weight across the band, on top of each frequency's share of it
+	enum Taper
+	{
+		TAPER_FLAT = 0,
+		TAPER_HANN,
+		TAPER_TRIANGLE
+	};
+
+	String name;
+	double low;
+	double high;
+	Taper taper;
+};
+
+class FrequencyBands
+{
+public:
+	// (band, weight) pairs that one frequency contributes to
+	using FreqWeights = std::vector<std::pair<int, double>>;
+
+	// Parse a list like "theta 4-8, beta 13-30 hann, 30-40 triangle". Names are optional, and
+	// so are tapers ("flat", "hann" or "triangle") after the range.
+	// Returns false (leaving bands untouched) if any entry can't be read.
+	static bool parse(const String& spec, std::vector<FrequencyBand>& bands);
+
+	// Inverse of parse
+	static String toString(const std::vector<FrequencyBand>& bands);
+
+	// Weights of each frequency (ascending, in Hz) for each band, indexed by frequency.
+	// Bands that contain no frequency get no weights.
+	static std::vector<FreqWeights> getWeights(const std::vector<FrequencyBand>& bands,
+		const std::vector<double>& freqs);
+
+private:
+	static const char* const TAPER_NAMES[];
+	static const int NUM_TAPERS = 3;
+
+	// Weight of the taper at x, the position across the band (0 to 1)
+	static double getTaperWeight(FrequencyBand::Taper taper, double x);
+};
+
+#endif // FREQUENCY_BANDS_H_INCLUDED
@@ -0,0 +1,192 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "Montage.h"
+
+Montage::Montage()
+	: commonAverage(false)
+{}
+
+bool Montage::parse(const String& spec)
+{
+	String trimmed = spec.trim();
+
+	if (trimmed.isEmpty())
+	{
+		commonAverage = false;
+		averageChannels.clear();
+		references.clear();
+		return true;
+	}
+
+	if (trimmed.startsWithIgnoreCase("CAR"))
+	{
+		Array<int> channels;
+		StringArray tokens;
+		tokens.addTokens(trimmed.fromFirstOccurrenceOf(":", false, false), " ,", "");
+		tokens.removeEmptyStrings();
+
+		for (const String& token : tokens)
+		{
+			// single channel or range "1-16"
+			String first = token.upToFirstOccurrenceOf("-", false, false);
+			String last = token.containsChar('-') ? token.fromFirstOccurrenceOf("-", false, false) : first;
+			if (!first.containsOnly("0123456789") || !last.containsOnly("0123456789")
+				|| first.getIntValue() < 1 || last.getIntValue() < first.getIntValue())
+			{
+				return false;
+			}
+			for (int chan = first.getIntValue() - 1; chan < last.getIntValue(); chan++)
+			{
+				channels.addIfNotAlreadyThere(chan);
+			}
+		}
+
+		commonAverage = true;
+		averageChannels = channels;
+		references.clear();
+		return true;
+	}
+
+	std::vector<std::pair<int, int>> newReferences;
+	StringArray tokens;
+	tokens.addTokens(trimmed, ",", "");
+	tokens.trim();
+	tokens.removeEmptyStrings();
+
+	for (const String& token : tokens)
+	{
+		String chan = token.upToFirstOccurrenceOf("-", false, false).trim();
+		String ref = token.fromFirstOccurrenceOf("-", false, false).trim();
+		if (!token.containsChar('-') || !chan.containsOnly("0123456789") || !ref.containsOnly("0123456789")
+			|| chan.getIntValue() < 1 || ref.getIntValue() < 1 || chan == ref)
+		{
+			return false;
+		}
+		newReferences.emplace_back(chan.getIntValue() - 1, ref.getIntValue() - 1);
+	}
+
+	commonAverage = false;
+	averageChannels.clear();
+	references.swap(newReferences);
+	return true;
+}
+
+void Montage::build(const Array<int>& outputChannels)
+{
+	inputChannels.clear();
+	terms.assign(outputChannels.size(), Terms());
+	averageTerms.clear();
+
+	// Outputs first, so without references input slot == output slot
+	for (int chan : outputChannels)
+	{
+		getOrAddInput(chan);
+	}
+
+	if (commonAverage)
+	{
+		const Array<int>& averaged = averageChannels.isEmpty() ? outputChannels : averageChannels;
+		for (int chan : averaged)
+		{
+			averageTerms.emplace_back(getOrAddInput(chan), 1.0 / averaged.size());
+		}
+	}
+
+	for (int out = 0; out < outputChannels.size(); out++)
+	{
+		int chan = outputChannels[out];
+		Terms& outTerms = terms[out];
+		outTerms.emplace_back(getInputSlot(chan), 1.0);
+
+		if (!commonAverage)
+		{
+			for (const auto& reference : references)
+			{
+				if (reference.first == chan)
+				{
+					outTerms.emplace_back(getOrAddInput(reference.second), -1.0);
+					break;
+				}
+			}
+		}
+	}
+}
+
+bool Montage::isIdentity() const
+{
+	if (!averageTerms.empty())
+	{
+		return false;
+	}
+
+	for (int out = 0; out < int(terms.size()); out++)
+	{
+		if (terms[out].size() != 1 || terms[out][0].first != out || terms[out][0].second != 1.0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+int Montage::getNumInputs() const
+{
+	return inputChannels.size();
+}
+
+int Montage::getNumOutputs() const
+{
+	return int(terms.size());
+}
+
+int Montage::getInputChannel(int slot) const
+{
+	return inputChannels[slot];
+}
+
+int Montage::getInputSlot(int chan) const
+{
+	return inputChannels.indexOf(chan);
+}
+
+const std::vector<Montage::Terms>& Montage::getTerms() const
+{
+	return terms;
+}
+
+const Montage::Terms& Montage::getAverageTerms() const
+{
+	return averageTerms;
+}
+
+int Montage::getOrAddInput(int chan)
+{
+	int slot = inputChannels.indexOf(chan);
+	if (slot == -1)
+	{
+		slot = inputChannels.size();
+		inputChannels.add(chan);
+	}
+	return slot;
+}
@@ -0,0 +1,98 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef MONTAGE_H_INCLUDED
+#define MONTAGE_H_INCLUDED
+
+/*
+
+Montage - re-referencing (bipolar or common average) applied to spectra instead of signals.
+Wavelet convolution is linear, so the spectrum of a re-referenced channel is the same
+combination of the channels' spectra. The TFR decomposes each input channel once and
+builds every output channel as a sparse weighted sum of input spectra, minus the common
+average if there is one. The average is kept apart from the terms so it's summed once for
+all outputs rather than once per output.
+
+Output channels are the channels the TFR reports on (in TFR slot order). Input channels are
+the output channels plus any reference channel not already among them, in that order, so
+without re-referencing inputs and outputs are the same.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <vector>
+#include <utility>
+
+class Montage
+{
+public:
+	// (input slot, weight) terms making up one output channel
+	using Terms = std::vector<std::pair<int, double>>;
+
+	Montage();
+
+	// Read a spec with 1-based channel numbers:
+	//   ""                no re-referencing
+	//   "CAR"             each channel minus the average of all output channels
+	//   "CAR: 1-16"       each channel minus the average of channels 1 to 16
+	//   "1-2, 3-4"        channel 1 minus channel 2, channel 3 minus channel 4 (others unchanged)
+	// Returns false, leaving the montage untouched, if the spec can't be read.
+	bool parse(const String& spec);
+
+	// Work out input channels and terms for these output channels
+	void build(const Array<int>& outputChannels);
+
+	// True if every output is just its own input
+	bool isIdentity() const;
+
+	int getNumInputs() const;
+	int getNumOutputs() const;
+	int getInputChannel(int slot) const;
+
+	// Input slot of a channel, or -1 if it isn't decomposed
+	int getInputSlot(int chan) const;
+
+	// # outputs, terms of each (not including the common average)
+	const std::vector<Terms>& getTerms() const;
+
+	// Terms of the common average every output has subtracted, empty without CAR
+	const Terms& getAverageTerms() const;
+
+private:
+	int getOrAddInput(int chan);
+
+	bool commonAverage;
+	// channels averaged for CAR, empty for all output channels
+	Array<int> averageChannels;
+	// (channel, reference channel) for bipolar derivations
+	std::vector<std::pair<int, int>> references;
+
+	Array<int> inputChannels;
+	std::vector<Terms> terms;
+	Terms averageTerms;
+
+	JUCE_LEAK_DETECTOR(Montage);
+};
+
+#endif // MONTAGE_H_INCLUDED
@@ -0,0 +1,225 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "PhaseAmplitudeCoupling.h"
+#include <cmath>
+
+PhaseAmplitudeCoupling::PhaseAmplitudeCoupling()
+	: nChans(0)
+	, phaseStart(0)
+	, nPhase(0)
+	, ampStart(0)
+	, nAmp(0)
+{}
+
+void PhaseAmplitudeCoupling::reset(int nc, int ps, int np, int as, int na)
+{
+	nChans = nc;
+	phaseStart = ps;
+	nPhase = np;
+	ampStart = as;
+	nAmp = na;
+
+	ampSums.assign(size_t(nChans) * nPhase * NUM_PHASE_BINS * nAmp, 0);
+	binCounts.assign(size_t(nChans) * nPhase * NUM_PHASE_BINS, 0);
+	vectorSums.assign(size_t(nChans) * nPhase * nAmp, 0);
+	totalAmps.assign(size_t(nChans) * nAmp, 0);
+}
+
+int PhaseAmplitudeCoupling::getNumChannels() const
+{
+	return nChans;
+}
+
+int PhaseAmplitudeCoupling::getPhaseStart() const
+{
+	return phaseStart;
+}
+
+int PhaseAmplitudeCoupling::getNumPhaseFreqs() const
+{
+	return nPhase;
+}
+
+int PhaseAmplitudeCoupling::getAmpStart() const
+{
+	return ampStart;
+}
+
+int PhaseAmplitudeCoupling::getNumAmpFreqs() const
+{
+	return nAmp;
+}
+
+double PhaseAmplitudeCoupling::getAmpWindowSeconds(double maxPhaseFreq, double maxSeconds)
+{
+	// a Hann window's -6 dB bandwidth is 2 / length, and has to cover 2 * maxPhaseFreq
+	return maxPhaseFreq > 0 ? jmin(maxSeconds, 1.0 / maxPhaseFreq) : maxSeconds;
+}
+
+int PhaseAmplitudeCoupling::getTimeStep(double maxPhaseFreq, double Fs)
+{
+	// a sample for every phase bin over a cycle, which also samples the envelope (bandwidth
+	// up to 2 * maxPhaseFreq) well above its Nyquist rate
+	return maxPhaseFreq > 0 ? jmax(1, int(Fs / (NUM_PHASE_BINS * maxPhaseFreq))) : 1;
+}
+
+void PhaseAmplitudeCoupling::addSegment(const std::vector<std::vector<std::vector<std::complex<double>>>>& spectra,
+	const std::vector<bool>& valid)
+{
+	if (nPhase == 0 || nAmp == 0)
+	{
+		return;
+	}
+
+	jassert(spectra.size() == nChans && valid.size() == nChans);
+
+	for (int chan = 0; chan < nChans; chan++)
+	{
+		if (!valid[chan])
+		{
+			continue;
+		}
+
+		const auto& chanSpectra = spectra[chan];
+		int nTimes = chanSpectra[0].size();
+
+		// Amplitudes, time-major so each time's amplitudes are contiguous
+		amps.resize(size_t(nTimes) * nAmp);
+		for (int a = 0; a < nAmp; a++)
+		{
+			const std::complex<double>* spect = chanSpectra[nPhase + a].data();
+			for (int t = 0; t < nTimes; t++)
+			{
+				amps[size_t(t) * nAmp + a] = std::abs(spect[t]);
+			}
+		}
+
+		// Phase bins and directions
+		phaseBins.resize(size_t(nPhase) * nTimes);
+		phaseDirs.resize(size_t(nPhase) * nTimes);
+		for (int p = 0; p < nPhase; p++)
+		{
+			const std::complex<double>* spect = chanSpectra[p].data();
+			for (int t = 0; t < nTimes; t++)
+			{
+				double phase = std::arg(spect[t]); // -pi to pi
+				int bin = int((phase + double_Pi) / (2 * double_Pi) * NUM_PHASE_BINS);
+				phaseBins[size_t(p) * nTimes + t] = jmin(bin, NUM_PHASE_BINS - 1);
+				phaseDirs[size_t(p) * nTimes + t] = std::polar(1.0, phase);
+			}
+		}
+
+		// Grid update, contiguous over amplitude frequencies
+		double* chanTotals = &totalAmps[size_t(chan) * nAmp];
+		for (int t = 0; t < nTimes; t++)
+		{
+			const double* amp = &amps[size_t(t) * nAmp];
+			for (int a = 0; a < nAmp; a++)
+			{
+				chanTotals[a] += amp[a];
+			}
+		}
+
+		for (int p = 0; p < nPhase; p++)
+		{
+			size_t cp = size_t(chan) * nPhase + p;
+			double* sums = &ampSums[cp * NUM_PHASE_BINS * nAmp];
+			double* counts = &binCounts[cp * NUM_PHASE_BINS];
+			std::complex<double>* vecs = &vectorSums[cp * nAmp];
+
+			for (int t = 0; t < nTimes; t++)
+			{
+				int bin = phaseBins[size_t(p) * nTimes + t];
+				std::complex<double> dir = phaseDirs[size_t(p) * nTimes + t];
+				const double* amp = &amps[size_t(t) * nAmp];
+				double* binSums = sums + size_t(bin) * nAmp;
+
+				counts[bin] += 1;
+				for (int a = 0; a < nAmp; a++)
+				{
+					binSums[a] += amp[a];
+					vecs[a] += amp[a] * dir;
+				}
+			}
+		}
+	}
+}
+
+void PhaseAmplitudeCoupling::getModulationIndex(int chan, double* dest) const
+{
+	const double logBins = std::log(double(NUM_PHASE_BINS));
+	double meanAmps[NUM_PHASE_BINS];
+
+	for (int p = 0; p < nPhase; p++)
+	{
+		size_t cp = size_t(chan) * nPhase + p;
+		const double* sums = &ampSums[cp * NUM_PHASE_BINS * nAmp];
+		const double* counts = &binCounts[cp * NUM_PHASE_BINS];
+
+		for (int a = 0; a < nAmp; a++)
+		{
+			// Normalized mean amplitude per phase bin, then KL distance from uniform
+			double total = 0;
+			for (int bin = 0; bin < NUM_PHASE_BINS; bin++)
+			{
+				meanAmps[bin] = counts[bin] > 0 ? sums[size_t(bin) * nAmp + a] / counts[bin] : 0;
+				total += meanAmps[bin];
+			}
+
+			double entropy = 0;
+			for (int bin = 0; bin < NUM_PHASE_BINS && total > 0; bin++)
+			{
+				double prob = meanAmps[bin] / total;
+				if (prob > 0)
+				{
+					entropy -= prob * std::log(prob);
+				}
+			}
+
+			dest[p * nAmp + a] = total > 0 ? (logBins - entropy) / logBins : 0;
+		}
+	}
+}
+
+void PhaseAmplitudeCoupling::getMeanVectorLength(int chan, double* dest) const
+{
+	for (int p = 0; p < nPhase; p++)
+	{
+		const std::complex<double>* vecs = &vectorSums[(size_t(chan) * nPhase + p) * nAmp];
+		const double* totals = &totalAmps[size_t(chan) * nAmp];
+		for (int a = 0; a < nAmp; a++)
+		{
+			dest[p * nAmp + a] = totals[a] > 0 ? std::abs(vecs[a]) / totals[a] : 0;
+		}
+	}
+}
+
+int64 PhaseAmplitudeCoupling::getMemory(int nChans, int nPhase, int nAmp)
+{
+	int64 nGrid = int64(nChans) * nPhase;
+	return nGrid * NUM_PHASE_BINS * nAmp * sizeof(double)
+		+ nGrid * NUM_PHASE_BINS * sizeof(double)
+		+ nGrid * nAmp * sizeof(std::complex<double>)
+		+ int64(nChans) * nAmp * sizeof(double);
+}
@@ -0,0 +1,113 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef PHASE_AMPLITUDE_COUPLING_H_INCLUDED
+#define PHASE_AMPLITUDE_COUPLING_H_INCLUDED
+
+/*
+
+Phase-Amplitude Coupling - streaming modulation index (Tort et al. 2010) and mean vector
+length between the phase of low frequencies and the amplitude of high frequencies, taken
+from complex wavelet spectra the TFR computes for it.
+
+The TFR's own spectra can't be used: its long wavelets give amplitude envelopes narrower than
+the phase frequencies, so the modulation is filtered out, and its times of interest are too far
+apart to follow the phase. So the amplitude comes from short wavelets, whose envelope bandwidth
+is at least twice the highest phase frequency (getAmpWindowSeconds), and both phase and
+amplitude are sampled on a dense grid with NUM_PHASE_BINS samples or more per cycle of the
+highest phase frequency (getTimeStep). Phase still uses the TFR's wavelets, at its frequencies.
+
+For each channel and phase frequency, each time falls into one of NUM_PHASE_BINS phase bins;
+the amplitude of every amplitude frequency at that time is added to that bin. Phase bins and
+amplitudes are found once per time, then the (phase freq x amp freq) grid is updated with
+contiguous loops over amplitude frequencies.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <vector>
+#include <complex>
+
+class PhaseAmplitudeCoupling
+{
+public:
+	static const int NUM_PHASE_BINS = 18;
+
+	PhaseAmplitudeCoupling();
+
+	// Clear all statistics and set the layout. Frequencies are TFR frequency indices:
+	// phase frequencies phaseStart to phaseStart + nPhase - 1, and likewise for amplitude.
+	void reset(int nChans, int phaseStart, int nPhase, int ampStart, int nAmp);
+
+	int getNumChannels() const;
+	int getPhaseStart() const;
+	int getNumPhaseFreqs() const;
+	int getAmpStart() const;
+	int getNumAmpFreqs() const;
+
+	// Length of the amplitude wavelets for phase frequencies up to maxPhaseFreq: a Hann window
+	// of this length passes f +/- maxPhaseFreq. At most maxSeconds.
+	static double getAmpWindowSeconds(double maxPhaseFreq, double maxSeconds);
+	// Samples at Fs between the times phase and amplitude are taken at
+	static int getTimeStep(double maxPhaseFreq, double Fs);
+
+	// Add one segment. spectra is # PAC channels x (# phase freqs, then # amp freqs) x # times
+	// (see above). Channels that are false in valid (masked for an artifact) are skipped.
+	void addSegment(const std::vector<std::vector<std::vector<std::complex<double>>>>& spectra,
+		const std::vector<bool>& valid);
+
+	// Modulation index of each (phase freq, amp freq) for a channel, phase-major (nPhase x nAmp)
+	void getModulationIndex(int chan, double* dest) const;
+
+	// Mean vector length, normalized by mean amplitude, same layout as getModulationIndex
+	void getMeanVectorLength(int chan, double* dest) const;
+
+	// Bytes reset would allocate for this layout
+	static int64 getMemory(int nChans, int nPhase, int nAmp);
+
+private:
+	int nChans;
+	int phaseStart;
+	int nPhase;
+	int ampStart;
+	int nAmp;
+
+	// # chans x # phase freqs x # bins x # amp freqs
+	std::vector<double> ampSums;
+	// # chans x # phase freqs x # bins
+	std::vector<double> binCounts;
+	// # chans x # phase freqs x # amp freqs, sum of amplitude * phase direction
+	std::vector<std::complex<double>> vectorSums;
+	// # chans x # amp freqs
+	std::vector<double> totalAmps;
+
+	// Per segment scratch: # amp freqs x # times, # phase freqs x # times
+	std::vector<double> amps;
+	std::vector<int> phaseBins;
+	std::vector<std::complex<double>> phaseDirs;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PhaseAmplitudeCoupling);
+};
+
+#endif // PHASE_AMPLITUDE_COUPLING_H_INCLUDED
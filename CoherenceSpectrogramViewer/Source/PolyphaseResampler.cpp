@@ -0,0 +1,245 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "PolyphaseResampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+PolyphaseResampler::PolyphaseResampler()
+	: inRate(0)
+	, up(1)
+	, down(1)
+	, maxBlock(0)
+	, tapsPerPhase(1)
+	, nextInput(0)
+	, nextPhase(0)
+	, nOutput(0)
+	, nNaNOutputs(0)
+{}
+
+void PolyphaseResampler::getRatio(double ratio, int maxUp, int& bestUp, int& bestDown)
+{
+	// Convergents h / k of the continued fraction of ratio, the last one with h <= maxUp
+	int64 h0 = 0, h1 = 1, k0 = 1, k1 = 0;
+	double x = ratio;
+	bestUp = 1;
+	bestDown = jmax(1, roundToInt(1 / ratio));
+
+	for (int i = 0; i < 32; i++)
+	{
+		int64 a = int64(std::floor(x));
+		int64 h2 = a * h1 + h0;
+		int64 k2 = a * k1 + k0;
+		if (h2 > maxUp || k2 > std::numeric_limits<int>::max())
+		{
+			break;
+		}
+		if (h2 > 0)
+		{
+			bestUp = int(h2);
+			bestDown = int(k2);
+		}
+
+		h0 = h1; h1 = h2;
+		k0 = k1; k1 = k2;
+		double fraction = x - double(a);
+		if (fraction < 1e-9)
+		{
+			break;
+		}
+		x = 1 / fraction;
+	}
+}
+
+void PolyphaseResampler::reset(double inputRate, double outRate, int maxBlockSize, const PolyphaseResampler* like)
+{
+	inRate = inputRate;
+	maxBlock = jmax(1, maxBlockSize);
+	getRatio(outRate / inputRate, MAX_UP, up, down);
+
+	// Sinc cutoff at the lower Nyquist rate (90% of it, leaving a transition band), in cycles
+	// per sample at the upsampled rate
+	int factor = jmax(up, down);
+	int length = 2 * ZERO_CROSSINGS * factor + 1;
+	tapsPerPhase = isIdentity() ? 1 : (length + up - 1) / up;
+
+	if (like != nullptr && like->up == up && like->down == down && like->phases != nullptr)
+	{
+		phases = like->phases;
+	}
+	else if (!isIdentity())
+	{
+		double cutoff = 0.45 / factor;
+		double centre = (length - 1) / 2.0;
+		std::vector<double> prototype(size_t(tapsPerPhase) * up, 0);
+		for (int i = 0; i < length; i++)
+		{
+			double t = i - centre;
+			double sinc = t == 0 ? 1 : std::sin(2 * double_Pi * cutoff * t) / (2 * double_Pi * cutoff * t);
+			double window = 0.42 - 0.5 * std::cos(2 * double_Pi * i / (length - 1))
+				+ 0.08 * std::cos(4 * double_Pi * i / (length - 1)); // Blackman
+			// gain of up, for the zeros upsampling inserts
+			prototype[i] = up * 2 * cutoff * sinc * window;
+		}
+
+		// Phase p holds taps p, p + up, p + 2 up, ..., reversed so they line up with the inputs
+		auto newPhases = std::make_shared<std::vector<float>>(size_t(tapsPerPhase) * up);
+		for (int p = 0; p < up; p++)
+		{
+			for (int j = 0; j < tapsPerPhase; j++)
+			{
+				(*newPhases)[size_t(p) * tapsPerPhase + (tapsPerPhase - 1 - j)] = float(prototype[size_t(p) + size_t(j) * up]);
+			}
+		}
+		phases = newPhases;
+	}
+	else
+	{
+		phases = nullptr;
+	}
+
+	history.assign(size_t(tapsPerPhase) - 1 + maxBlock, 0);
+	output.assign(size_t(maxBlock) * up / down + 2, 0);
+	clear();
+}
+
+void PolyphaseResampler::clear()
+{
+	std::fill(history.begin(), history.end(), 0.0f);
+	nOutput = 0;
+	nNaNOutputs = 0;
+
+	// Start one group delay in, so output k is centred on input time k * down / up
+	int length = 2 * ZERO_CROSSINGS * jmax(up, down) + 1;
+	int64 start = isIdentity() ? 0 : (length - 1) / 2;
+	nextInput = start / up;
+	nextPhase = int(start % up);
+}
+
+bool PolyphaseResampler::isIdentity() const
+{
+	return up == 1 && down == 1;
+}
+
+int PolyphaseResampler::getUp() const
+{
+	return up;
+}
+
+int PolyphaseResampler::getDown() const
+{
+	return down;
+}
+
+double PolyphaseResampler::getInputRate() const
+{
+	return inRate;
+}
+
+void PolyphaseResampler::process(const float* src, int n, bool artifact)
+{
+	int nBefore = nOutput;
+	for (int done = 0; done < n; done += maxBlock)
+	{
+		processChunk(src + done, jmin(maxBlock, n - done));
+	}
+
+	if (artifact)
+	{
+		// this block's outputs, and the later ones whose filter still reaches back into it
+		nNaNOutputs = jmax(nNaNOutputs, (nOutput - nBefore) + (tapsPerPhase * up + down - 1) / down);
+		// the block's own outputs are already queued
+		int nMark = jmin(nOutput - nBefore, nNaNOutputs);
+		std::fill(output.begin() + nBefore, output.begin() + nBefore + nMark, std::numeric_limits<float>::quiet_NaN());
+		nNaNOutputs -= nMark;
+	}
+}
+
+void PolyphaseResampler::processChunk(const float* src, int n)
+{
+	int nHistory = tapsPerPhase - 1;
+	float* hist = history.data();
+	std::copy(src, src + n, hist + nHistory);
+
+	float* out = output.data();
+	int capacity = int(output.size());
+	int nBefore = nOutput;
+
+	if (isIdentity())
+	{
+		int nCopy = jmin(n, capacity - nOutput);
+		jassert(nCopy == n); // taken too slowly
+		std::copy(src, src + nCopy, out + nOutput);
+		nOutput += nCopy;
+	}
+	else
+	{
+		const float* coeffs = phases->data();
+		while (nextInput < n && nOutput < capacity)
+		{
+			// inputs nextInput - tapsPerPhase + 1 to nextInput, contiguous in hist
+			const float* x = hist + nextInput;
+			const float* h = coeffs + size_t(nextPhase) * tapsPerPhase;
+			float sum = 0;
+			for (int j = 0; j < tapsPerPhase; j++)
+			{
+				sum += h[j] * x[j];
+			}
+			out[nOutput++] = sum;
+
+			nextPhase += down;
+			nextInput += nextPhase / up;
+			nextPhase %= up;
+		}
+		jassert(nextInput >= n); // taken too slowly
+		nextInput -= n;
+
+		// keep the newest inputs for the next chunk
+		std::copy(hist + n, hist + n + nHistory, hist);
+	}
+
+	// outputs still reaching back into an artifact
+	int nMark = jmin(nOutput - nBefore, nNaNOutputs);
+	std::fill(out + nBefore, out + nBefore + nMark, std::numeric_limits<float>::quiet_NaN());
+	nNaNOutputs -= nMark;
+}
+
+const float* PolyphaseResampler::getOutput() const
+{
+	return output.data();
+}
+
+int PolyphaseResampler::getNumOutput() const
+{
+	return nOutput;
+}
+
+void PolyphaseResampler::consume(int n)
+{
+	n = jmin(n, nOutput);
+	std::copy(output.begin() + n, output.begin() + nOutput, output.begin());
+	nOutput -= n;
+}
@@ -0,0 +1,109 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef POLYPHASE_RESAMPLER_H_INCLUDED
+#define POLYPHASE_RESAMPLER_H_INCLUDED
+
+/*
+
+Polyphase Resampler - streaming rational resampler, used at ingest to bring channels recorded
+at different rates to the TFR's analysis rate.
+
+The rate ratio is taken as the fraction up / down nearest to outRate / inRate with up at most
+MAX_UP. A windowed-sinc lowpass at the lower of the two Nyquist rates is split into up phases,
+so each output sample is a single contiguous dot product with the latest inputs, whatever the
+ratio. The filter's delay is compensated: output k is the signal at input time k * down / up,
+so channels at different rates stay in phase. The first outputs take correspondingly longer to
+come out.
+
+Outputs are queued until the caller takes them. The node writes each channel's outputs at its
+own position in the sample ring, so the delay before the first ones only holds back when that
+channel's samples are published.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <memory>
+#include <vector>
+
+class PolyphaseResampler
+{
+public:
+	static const int MAX_UP = 1024;
+	// Half-length of the filter in zero crossings of its sinc, each side
+	static const int ZERO_CROSSINGS = 8;
+
+	PolyphaseResampler();
+
+	// Resample from inRate to outRate, taking up to maxBlock inputs at a time, and clear.
+	// Reuses the filter of like (may be null) if it has the same ratio.
+	void reset(double inRate, double outRate, int maxBlock, const PolyphaseResampler* like = nullptr);
+	// Start again from no input, as after reset (e.g. after a break in the input)
+	void clear();
+
+	bool isIdentity() const;
+	int getUp() const;
+	int getDown() const;
+	double getInputRate() const;
+
+	// Filter a block and queue its outputs. If artifact is set, every output the block
+	// contributes to is NaN.
+	void process(const float* src, int n, bool artifact);
+
+	// Queued outputs, oldest first
+	const float* getOutput() const;
+	int getNumOutput() const;
+	// Drop the oldest n queued outputs
+	void consume(int n);
+
+	// Ratio up / down nearest to ratio with up <= maxUp (continued fractions)
+	static void getRatio(double ratio, int maxUp, int& up, int& down);
+
+private:
+	void processChunk(const float* src, int n);
+
+	double inRate;
+	int up;
+	int down;
+	int maxBlock;
+	// Taps of each phase, and the phases (up x tapsPerPhase, each reversed for the dot product)
+	int tapsPerPhase;
+	std::shared_ptr<const std::vector<float>> phases;
+
+	// Last tapsPerPhase - 1 inputs, then the current chunk
+	std::vector<float> history;
+	// Input (from the start of the next chunk) and phase of the next output
+	int64 nextInput;
+	int nextPhase;
+
+	std::vector<float> output;
+	int nOutput;
+	// Outputs still to be made NaN after an artifact
+	int nNaNOutputs;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PolyphaseResampler);
+};
+
+#endif // POLYPHASE_RESAMPLER_H_INCLUDED
@@ -0,0 +1,371 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "SampleIngest.h"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SAMPLE_INGEST_SSE2 1
+#include <emmintrin.h>
+#else
+#define SAMPLE_INGEST_SSE2 0
+#endif
+
+SampleIngest::SampleIngest(SampleRing& r, ArtifactDetectors& d)
+	: ring(r)
+	, detectors(d)
+	, Fs(0)
+	, alignStart(std::numeric_limits<double>::quiet_NaN())
+	, droppedSamples(0)
+	, eventFifo(MAX_PENDING_EVENTS)
+	, worstBlockSeconds(0)
+	, worstBlockDuration(0)
+{}
+
+void SampleIngest::reset(const std::vector<double>& slotRates, double analysisRate)
+{
+	Fs = analysisRate;
+
+	resamplers.clear();
+	for (double rate : slotRates)
+	{
+		// channels from the same source share a filter
+		const PolyphaseResampler* like = nullptr;
+		for (const PolyphaseResampler* other : resamplers)
+		{
+			if (other->getInputRate() == rate)
+			{
+				like = other;
+			}
+		}
+
+		// up to a second of input at a time, more than any block
+		PolyphaseResampler* resampler = resamplers.add(new PolyphaseResampler());
+		resampler->reset(rate, Fs, int(rate) + 1, like);
+	}
+
+	slotClocks.resize(resamplers.size());
+	lastSamples.resize(resamplers.size());
+	routeBlocks.resize(resamplers.size());
+	clear();
+}
+
+void SampleIngest::clear()
+{
+	for (PolyphaseResampler* resampler : resamplers)
+	{
+		resampler->clear();
+	}
+
+	// positions are set from the first block's timestamps
+	std::fill(slotClocks.begin(), slotClocks.end(), SlotClock());
+	std::fill(lastSamples.begin(), lastSamples.end(), std::numeric_limits<float>::quiet_NaN());
+	alignStart = std::numeric_limits<double>::quiet_NaN();
+	droppedSamples = 0;
+	eventFifo.reset();
+	worstBlockSeconds = 0;
+	worstBlockDuration = 0;
+}
+
+double SampleIngest::getSlotRate(int slot) const
+{
+	return resamplers[slot]->getInputRate();
+}
+
+int SampleIngest::getMaxAlignment() const
+{
+	return int(MAX_ALIGNMENT_SECONDS * Fs);
+}
+
+int SampleIngest::process(const std::vector<Route>& routes, const ChannelBlock* channels, int nChannels,
+	const BlockEvent* events, int nEvents)
+{
+	auto blockStart = std::chrono::steady_clock::now();
+
+	// the block of each routed channel
+	int nBlocks = 0;
+	for (const Route& route : routes)
+	{
+		if (nBlocks < int(routeBlocks.size()) && route.chan < nChannels)
+		{
+			const ChannelBlock& channel = channels[route.chan];
+			routeBlocks[nBlocks++] = { route.slot, channel.samples, channel.n, channel.timestamp };
+		}
+	}
+
+	// Events in this block, placed by their timestamps once ring sample 0 is known
+	if (align(routeBlocks.data(), nBlocks))
+	{
+		for (int i = 0; i < nEvents; i++)
+		{
+			queueEvent(events[i]);
+		}
+	}
+
+	int nSamples = appendBlock(routeBlocks.data(), nBlocks);
+
+	float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - blockStart).count();
+	if (nSamples > 0 && seconds > worstBlockSeconds)
+	{
+		worstBlockSeconds = seconds;
+		worstBlockDuration = float(nSamples / Fs);
+	}
+	return nSamples;
+}
+
+void SampleIngest::queueEvent(const BlockEvent& event)
+{
+	int start1, size1, start2, size2;
+	eventFifo.prepareToWrite(1, start1, size1, start2, size2);
+	if (size1 == 0 || event.size > int(sizeof(PendingEvent::data)) || event.size > int(sizeof(BlockEvent::data)))
+	{
+		return;
+	}
+
+	PendingEvent& pending = pendingEvents[start1];
+	pending.channel = event.channel;
+	pending.size = event.size;
+	std::memcpy(pending.data, event.data, event.size);
+	// the event's timestamp is in its own source's samples, which may be at another rate
+	pending.position = std::llround(getRingPosition(event.timestamp, event.rate > 0 ? event.rate : Fs));
+	eventFifo.finishedWrite(1);
+
+	// so the coherence thread knows which samples to wait for
+	wakeReader();
+}
+
+bool SampleIngest::popEvent(PendingEvent& dest)
+{
+	int start1, size1, start2, size2;
+	eventFifo.prepareToRead(1, start1, size1, start2, size2);
+	if (size1 == 0)
+	{
+		return false;
+	}
+	dest = pendingEvents[start1];
+	eventFifo.finishedRead(1);
+	return true;
+}
+
+float SampleIngest::getWorstBlockSeconds() const
+{
+	return worstBlockSeconds;
+}
+
+float SampleIngest::getWorstBlockDuration() const
+{
+	return worstBlockDuration;
+}
+
+bool SampleIngest::align(const Block* blocks, int nBlocks)
+{
+	if (nBlocks > 0 && std::isnan(alignStart))
+	{
+		// Ring sample 0 is the earliest first sample among the sources
+		for (int i = 0; i < nBlocks; i++)
+		{
+			double start = blocks[i].timestamp / getSlotRate(blocks[i].slot);
+			alignStart = std::isnan(alignStart) ? start : jmin(alignStart, start);
+		}
+	}
+	return !std::isnan(alignStart);
+}
+
+int SampleIngest::appendBlock(const Block* blocks, int nBlocks)
+{
+	if (nBlocks == 0)
+	{
+		return 0;
+	}
+
+	// Sources can send blocks of different lengths: the time they cover at the analysis rate is
+	// that of the longest
+	int nSamples = 0;
+	for (int i = 0; i < nBlocks; i++)
+	{
+		nSamples = jmax(nSamples, int(std::llround(blocks[i].n * Fs / getSlotRate(blocks[i].slot))));
+	}
+
+	// The coherence thread still needs the oldest samples. Drop the block on every channel rather
+	// than wait, and take its time out of the positions of the blocks after it. The same time comes
+	// out of every source, so they stay lined up; one whose block was shorter skips the overlap.
+	for (int i = 0; i < nBlocks; i++)
+	{
+		// the block, after any samples its source is missing (appendSlot fills at most getMaxAlignment)
+		const Block& block = blocks[i];
+		double rate = getSlotRate(block.slot);
+		double start = getRingPosition(block.timestamp, rate) + slotClocks[block.slot].offset;
+		int64 missing = jlimit(int64(0), int64(getMaxAlignment()), int64(std::ceil(start)) - ring.getSlotIndex(block.slot));
+		if (!ring.hasSpace(block.slot, missing + int64(std::ceil(block.n * Fs / rate)) + 1))
+		{
+			ring.markGap();
+			droppedSamples += nSamples;
+			return nSamples;
+		}
+	}
+
+	// Append the block to the ring of each routed channel. A block with an artifact goes in as NaN,
+	// which masks the channel in every window it's part of; the other channels carry on.
+	for (int i = 0; i < nBlocks; i++)
+	{
+		const Block& block = blocks[i];
+		if (block.n == 0)
+		{
+			continue;
+		}
+
+		// continuity with the next block, whatever happens to this one
+		float previous = lastSamples[block.slot];
+		lastSamples[block.slot] = block.samples[block.n - 1];
+
+		// checked on the channel's own samples, before any resampling
+		bool artifact = detectors.isArtifact(block.slot, ArtifactDetectors::scan(block.samples, block.n, previous));
+		appendSlot(block.slot, block.samples, block.n, block.timestamp, artifact);
+	}
+
+	// Publish only what every channel has: a source whose block hasn't come yet, or whose
+	// resampler is still filling, holds the others back until it covers the same samples
+	int64 newWriteIndex = std::numeric_limits<int64>::max();
+	for (int i = 0; i < nBlocks; i++)
+	{
+		newWriteIndex = jmin(newWriteIndex, ring.getSlotIndex(blocks[i].slot));
+	}
+	if (newWriteIndex > ring.getWriteIndex() && ring.commit(newWriteIndex))
+	{
+		// the coherence thread is waiting for these samples, at most once per window
+		wakeReader();
+	}
+	return nSamples;
+}
+
+void SampleIngest::appendSlot(int slot, const float* src, int n, int64 timestamp, bool artifact)
+{
+	PolyphaseResampler* resampler = resamplers[slot];
+	SlotClock& clock = slotClocks[slot];
+	double rate = resampler->getInputRate();
+	double position = getRingPosition(timestamp, rate) + clock.offset;
+	int64 index = ring.getSlotIndex(slot);
+
+	// Where the slot's samples have got to by its own count. Away from the timestamps by more than
+	// a sample means a break in the source's samples, or the resampler's ratio drifting.
+	double expected = clock.origin + clock.nInputs * double(resampler->getUp()) / resampler->getDown();
+	int skip = 0;
+	if (!clock.started || std::abs(position - expected) > 1)
+	{
+		if (std::abs(position - index) > getMaxAlignment())
+		{
+			// a clock unrelated to the others, or a jump the ring couldn't hold: carry on from here
+			clock.offset += index - position;
+			position = double(index);
+		}
+
+		// samples already written (timestamps went back), then samples the source is missing
+		if (position < index)
+		{
+			skip = jmin(n, int(std::ceil((index - position) * rate / Fs)));
+			position += skip * Fs / rate;
+		}
+		clock.origin = jmax(index, int64(std::llround(position)));
+		ring.fill(slot, std::numeric_limits<float>::quiet_NaN(), clock.origin - index);
+		clock.nInputs = 0;
+		clock.started = true;
+		resampler->clear();
+	}
+	clock.nInputs += n - skip;
+
+	if (resampler->isIdentity())
+	{
+		if (artifact)
+		{
+			ring.fill(slot, std::numeric_limits<float>::quiet_NaN(), n - skip);
+		}
+		else
+		{
+			ring.write(slot, src + skip, n - skip);
+		}
+		return;
+	}
+
+	// the resampler turns the outputs an artifact reaches into NaN. Output k of it is ring
+	// sample origin + k, the delay before the first only holds back publishing.
+	resampler->process(src + skip, n - skip, artifact);
+	ring.write(slot, resampler->getOutput(), resampler->getNumOutput());
+	resampler->consume(resampler->getNumOutput());
+}
+
+double SampleIngest::getRingPosition(int64 timestamp, double rate) const
+{
+	// minus the time of any dropped blocks, which aren't in the ring
+	return (timestamp / rate - alignStart) * Fs - droppedSamples;
+}
+
+void SampleIngest::wakeReader()
+{
+	wake.signal();
+}
+
+void SampleIngest::waitForSamples(int64 wakeIndex, int timeoutMs)
+{
+	ring.setWakeIndex(wakeIndex);
+
+	// the producer may have got there before it saw the wake index
+	if (ring.getWriteIndex() < wakeIndex)
+	{
+		wake.wait(timeoutMs);
+	}
+}
+
+int64 SampleIngest::getDroppedSamples() const
+{
+	return droppedSamples;
+}
+
+bool SampleIngest::copyToDouble(double* dest, const float* src, int n)
+{
+	int i = 0;
+	bool hasNaN = false;
+
+#if SAMPLE_INGEST_SSE2
+	__m128 unordered = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 in = _mm_loadu_ps(src + i);
+		unordered = _mm_or_ps(unordered, _mm_cmpunord_ps(in, in));
+		_mm_storeu_pd(dest + i, _mm_cvtps_pd(in));
+		_mm_storeu_pd(dest + i + 2, _mm_cvtps_pd(_mm_movehl_ps(in, in)));
+	}
+	hasNaN = _mm_movemask_ps(unordered) != 0;
+#endif
+
+	for (; i < n; i++)
+	{
+		dest[i] = src[i];
+		hasNaN |= src[i] != src[i];
+	}
+
+	return !hasNaN;
+}
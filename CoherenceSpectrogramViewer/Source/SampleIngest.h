@@ -0,0 +1,225 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef SAMPLE_INGEST_H_INCLUDED
+#define SAMPLE_INGEST_H_INCLUDED
+
+/*
+
+Sample Ingest - moves raw samples from process() into the sample ring, and out of it into the
+TFR's transform buffers.
+
+On the audio thread, process() does all of CoherenceNode::process's work: each routed channel's
+block is checked for artifacts as a whole (see
+ArtifactDetectors), brought to the analysis rate and written into the ring at the position its
+source's timestamp gives, so channels from different processors or boards line up in time
+whatever their block timing. A window is only published once every source covers it, and the
+commit that reaches the coherence thread's wake index wakes it. TTL events are placed in the
+ring by their timestamps and queued for the coherence thread. This path is real-time safe:
+everything it uses is allocated by reset, and waking the reader is a semaphore post (see
+WakeSignal), not a lock.
+
+On the coherence thread, a window is copied out in bulk, converting float to double with
+SIMD; artifacts were marked in the ring with NaN, so its mask comes out of the same pass.
+
+*/
+
+#include <BasicJuceHeader.h>
+#include "SampleRing.h"
+#include "PolyphaseResampler.h"
+#include "ArtifactDetectors.h"
+#include "WakeSignal.h"
+
+#include <atomic>
+#include <vector>
+
+class EventChannel;
+
+class SampleIngest
+{
+public:
+	// Data buffer slot of an input channel the TFR decomposes
+	struct Route
+	{
+		int chan;
+		int slot;
+	};
+
+	// One input channel's samples in the current process() block
+	struct ChannelBlock
+	{
+		const float* samples;
+		int n;
+		// of the first sample, in the source's samples
+		int64 timestamp;
+	};
+
+	// One routed channel's samples in the current process() block
+	struct Block
+	{
+		int slot;
+		const float* samples;
+		int n;
+		int64 timestamp;
+	};
+
+	// A TTL event in the current process() block, as handleEvent gets it (its bytes are copied:
+	// the message doesn't outlast handleEvent)
+	struct BlockEvent
+	{
+		const EventChannel* channel;
+		// in the samples of its own source, at rate
+		int64 timestamp;
+		double rate;
+		int size;
+		uint8 data[64];
+	};
+
+	// An event waiting for the coherence thread to decode it (deserializing allocates, so the
+	// audio thread only copies its bytes)
+	struct PendingEvent
+	{
+		const EventChannel* channel;
+		// ring sample number of the event, from its timestamp
+		int64 position;
+		int size;
+		uint8 data[64];
+	};
+	// Events past this many undecoded ones are dropped
+	static const int MAX_PENDING_EVENTS = 256;
+
+	// Furthest a source's timestamps are followed across a break or ahead of the other sources;
+	// beyond that the source carries on where its samples are up to. The ring needs room for it.
+	static const int MAX_ALIGNMENT_SECONDS = 1;
+
+	SampleIngest(SampleRing& ring, ArtifactDetectors& detectors);
+
+	// Build a resampler from each slot's rate to analysisRate, and clear.
+	// Only while the audio thread isn't ingesting.
+	void reset(const std::vector<double>& slotRates, double analysisRate);
+	// Start again from no samples (ring sample 0 is set by the next align), as at the start of
+	// acquisition. Only while the audio thread isn't ingesting.
+	void clear();
+
+	double getSlotRate(int slot) const;
+
+	// ---- Audio thread: no allocation, locks or system calls other than waking the reader ----
+
+	// One process() block: the block of each routed channel (channels holds nChannels input
+	// channels) goes into the ring, and the block's events into the event queue. Returns the
+	// samples appended at the analysis rate (see appendBlock). The call's time is kept for
+	// getWorstBlockSeconds.
+	int process(const std::vector<Route>& routes, const ChannelBlock* channels, int nChannels,
+		const BlockEvent* events, int nEvents);
+
+	// Ring position of a sample with this timestamp at this rate, before any slot offset.
+	// Only after align.
+	double getRingPosition(int64 timestamp, double rate) const;
+
+	// Wake the coherence thread if it's in waitForSamples (or make its next wait return)
+	void wakeReader();
+
+	// ---- Coherence thread ----
+
+	// Sleep until the write index reaches wakeIndex, wakeReader is called or timeoutMs passes
+	void waitForSamples(int64 wakeIndex, int timeoutMs);
+
+	// Take the oldest queued event. Returns false if there is none.
+	bool popEvent(PendingEvent& dest);
+
+	// ---- Any thread ----
+
+	// Longest process() call since clear, and how long the data in that block lasts
+	float getWorstBlockSeconds() const;
+	float getWorstBlockDuration() const;
+
+	// Time dropped because the coherence thread still needed the whole ring, since clear,
+	// in samples at the analysis rate
+	int64 getDroppedSamples() const;
+
+	// dest[i] = src[i] for i < n. Returns false if any sample is NaN (an artifact mark).
+	static bool copyToDouble(double* dest, const float* src, int n);
+
+private:
+	// Set ring sample 0 to the earliest first sample among the sources, on the first blocks.
+	// Returns false if it isn't set yet.
+	bool align(const Block* blocks, int nBlocks);
+
+	// Append the blocks of each routed slot to the ring, returning the length of the longest at
+	// the analysis rate (0 if there was nothing to add). If the coherence thread still needs the
+	// samples a block would overwrite, the blocks are dropped on every slot.
+	int appendBlock(const Block* blocks, int nBlocks);
+
+	// Put a slot's block into the ring at its timestamp position, or queue it through the resampler.
+	// First fills samples the source is missing with NaN or skips ones it has already written.
+	void appendSlot(int slot, const float* src, int n, int64 timestamp, bool artifact);
+
+	int getMaxAlignment() const;
+
+	// Place an event in the ring by its timestamp and queue it. Only after align.
+	void queueEvent(const BlockEvent& event);
+
+	SampleRing& ring;
+	ArtifactDetectors& detectors;
+	WakeSignal wake;
+
+	double Fs;
+
+	// One per slot, bringing its channel to Fs (unused for channels already at Fs)
+	OwnedArray<PolyphaseResampler> resamplers;
+
+	// Where each slot has got to against its timestamps
+	struct SlotClock
+	{
+		// false until the slot's first block
+		bool started;
+		// ring index the slot's resampler was (re)started at, and inputs it has had since
+		int64 origin;
+		int64 nInputs;
+		// added to the positions of a source whose timestamps couldn't be lined up with the others
+		double offset;
+	};
+	std::vector<SlotClock> slotClocks;
+
+	// Last sample of each slot (NaN before the first block), so artifact checks carry across blocks
+	std::vector<float> lastSamples;
+
+	// Source time (seconds of timestamps) of ring sample 0, NaN before the first block
+	double alignStart;
+
+	std::atomic<int64> droppedSamples;
+
+	// The current block of each route (sized for every slot)
+	std::vector<Block> routeBlocks;
+
+	AbstractFifo eventFifo;
+	PendingEvent pendingEvents[MAX_PENDING_EVENTS];
+
+	std::atomic<float> worstBlockSeconds;
+	std::atomic<float> worstBlockDuration;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SampleIngest);
+};
+
+#endif // SAMPLE_INGEST_H_INCLUDED
@@ -0,0 +1,154 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "SampleRing.h"
+
+#include <algorithm>
+
+SampleRing::SampleRing()
+	: capacity(0)
+	, mask(0)
+	, writeIndex(0)
+	, readIndex(0)
+	, wakeIndex(NO_WAKE)
+	, gapIndex(-1)
+{}
+
+void SampleRing::reset(int nSlots, int minCapacity)
+{
+	capacity = jmax(1, nextPowerOfTwo(jmax(1, minCapacity)));
+	mask = capacity - 1;
+	slots.assign(nSlots, std::vector<float>(capacity));
+	slotIndices.assign(nSlots, 0);
+	clear();
+}
+
+void SampleRing::clear()
+{
+	writeIndex = 0;
+	readIndex = 0;
+	wakeIndex = NO_WAKE;
+	gapIndex = -1;
+	std::fill(slotIndices.begin(), slotIndices.end(), 0);
+}
+
+int SampleRing::getNumSlots() const
+{
+	return int(slots.size());
+}
+
+int SampleRing::getCapacity() const
+{
+	return capacity;
+}
+
+int64 SampleRing::getSlotIndex(int slot) const
+{
+	return slotIndices[slot];
+}
+
+bool SampleRing::hasSpace(int slot, int64 n) const
+{
+	return slotIndices[slot] + n - readIndex.load(std::memory_order_acquire) <= capacity;
+}
+
+void SampleRing::write(int slot, const float* src, int n)
+{
+	float* dest = slots[slot].data();
+	int start = int(slotIndices[slot] & mask);
+	int numFirst = jmin(n, capacity - start);
+	std::copy(src, src + numFirst, dest + start);
+	std::copy(src + numFirst, src + n, dest);
+	slotIndices[slot] += n;
+}
+
+void SampleRing::fill(int slot, float value, int64 n)
+{
+	jassert(n <= capacity);
+	float* dest = slots[slot].data();
+	int start = int(slotIndices[slot] & mask);
+	int numFirst = int(jmin(n, int64(capacity - start)));
+	std::fill(dest + start, dest + start + numFirst, value);
+	std::fill(dest, dest + (n - numFirst), value);
+	slotIndices[slot] += n;
+}
+
+bool SampleRing::commit(int64 newIndex)
+{
+	jassert(newIndex >= writeIndex.load(std::memory_order_relaxed));
+	// sequentially consistent with setWakeIndex and the consumer's check after it,
+	// so either this sees the new wake index or the consumer sees these samples
+	writeIndex.store(newIndex);
+	// take the wake index, so it's reported once (unless the consumer just moved it)
+	int64 wake = wakeIndex.load();
+	return wake <= newIndex && wakeIndex.compare_exchange_strong(wake, NO_WAKE);
+}
+
+void SampleRing::markGap()
+{
+	gapIndex.store(writeIndex.load(std::memory_order_relaxed), std::memory_order_release);
+}
+
+int64 SampleRing::getWriteIndex() const
+{
+	return writeIndex.load();
+}
+
+int64 SampleRing::getOldestIndex() const
+{
+	return jmax(int64(0), getWriteIndex() - capacity);
+}
+
+int64 SampleRing::getLastGap() const
+{
+	return gapIndex.load(std::memory_order_acquire);
+}
+
+void SampleRing::getSpans(int slot, int64 start, int n, const float*& first, int& numFirst,
+	const float*& second, int& numSecond) const
+{
+	jassert(start >= getOldestIndex() && start + n <= getWriteIndex());
+
+	const float* data = slots[slot].data();
+	int offset = int(start & mask);
+	first = data + offset;
+	numFirst = jmin(n, capacity - offset);
+	second = data;
+	numSecond = n - numFirst;
+}
+
+void SampleRing::setReadIndex(int64 index)
+{
+	readIndex.store(index, std::memory_order_release);
+}
+
+int64 SampleRing::getReadIndex() const
+{
+	return readIndex.load(std::memory_order_relaxed);
+}
+
+void SampleRing::setWakeIndex(int64 index)
+{
+	wakeIndex.store(index);
+}
@@ -0,0 +1,126 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef SAMPLE_RING_H_INCLUDED
+#define SAMPLE_RING_H_INCLUDED
+
+/*
+
+Sample Ring - lock-free single-producer, single-consumer ring of raw samples for each data
+buffer slot. The audio thread appends every block, the coherence thread reads windows of any
+length and hop straight out of it, so the raw data is held once instead of as whole segments
+passed between threads.
+
+Each slot is written at its own position, so channels whose samples arrive at different times
+(other sources, resampler delays) are lined up by where they're written rather than when. The
+producer publishes one write index, up to which every slot it uses has samples, and the
+consumer keeps one read index (oldest sample it still needs), each on its own cache line.
+Capacity is a power of two, so a position is an index & mask, and a window is at most two
+contiguous spans.
+
+Samples are numbered from the last clear(). A block the producer couldn't fit is dropped and
+its position recorded as a gap, so windows that would run across it can be skipped.
+
+The consumer can sleep instead of polling: it sets a wake index, and the commit that reaches
+it reports so once, for the producer to wake the consumer.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <atomic>
+#include <limits>
+#include <vector>
+
+class SampleRing
+{
+public:
+	SampleRing();
+
+	// Size for nSlots slots of at least minCapacity samples each, and clear.
+	// Only while neither thread is using the ring.
+	void reset(int nSlots, int minCapacity);
+	// Forget all samples, numbering restarts at 0. Only while neither thread is using the ring.
+	void clear();
+
+	int getNumSlots() const;
+	int getCapacity() const;
+
+	// ---- Producer (audio thread) ----
+
+	// Index of the next sample written to a slot
+	int64 getSlotIndex(int slot) const;
+	// True if n more samples fit on a slot without overwriting any the consumer still needs
+	bool hasSpace(int slot, int64 n) const;
+	// Stage n samples at the slot's index, or fill them with a value, moving it on by n
+	void write(int slot, const float* src, int n);
+	void fill(int slot, float value, int64 n);
+	// Publish the samples before newIndex, which every slot the consumer reads must have staged.
+	// Returns true (once per setWakeIndex) if the write index has reached the consumer's wake index.
+	bool commit(int64 newIndex);
+	// Record that samples were dropped at the current write index
+	void markGap();
+
+	// ---- Consumer (coherence thread) ----
+
+	// Number of samples published so far (the index after the newest)
+	int64 getWriteIndex() const;
+	// Oldest sample still in the ring
+	int64 getOldestIndex() const;
+	// Write index at the latest gap, or -1 if there hasn't been one
+	int64 getLastGap() const;
+	// Spans covering samples start to start + n - 1 of a slot. They must still be in the ring.
+	void getSpans(int slot, int64 start, int n, const float*& first, int& numFirst,
+		const float*& second, int& numSecond) const;
+	// Let the producer overwrite everything before this sample
+	void setReadIndex(int64 index);
+	int64 getReadIndex() const;
+	// Have commit report when the write index reaches this sample. Check getWriteIndex again
+	// before sleeping: a commit in between may not have seen it.
+	void setWakeIndex(int64 index);
+
+private:
+	static const int CACHE_LINE = 64;
+
+	int capacity;
+	int mask;
+	std::vector<std::vector<float>> slots;
+	// producer only
+	std::vector<int64> slotIndices;
+
+	// Indices on their own cache lines, so the threads don't invalidate each other's
+	char padBefore[CACHE_LINE];
+	std::atomic<int64> writeIndex;
+	char padWrite[CACHE_LINE - sizeof(std::atomic<int64>)];
+	std::atomic<int64> readIndex;
+	std::atomic<int64> wakeIndex;
+	char padRead[CACHE_LINE - 2 * sizeof(std::atomic<int64>)];
+	std::atomic<int64> gapIndex;
+
+	static const int64 NO_WAKE = std::numeric_limits<int64>::max();
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SampleRing);
+};
+
+#endif // SAMPLE_RING_H_INCLUDED
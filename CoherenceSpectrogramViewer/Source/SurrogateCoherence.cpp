@@ -0,0 +1,326 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "SurrogateCoherence.h"
+#include <algorithm>
+#include <cmath>
+
+const double SurrogateCoherence::THRESHOLD_PERCENTILE = 95.0;
+
+SurrogateCoherence::SurrogateCoherence()
+	: nChans(0)
+	, nFreqs(0)
+	, nTimes(0)
+	, nHistory(0)
+	, nSurrogates(0)
+	, method(CIRCULAR_SHIFT)
+	, nThreads(1)
+	, alpha(0)
+	, windowSize(0)
+	, collapseTime(false)
+	, nComputed(0)
+{}
+
+SurrogateCoherence::~SurrogateCoherence()
+{
+	stop();
+}
+
+void SurrogateCoherence::reset(const std::vector<std::pair<int, int>>& newSlotPairs, int nc, int nf, int nt,
+	int nh, int ns, Method m, float cpuPercent, double a, int ws, bool collapse)
+{
+	stop();
+
+	slotPairs = newSlotPairs;
+	nChans = nc;
+	nFreqs = nf;
+	nTimes = nt;
+	// older segments than the TFR's window have no weight
+	nHistory = ws > 0 ? jmin(nh, ws) : nh;
+	nSurrogates = ns;
+	method = m;
+	alpha = a;
+	windowSize = ws;
+	collapseTime = collapse;
+	nThreads = jmax(1, roundToInt(SystemStats::getNumCpus() * cpuPercent / 100.0f));
+
+	history.clear();
+	nullValues.assign(slotPairs.size() * nFreqs, CircularArray<double>(nSurrogates));
+	thresholds.assign(slotPairs.size() * nFreqs, 0);
+	nComputed = 0;
+
+	// A surrogate needs at least two segments to move the second channel against the first
+	if (!slotPairs.empty() && nSurrogates > 0 && nHistory >= 2)
+	{
+		pool = new ThreadPool(nThreads);
+	}
+}
+
+void SurrogateCoherence::stop()
+{
+	if (pool)
+	{
+		pool->removeAllJobs(true, 5000);
+		pool = nullptr;
+	}
+}
+
+bool SurrogateCoherence::isActive() const
+{
+	return pool != nullptr;
+}
+
+void SurrogateCoherence::addSegment(const std::vector<std::vector<std::vector<std::complex<double>>>>& spectra)
+{
+	if (!isActive())
+	{
+		return;
+	}
+
+	std::shared_ptr<Segment> segment = std::make_shared<Segment>(size_t(nChans) * nFreqs * nTimes);
+	std::complex<double>* dest = segment->data();
+	for (int chan = 0; chan < nChans; chan++)
+	{
+		for (int freq = 0; freq < nFreqs; freq++)
+		{
+			dest = std::copy(spectra[chan][freq].begin(), spectra[chan][freq].begin() + nTimes, dest);
+		}
+	}
+
+	{
+		const ScopedLock historyScopedLock(historyLock);
+		history.push_back(segment);
+		if (int(history.size()) > nHistory)
+		{
+			history.pop_front();
+		}
+	}
+
+	// Don't queue more than the workers can take, so jobs always use a recent history
+	if (pool->getNumJobs() < nThreads)
+	{
+		pool->addJob(new SurrogateJob(*this), true);
+	}
+}
+
+void SurrogateCoherence::getThresholds(int pair, double* dest)
+{
+	const ScopedLock resultScopedLock(resultLock);
+	std::copy(thresholds.begin() + size_t(pair) * nFreqs, thresholds.begin() + size_t(pair + 1) * nFreqs, dest);
+}
+
+int SurrogateCoherence::getNumSurrogates() const
+{
+	return nComputed;
+}
+
+int64 SurrogateCoherence::getMemory(int nPairs, int nChans, int nFreqs, int nTimes, int nHistory, int nSurrogates)
+{
+	int64 nValues = int64(nPairs) * nFreqs;
+	// history plus the segment being added, surrogate values and one batch per job
+	return int64(nHistory + 1) * nChans * nFreqs * nTimes * sizeof(std::complex<double>)
+		+ nValues * (sizeof(CircularArray<double>) + nSurrogates * sizeof(double) + sizeof(double))
+		+ nValues * BATCH_SIZE * sizeof(double);
+}
+
+void SurrogateCoherence::computeBatch(const History& segments, Random& random, std::vector<double>& dest,
+	ThreadPoolJob& job)
+{
+	int nSegments = segments.size();
+	int nSamples = nSegments * nTimes;
+	dest.clear();
+
+	// Weight of each segment in the TFR's averages; the newest segment is last
+	std::vector<double> weights(nSegments, 1.0);
+	if (windowSize == 0 && alpha > 0)
+	{
+		for (int s = nSegments - 2; s >= 0; s--)
+		{
+			weights[s] = weights[s + 1] * (1 - alpha);
+		}
+	}
+
+	// Auto-power of the first channels, averaged over segments at each time of interest
+	int nAccumTimes = collapseTime ? 1 : nTimes;
+	std::vector<double> power(size_t(nChans) * nFreqs * nAccumTimes);
+	for (int s = 0; s < nSegments; s++)
+	{
+		for (size_t chanFreq = 0; chanFreq < size_t(nChans) * nFreqs; chanFreq++)
+		{
+			const std::complex<double>* spect = segments[s]->data() + chanFreq * nTimes;
+			double* pow = power.data() + chanFreq * nAccumTimes;
+			for (int t = 0; t < nTimes; t++)
+			{
+				pow[collapseTime ? 0 : t] += weights[s] * std::norm(spect[t]);
+			}
+		}
+	}
+
+	// Segment and time of the second channel matched with each sample of the first
+	std::vector<int> ySegment(nSamples);
+	std::vector<int> yTime(nSamples);
+	std::vector<int> order(nSegments);
+
+	std::vector<std::complex<double>> crss(nAccumTimes);
+	std::vector<double> powY(nAccumTimes);
+
+	for (int surrogate = 0; surrogate < BATCH_SIZE && !job.shouldExit(); surrogate++)
+	{
+		if (method == CIRCULAR_SHIFT)
+		{
+			// shift by at least one segment either way
+			int offset = nTimes + random.nextInt(nSamples - 2 * nTimes + 1);
+			for (int i = 0; i < nSamples; i++)
+			{
+				int j = (i + offset) % nSamples;
+				ySegment[i] = j / nTimes;
+				yTime[i] = j % nTimes;
+			}
+		}
+		else
+		{
+			// Random derangement: a segment paired with itself would add real coherence,
+			// so shuffle again until none is (about e tries on average)
+			bool deranged;
+			do
+			{
+				for (int s = 0; s < nSegments; s++)
+				{
+					order[s] = s;
+				}
+				for (int s = nSegments - 1; s > 0; s--)
+				{
+					std::swap(order[s], order[random.nextInt(s + 1)]);
+				}
+
+				deranged = true;
+				for (int s = 0; s < nSegments && deranged; s++)
+				{
+					deranged = order[s] != s;
+				}
+			} while (!deranged);
+
+			for (int i = 0; i < nSamples; i++)
+			{
+				ySegment[i] = order[i / nTimes];
+				yTime[i] = i % nTimes;
+			}
+		}
+
+		for (const auto& slotPair : slotPairs)
+		{
+			for (int freq = 0; freq < nFreqs; freq++)
+			{
+				size_t xOffset = (size_t(slotPair.first) * nFreqs + freq) * nTimes;
+				size_t yOffset = (size_t(slotPair.second) * nFreqs + freq) * nTimes;
+
+				// the second channel's power is over the samples it's matched with
+				std::fill(crss.begin(), crss.end(), std::complex<double>());
+				std::fill(powY.begin(), powY.end(), 0.0);
+				for (int i = 0; i < nSamples; i++)
+				{
+					int s = i / nTimes;
+					int t = collapseTime ? 0 : i % nTimes;
+					std::complex<double> x = (*segments[s])[xOffset + i % nTimes];
+					std::complex<double> y = (*segments[ySegment[i]])[yOffset + yTime[i]];
+					crss[t] += weights[s] * x * std::conj(y);
+					powY[t] += weights[s] * std::norm(y);
+				}
+
+				const double* powX = power.data() + (size_t(slotPair.first) * nFreqs + freq) * nAccumTimes;
+				double coh = 0;
+				for (int t = 0; t < nAccumTimes; t++)
+				{
+					double norm = powX[t] * powY[t];
+					coh += norm > 0 ? std::norm(crss[t]) / norm : 0;
+				}
+				dest.push_back(coh / nAccumTimes);
+			}
+		}
+	}
+}
+
+void SurrogateCoherence::publish(const std::vector<double>& batch)
+{
+	size_t nValues = nullValues.size();
+	if (nValues == 0 || batch.size() < nValues)
+	{
+		return;
+	}
+
+	const ScopedLock resultScopedLock(resultLock);
+
+	int nNew = batch.size() / nValues;
+	for (int surrogate = 0; surrogate < nNew; surrogate++)
+	{
+		for (size_t i = 0; i < nValues; i++)
+		{
+			nullValues[i].enqueue(batch[surrogate * nValues + i]);
+		}
+	}
+	nComputed = jmin(nComputed + nNew, nSurrogates);
+
+	// newest nComputed values are at the end of each ring
+	int count = nComputed;
+	int rank = jlimit(0, count - 1, int(std::ceil(THRESHOLD_PERCENTILE / 100.0 * count)) - 1);
+	std::vector<double> values(count);
+	for (size_t i = 0; i < nValues; i++)
+	{
+		for (int v = 0; v < count; v++)
+		{
+			values[v] = nullValues[i][nSurrogates - count + v];
+		}
+		std::nth_element(values.begin(), values.begin() + rank, values.end());
+		thresholds[i] = values[rank];
+	}
+}
+
+// > SurrogateJob
+
+SurrogateCoherence::SurrogateJob::SurrogateJob(SurrogateCoherence& o)
+	: ThreadPoolJob("Coherence surrogates")
+	, owner(o)
+{}
+
+ThreadPoolJob::JobStatus SurrogateCoherence::SurrogateJob::runJob()
+{
+	// Snapshot: segments are never changed once stored, so sharing them is enough
+	History segments;
+	{
+		const ScopedLock historyScopedLock(owner.historyLock);
+		segments.assign(owner.history.begin(), owner.history.end());
+	}
+
+	if (segments.size() < 2)
+	{
+		return jobHasFinished;
+	}
+
+	std::vector<double> batch;
+	owner.computeBatch(segments, random, batch, *this);
+	if (!shouldExit())
+	{
+		owner.publish(batch);
+	}
+	return jobHasFinished;
+}
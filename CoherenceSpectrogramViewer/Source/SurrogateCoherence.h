@@ -0,0 +1,146 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SURROGATE_COHERENCE_H_INCLUDED
+#define SURROGATE_COHERENCE_H_INCLUDED
+
+/*
+
+Surrogate Coherence - null distribution of coherence, for significance thresholds at each
+pair and frequency, built in the background from the spectra the TFR already computed.
+
+The spectra of the last nHistory segments are kept. Each surrogate uses the estimator the TFR
+plots: at each time of interest, cross- and auto-spectra are averaged over segments (weighted
+like the TFR's accumulators), coherence is |Sxy|^2 / (Sxx * Syy), and the result is the mean
+over times (or the averages are taken over times first, if the TFR collapses time). A surrogate
+breaks the timing between the two channels of each pair, either by circularly shifting the
+second channel by at least one segment or by pairing every segment of the first channel with
+a different segment of the second. Worker jobs on a thread pool
+compute batches of surrogates from a snapshot of the history, and the threshold of each pair
+and frequency is updated after every batch from the last nSurrogates values.
+
+*/
+
+#include <BasicJuceHeader.h>
+#include "CircularArray.h"
+
+#include <vector>
+#include <complex>
+#include <deque>
+#include <memory>
+#include <atomic>
+
+class SurrogateCoherence
+{
+public:
+	enum Method
+	{
+		CIRCULAR_SHIFT = 0, // shift the second channel by a random number of times of interest
+		TRIAL_SHUFFLE       // pair each segment of the first channel with another of the second (a derangement)
+	};
+
+	// Percentile of the null distribution used as the threshold
+	static const double THRESHOLD_PERCENTILE;
+
+	// Surrogates computed per job before results are published
+	static const int BATCH_SIZE = 10;
+
+	SurrogateCoherence();
+	~SurrogateCoherence();
+
+	// Stop the workers and clear all history and surrogates. slotPairs are TFR channel slots,
+	// all of them below nChans; those nChans slots are stored for each segment.
+	// cpuPercent of the machine's cores (at least one) run surrogate jobs.
+	// alpha, windowSize and collapseTime are the TFR's, so segments are weighted and times
+	// averaged the same way; a cumulative TFR (both 0) weights the whole history equally.
+	void reset(const std::vector<std::pair<int, int>>& slotPairs, int nChans, int nFreqs, int nTimes,
+		int nHistory, int nSurrogates, Method method, float cpuPercent,
+		double alpha = 0, int windowSize = 0, bool collapseTime = false);
+
+	// Stop the workers (reset starts them again)
+	void stop();
+
+	bool isActive() const;
+
+	// Store the latest segment (# TFR channels x # freqs x # times) and queue a batch of
+	// surrogates if a worker is free
+	void addSegment(const std::vector<std::vector<std::vector<std::complex<double>>>>& spectra);
+
+	// Threshold at each frequency for a pair, 0 until a batch of surrogates is done
+	void getThresholds(int pair, double* dest);
+
+	// Number of surrogates the thresholds are based on (up to nSurrogates)
+	int getNumSurrogates() const;
+
+	// Bytes reset would allocate for this layout
+	static int64 getMemory(int nPairs, int nChans, int nFreqs, int nTimes, int nHistory, int nSurrogates);
+
+private:
+	// Spectra of the stored channels for one segment: (chan * nFreqs + freq) * nTimes + time
+	using Segment = std::vector<std::complex<double>>;
+	using History = std::vector<std::shared_ptr<const Segment>>;
+
+	class SurrogateJob : public ThreadPoolJob
+	{
+	public:
+		SurrogateJob(SurrogateCoherence& owner);
+		JobStatus runJob() override;
+
+	private:
+		SurrogateCoherence& owner;
+		Random random;
+	};
+
+	// Compute a batch from a history snapshot into dest (# surrogates x # pairs x # freqs)
+	void computeBatch(const History& history, Random& random, std::vector<double>& dest, ThreadPoolJob& job);
+
+	// Add a batch of surrogate values and update thresholds
+	void publish(const std::vector<double>& batch);
+
+	std::vector<std::pair<int, int>> slotPairs;
+	int nChans;
+	int nFreqs;
+	int nTimes;
+	int nHistory;
+	int nSurrogates;
+	Method method;
+	int nThreads;
+	double alpha;
+	int windowSize;
+	bool collapseTime;
+
+	std::deque<std::shared_ptr<const Segment>> history;
+	CriticalSection historyLock;
+
+	// Last nSurrogates values for each pair and frequency: # pairs x # freqs
+	std::vector<CircularArray<double>> nullValues;
+	std::vector<double> thresholds;
+	std::atomic<int> nComputed;
+	CriticalSection resultLock;
+
+	ScopedPointer<ThreadPool> pool;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SurrogateCoherence);
+};
+
+#endif // SURROGATE_COHERENCE_H_INCLUDED
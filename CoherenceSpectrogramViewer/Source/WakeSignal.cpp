@@ -0,0 +1,116 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "WakeSignal.h"
+
+#if JUCE_WINDOWS
+#include <windows.h>
+#elif JUCE_MAC
+#include <dispatch/dispatch.h>
+#else
+#include <semaphore.h>
+#include <time.h>
+#include <cerrno>
+#endif
+
+#if JUCE_WINDOWS
+
+struct WakeSignal::Semaphore
+{
+	Semaphore() : handle(CreateSemaphoreW(nullptr, 0, MAXLONG, nullptr)) {}
+	~Semaphore() { CloseHandle(handle); }
+
+	HANDLE handle;
+};
+
+void WakeSignal::signal()
+{
+	ReleaseSemaphore(semaphore->handle, 1, nullptr);
+}
+
+bool WakeSignal::wait(int timeoutMs)
+{
+	return WaitForSingleObject(semaphore->handle, DWORD(jmax(0, timeoutMs))) == WAIT_OBJECT_0;
+}
+
+#elif JUCE_MAC
+
+struct WakeSignal::Semaphore
+{
+	Semaphore() : handle(dispatch_semaphore_create(0)) {}
+	~Semaphore() { dispatch_release(handle); }
+
+	dispatch_semaphore_t handle;
+};
+
+void WakeSignal::signal()
+{
+	dispatch_semaphore_signal(semaphore->handle);
+}
+
+bool WakeSignal::wait(int timeoutMs)
+{
+	dispatch_time_t timeout = dispatch_time(DISPATCH_TIME_NOW, int64(jmax(0, timeoutMs)) * NSEC_PER_MSEC);
+	return dispatch_semaphore_wait(semaphore->handle, timeout) == 0;
+}
+
+#else
+
+struct WakeSignal::Semaphore
+{
+	Semaphore() { sem_init(&handle, 0, 0); }
+	~Semaphore() { sem_destroy(&handle); }
+
+	sem_t handle;
+};
+
+void WakeSignal::signal()
+{
+	sem_post(&semaphore->handle);
+}
+
+bool WakeSignal::wait(int timeoutMs)
+{
+	// sem_timedwait takes an absolute time on the realtime clock
+	timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	int64 nanoseconds = deadline.tv_nsec + int64(jmax(0, timeoutMs)) * 1000000;
+	deadline.tv_sec += time_t(nanoseconds / 1000000000);
+	deadline.tv_nsec = long(nanoseconds % 1000000000);
+
+	int result;
+	do
+	{
+		result = sem_timedwait(&semaphore->handle, &deadline);
+	} while (result != 0 && errno == EINTR);
+	return result == 0;
+}
+
+#endif
+
+WakeSignal::WakeSignal()
+	: semaphore(new Semaphore())
+{}
+
+WakeSignal::~WakeSignal()
+{}
@@ -0,0 +1,62 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef WAKE_SIGNAL_H_INCLUDED
+#define WAKE_SIGNAL_H_INCLUDED
+
+/*
+
+Wake Signal - counting semaphore the audio thread can signal without allocating or taking a
+lock, unlike Thread::notify (a WaitableEvent behind a mutex). Uses the system semaphore
+directly: sem_t on Linux, dispatch_semaphore on macOS, a semaphore handle on Windows.
+
+Each signal wakes one wait, or the next one if nothing is waiting, so a signal sent just
+before the waiter sleeps isn't lost. Waits can also return early on an old signal, so the
+waiter checks again whatever it was waiting for.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <memory>
+
+class WakeSignal
+{
+public:
+	WakeSignal();
+	~WakeSignal();
+
+	// Real-time safe
+	void signal();
+
+	// Block until a signal (returns true) or timeoutMs passes (returns false)
+	bool wait(int timeoutMs);
+
+private:
+	struct Semaphore;
+	std::unique_ptr<Semaphore> semaphore;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(WakeSignal);
+};
+
+#endif // WAKE_SIGNAL_H_INCLUDED
@@ -0,0 +1,374 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+/*
+
+CumulativeTFR tests: wavelet gain on padded and unpadded transform lengths, at frequencies
+off the FFT bins, phase-amplitude coupling at a phase frequency above the time resolution
+of the TFR's own spectra, the sliding window average, baseline z-scores of white noise, common
+average referencing and the weights of tapered frequency bands.
+
+*/
+
+#include "TestUtils.h"
+#include "CumulativeTFR.h"
+#include "CoherenceBaseline.h"
+#include "Montage.h"
+#include "PhaseAmplitudeCoupling.h"
+
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace
+{
+	const float WINDOW_LEN = 2;
+	const float STEP_LEN = 0.5f;
+
+	// Magnitude the TFR gives a unit cosine at a wavelet's own frequency, over what the Hann
+	// window predicts (1/2 of the window sum, about nWindow / 2, times the sqrt(2 / nWindow)
+	// scaling). The smallest ratio over the times of interest.
+	double getCentreGain(double Fs, double segSec, double freq)
+	{
+		std::vector<double> freqs = { freq };
+		int nTimes = int((segSec - WINDOW_LEN) / STEP_LEN) + 1;
+		CumulativeTFR tfr(1, 0, freqs, nTimes, Fs, WINDOW_LEN, STEP_LEN, segSec);
+
+		FFTWArrayType buffer(CumulativeTFR::getFFTLength(segSec, Fs));
+		int nSamples = int(segSec * Fs);
+		for (int i = 0; i < nSamples; i++)
+		{
+			buffer.set(i, std::cos(2 * double_Pi * freq * i / Fs));
+		}
+		tfr.addTrial(buffer, 0);
+		tfr.finishTrial();
+
+		double nWindow = Fs * WINDOW_LEN;
+		double expected = 0.25 * nWindow * std::sqrt(2 / nWindow);
+		double minGain = std::numeric_limits<double>::max();
+		for (const std::complex<double>& value : tfr.getSpectra()[0][0])
+		{
+			minGain = jmin(minGain, std::abs(value) / expected);
+		}
+		return minGain;
+	}
+
+	// Padded transform: 4 s at 2034.5 Hz is 8138 samples, transformed at 8192, so no
+	// frequency has a whole number of cycles in nfft
+	void testPaddedGain()
+	{
+		double Fs = 2034.5;
+		check(CumulativeTFR::getFFTLength(4, Fs) != int(4 * Fs), "4 s at 2034.5 Hz is zero-padded");
+
+		for (double freq : { 8.25, 20.0, 41.0 })
+		{
+			checkNear(getCentreGain(Fs, 4, freq), 1, 0.03, "wavelet gain at its centre frequency, padded nfft");
+		}
+	}
+
+	// Unpadded transform (3 s at 1000 Hz is 3000 samples) at frequencies that don't fit a whole
+	// number of cycles in the segment: a log grid point and an explicit 12.5 Hz
+	void testOffGridGain()
+	{
+		double Fs = 1000;
+		check(CumulativeTFR::getFFTLength(3, Fs) == int(3 * Fs), "3 s at 1000 Hz isn't padded");
+
+		double logFreq = 4 * std::pow(2.0, 3 / 8.0); // 3rd step of a log grid from 4 Hz, 8 per octave
+		checkNear(getCentreGain(Fs, 3, logFreq), 1, 0.03, "wavelet gain at a log grid frequency");
+		checkNear(getCentreGain(Fs, 3, 12.5), 1, 0.03, "wavelet gain at a listed 12.5 Hz");
+	}
+
+	// Mean vector length between 6 Hz phase and 35 Hz amplitude, for a 35 Hz carrier whose
+	// amplitude follows the 6 Hz phase with this modulation depth
+	double getCouplingMVL(double depth)
+	{
+		double Fs = 500;
+		double segSec = 4;
+		std::vector<double> freqs = { 4, 5, 6, 7, 8, 30, 35, 40 };
+		int nTimes = int((segSec - WINDOW_LEN) / STEP_LEN) + 1;
+		CumulativeTFR tfr(1, 0, freqs, nTimes, Fs, WINDOW_LEN, STEP_LEN, segSec);
+
+		PhaseAmplitudeCoupling pac;
+		pac.reset(1, 0, 5, 5, 3);
+		tfr.setPAC(&pac, { 0 });
+
+		FFTWArrayType buffer(CumulativeTFR::getFFTLength(segSec, Fs));
+		int nSamples = int(segSec * Fs);
+		for (int segment = 0; segment < 3; segment++)
+		{
+			for (int i = 0; i < nSamples; i++)
+			{
+				double phase = 2 * double_Pi * 6 * (segment * segSec + i / Fs);
+				double amplitude = 0.5 * (1 + depth * std::cos(phase));
+				buffer.set(i, std::cos(phase) + amplitude * std::cos(2 * double_Pi * 35 * i / Fs));
+			}
+			tfr.addTrial(buffer, 0);
+			tfr.finishTrial();
+		}
+
+		std::vector<double> mvl(5 * 3);
+		pac.getMeanVectorLength(0, mvl.data());
+		return mvl[2 * 3 + 1];
+	}
+
+	// The TFR's own spectra (2 s wavelets every 0.1 s) can't see 6 Hz amplitude modulation:
+	// the envelope is filtered to under 1 Hz and the phase is sampled below its Nyquist rate
+	void testPACResolvesCoupling()
+	{
+		double coupled = getCouplingMVL(0.8);
+		double uncoupled = getCouplingMVL(0);
+		check(coupled > 0.2, "PAC finds 6 Hz phase modulating 35 Hz amplitude");
+		check(uncoupled < 0.05, "PAC finds no coupling in an unmodulated carrier");
+	}
+
+	// Adds segment k of a fixed sequence of partly coherent noise on two channels; channel 1
+	// is masked in every 4th segment
+	void addNoiseSegment(CumulativeTFR& tfr, int k, double Fs, double segSec)
+	{
+		std::mt19937 rng(k + 1);
+		std::normal_distribution<double> noise;
+		FFTWArrayType shared(CumulativeTFR::getFFTLength(segSec, Fs));
+		FFTWArrayType own(shared.getLength());
+		int nSamples = int(segSec * Fs);
+		for (int i = 0; i < nSamples; i++)
+		{
+			double common = noise(rng);
+			shared.set(i, common + noise(rng));
+			own.set(i, common + (k % 3 + 1) * noise(rng));
+		}
+		tfr.addTrial(shared, 0);
+		tfr.addTrial(own, 1);
+		tfr.finishTrial({ true, k % 4 != 3 });
+	}
+
+	// A window of 3 segments after 11 (so past two wraps and a masked segment) against a
+	// cumulative average of just the last 3
+	void testSlidingWindow()
+	{
+		double Fs = 200;
+		double segSec = 3;
+		const int WINDOW = 3;
+		const int N_SEGMENTS = 11;
+		std::vector<double> freqs = { 5, 10, 20 };
+		int nTimes = int((segSec - WINDOW_LEN) / STEP_LEN) + 1;
+
+		CumulativeTFR windowed(2, 1, freqs, nTimes, Fs, WINDOW_LEN, STEP_LEN, segSec, 0, WINDOW);
+		CumulativeTFR recent(2, 1, freqs, nTimes, Fs, WINDOW_LEN, STEP_LEN, segSec);
+		std::vector<double> windowCoh(freqs.size());
+		std::vector<double> recentCoh(freqs.size());
+		std::vector<double> windowEnvelope(freqs.size());
+		std::vector<double> recentEnvelope(freqs.size());
+		for (int k = 0; k < N_SEGMENTS; k++)
+		{
+			addNoiseSegment(windowed, k, Fs, segSec);
+			windowed.getMeanCoherence(0, 1, windowCoh.data(), 0, nullptr, windowEnvelope.data());
+			if (k >= N_SEGMENTS - WINDOW)
+			{
+				addNoiseSegment(recent, k, Fs, segSec);
+				recent.getMeanCoherence(0, 1, recentCoh.data(), 0, nullptr, recentEnvelope.data());
+			}
+		}
+
+		for (size_t f = 0; f < freqs.size(); f++)
+		{
+			checkNear(windowCoh[f], recentCoh[f], 1e-9, "windowed coherence is the mean of the last segments");
+			checkNear(windowEnvelope[f], recentEnvelope[f], 1e-9, "windowed envelope correlation is of the last segments");
+		}
+	}
+
+	// Independent white noise on two channels: once a baseline is captured from it, more of the
+	// same noise should z-score with mean 0 and variance 1
+	void testBaselineZScores()
+	{
+		double Fs = 200;
+		double segSec = 3;
+		const int N_SEGMENTS = 300;
+		std::vector<double> freqs = { 5, 10, 20, 40 };
+		int nTimes = int((segSec - WINDOW_LEN) / STEP_LEN) + 1;
+
+		CumulativeTFR tfr(2, 1, freqs, nTimes, Fs, WINDOW_LEN, STEP_LEN, segSec);
+		CoherenceBaseline baseline;
+		tfr.setBaseline(&baseline);
+
+		std::mt19937 rng(7);
+		std::normal_distribution<double> noise;
+		FFTWArrayType bufferX(CumulativeTFR::getFFTLength(segSec, Fs));
+		FFTWArrayType bufferY(bufferX.getLength());
+		std::vector<double> dest(freqs.size());
+		StatisticsAccumulator<double> zScores;
+
+		for (CoherenceBaseline::Mode mode : { CoherenceBaseline::CAPTURE, CoherenceBaseline::ZSCORE })
+		{
+			baseline.requestMode(mode);
+			baseline.applyRequestedMode({ { 0, 4 } }, freqs);
+			for (int k = 0; k < N_SEGMENTS; k++)
+			{
+				for (int i = 0; i < int(segSec * Fs); i++)
+				{
+					bufferX.set(i, noise(rng));
+					bufferY.set(i, noise(rng));
+				}
+				tfr.addTrial(bufferX, 0);
+				tfr.addTrial(bufferY, 1);
+				tfr.finishTrial();
+				tfr.getMeanCoherence(0, 1, dest.data(), 0);
+
+				if (mode == CoherenceBaseline::ZSCORE)
+				{
+					for (double z : dest)
+					{
+						zScores.addValue(z);
+					}
+				}
+			}
+		}
+
+		checkNear(zScores.getAverage(), 0, 0.15, "white noise z-scores have mean 0");
+		checkNear(zScores.getVariance(), 1, 0.25, "white noise z-scores have variance 1");
+
+		// Same number of pairs, different channels
+		check(!baseline.matches({ { 2, 6 } }, freqs), "baseline doesn't match other channel pairs");
+	}
+
+	// CAR spectra against each channel's own spectrum minus the mean of all of them,
+	// and a masked input masking every channel through the average
+	void testCommonAverage()
+	{
+		double Fs = 200;
+		double segSec = 3;
+		const int N_CHANS = 4;
+		std::vector<double> freqs = { 5, 10, 20 };
+		int nTimes = int((segSec - WINDOW_LEN) / STEP_LEN) + 1;
+
+		Montage montage;
+		montage.parse("CAR");
+		montage.build({ 0, 1, 2, 3 });
+		CumulativeTFR plain(N_CHANS, 0, freqs, nTimes, Fs, WINDOW_LEN, STEP_LEN, segSec);
+		CumulativeTFR car(montage.getNumOutputs(), 0, freqs, nTimes, Fs, WINDOW_LEN, STEP_LEN, segSec);
+		car.setMontage(montage.getNumInputs(), montage.getTerms(), montage.getAverageTerms());
+
+		std::mt19937 rng(3);
+		std::normal_distribution<double> noise;
+		FFTWArrayType buffer(CumulativeTFR::getFFTLength(segSec, Fs));
+		std::vector<double> samples(int(segSec * Fs));
+		for (int chan = 0; chan < N_CHANS; chan++)
+		{
+			for (double& sample : samples)
+			{
+				sample = (chan + 1) * noise(rng);
+			}
+
+			// addTrial transforms the buffer in place
+			for (CumulativeTFR* tfr : { &plain, &car })
+			{
+				for (int i = 0; i < int(samples.size()); i++)
+				{
+					buffer.set(i, samples[i]);
+				}
+				tfr->addTrial(buffer, tfr == &car ? montage.getInputSlot(chan) : chan);
+			}
+		}
+		plain.finishTrial();
+		car.finishTrial();
+
+		double maxError = 0;
+		for (int f = 0; f < int(freqs.size()); f++)
+		{
+			for (int t = 0; t < nTimes; t++)
+			{
+				std::complex<double> mean;
+				for (int chan = 0; chan < N_CHANS; chan++)
+				{
+					mean += plain.getSpectra()[chan][f][t] / double(N_CHANS);
+				}
+				for (int chan = 0; chan < N_CHANS; chan++)
+				{
+					std::complex<double> expected = plain.getSpectra()[chan][f][t] - mean;
+					maxError = jmax(maxError, std::abs(car.getSpectra()[chan][f][t] - expected));
+				}
+			}
+		}
+		checkNear(maxError, 0, 1e-9, "CAR spectrum is the channel's minus the mean spectrum");
+
+		car.finishTrial({ true, true, false, true });
+		check(!car.isChannelValid(0) && !car.isChannelValid(3), "a masked input masks every CAR channel");
+	}
+
+	// A tapered band weights its centre frequency over its edges and still sums to 1
+	void testBandTapers()
+	{
+		std::vector<FrequencyBand> bands;
+		check(FrequencyBands::parse("theta 4-8, theta 4-8 hann, 4-8 Triangle", bands) && bands.size() == 3,
+			"bands parse with and without a taper");
+		check(bands[0].taper == FrequencyBand::TAPER_FLAT && bands[1].taper == FrequencyBand::TAPER_HANN
+			&& bands[2].taper == FrequencyBand::TAPER_TRIANGLE && bands[2].name == "4-8",
+			"taper follows the range");
+
+		std::vector<FrequencyBand> reparsed;
+		check(FrequencyBands::parse(FrequencyBands::toString(bands), reparsed) && reparsed.size() == 3
+			&& reparsed[1].taper == FrequencyBand::TAPER_HANN, "taper survives toString");
+
+		std::vector<double> freqs = { 3, 4, 5, 6, 7, 8, 9 };
+		std::vector<FrequencyBands::FreqWeights> weights = FrequencyBands::getWeights(bands, freqs);
+		for (int b = 0; b < 3; b++)
+		{
+			double total = 0;
+			std::vector<double> bandWeights(freqs.size());
+			for (int f = 0; f < int(freqs.size()); f++)
+			{
+				for (const auto& weight : weights[f])
+				{
+					if (weight.first == b)
+					{
+						bandWeights[f] = weight.second;
+						total += weight.second;
+					}
+				}
+			}
+			checkNear(total, 1, 1e-12, "band weights sum to 1");
+			if (b == 0)
+			{
+				checkNear(bandWeights[3], bandWeights[2], 1e-12, "flat band weights its inside frequencies equally");
+			}
+			else
+			{
+				check(bandWeights[3] > bandWeights[2] && bandWeights[2] > bandWeights[1],
+					"tapered band weights its centre over its edges");
+			}
+		}
+	}
+}
+
+int main()
+{
+	testPaddedGain();
+	testOffGridGain();
+	testPACResolvesCoupling();
+	testSlidingWindow();
+	testBaselineZScores();
+	testCommonAverage();
+	testBandTapers();
+	return finishTests("CumulativeTFRTest");
+}
@@ -0,0 +1,448 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+/*
+
+SampleIngest tests: the audio thread's path into the sample ring (SampleIngest::process, all of
+what CoherenceNode::process runs past reading its buffers) driven with synthetic blocks and TTL
+events under an allocation trap and, on Linux, a lock trap, through routing, resampling,
+artifacts, a break in a source's timestamps, event placement, waking the reader and dropped
+blocks, with its worst call time against the block's; and the coherence thread's wait for
+samples, including its CPU time against polling for them.
+
+*/
+
+#include "TestUtils.h"
+#include "SampleIngest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#if JUCE_LINUX
+#include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+#endif
+
+namespace
+{
+	// Set while code that has to be real-time safe runs on this thread
+	thread_local bool trapArmed = false;
+	std::atomic<int> nAllocations(0);
+	std::atomic<int> nLocks(0);
+
+	void* allocate(std::size_t size)
+	{
+		if (trapArmed)
+		{
+			nAllocations++;
+		}
+		void* memory = std::malloc(size > 0 ? size : 1);
+		if (memory == nullptr)
+		{
+			throw std::bad_alloc();
+		}
+		return memory;
+	}
+
+	void deallocate(void* memory)
+	{
+		if (trapArmed && memory != nullptr)
+		{
+			nAllocations++;
+		}
+		std::free(memory);
+	}
+}
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+void operator delete(void* memory) noexcept { deallocate(memory); }
+void operator delete[](void* memory) noexcept { deallocate(memory); }
+void operator delete(void* memory, std::size_t) noexcept { deallocate(memory); }
+void operator delete[](void* memory, std::size_t) noexcept { deallocate(memory); }
+
+#if JUCE_LINUX
+// Every mutex (JUCE's CriticalSection and WaitableEvent, std::mutex) goes through here
+namespace
+{
+	using MutexFunction = int (*)(pthread_mutex_t*);
+	MutexFunction nextMutexLock = nullptr;
+}
+
+extern "C" int pthread_mutex_lock(pthread_mutex_t* mutex)
+{
+	if (nextMutexLock == nullptr)
+	{
+		nextMutexLock = reinterpret_cast<MutexFunction>(dlsym(RTLD_NEXT, "pthread_mutex_lock"));
+	}
+	if (trapArmed)
+	{
+		nLocks++;
+	}
+	return nextMutexLock(mutex);
+}
+#endif
+
+namespace
+{
+	const double FS = 1000;
+	const int BLOCK_SAMPLES = 32; // at FS
+	const int RING_CAPACITY = 4096;
+
+	// Slot 0 is at the analysis rate, slot 1 twice as fast so it goes through a resampler
+	const double SLOT_RATES[] = { FS, 2 * FS };
+	const int N_SLOTS = 2;
+
+	// Input channel 0 goes to slot 0 and 2 to slot 1; channel 1 isn't routed
+	const SampleIngest::Route ROUTES[] = { { 0, 0 }, { 2, 1 } };
+	const int N_CHANNELS = 3;
+	const double CHANNEL_RATES[] = { FS, FS, 2 * FS };
+
+	// A TTL event comes this many samples into every EVENT_BLOCKS-th block
+	const int EVENT_BLOCKS = 10;
+	const int EVENT_OFFSET = 5;
+	const uint8 EVENT_DATA[] = { 3, 1 };
+	const int EVENT_SIZE = 2;
+
+	// process() has to take a small part of the time its block lasts
+	const double MAX_BLOCK_FRACTION = 0.1;
+
+	class ArmedScope
+	{
+	public:
+		ArmedScope() { trapArmed = true; }
+		~ArmedScope() { trapArmed = false; }
+	};
+
+	// The traps have to catch what they're for, or the other tests prove nothing
+	void testTrapsWork()
+	{
+		int allocationsBefore = nAllocations;
+		int locksBefore = nLocks;
+		std::mutex mutex;
+		{
+			ArmedScope armed;
+			delete new int(1);
+			mutex.lock();
+			mutex.unlock();
+		}
+		check(nAllocations > allocationsBefore, "allocation trap catches new and delete");
+#if JUCE_LINUX
+		check(nLocks > locksBefore, "lock trap catches a mutex");
+#else
+		ignoreUnused(locksBefore);
+#endif
+	}
+
+	struct IngestFixture
+	{
+		IngestFixture()
+			: ingest(ring, detectors)
+			, routes(ROUTES, ROUTES + N_SLOTS)
+			, samples(N_CHANNELS)
+			, channels(N_CHANNELS)
+			, withEvents(false)
+			, nEvents(0)
+			, maxSeconds(0)
+		{
+			ring.reset(N_SLOTS, RING_CAPACITY);
+			detectors.parse("step, rms 6");
+			detectors.build(Array<int>({ 0, 1 }));
+			ingest.reset(std::vector<double>(SLOT_RATES, SLOT_RATES + N_SLOTS), FS);
+
+			for (int chan = 0; chan < N_CHANNELS; chan++)
+			{
+				samples[chan].resize(size_t(BLOCK_SAMPLES * CHANNEL_RATES[chan] / FS));
+			}
+		}
+
+		// Fill block k of each channel with a 10 Hz sine, a step in channel 0 if artifact,
+		// and timestamps that jump forward from block jumpBlock on. With withEvents, every
+		// EVENT_BLOCKS-th block has an event timed on channel 0 (which wakes the reader).
+		void makeBlocks(int k, bool artifact = false, int jumpBlock = -1)
+		{
+			for (int chan = 0; chan < N_CHANNELS; chan++)
+			{
+				double rate = CHANNEL_RATES[chan];
+				int n = int(samples[chan].size());
+				int64 timestamp = int64(k) * n + (jumpBlock >= 0 && k >= jumpBlock ? int64(rate / 4) : 0);
+				for (int i = 0; i < n; i++)
+				{
+					samples[chan][i] = float(100 * std::sin(2 * double_Pi * 10 * (timestamp + i) / rate));
+				}
+				if (artifact && chan == 0)
+				{
+					samples[chan][n / 2] += 10000;
+				}
+				channels[chan] = { samples[chan].data(), n, timestamp };
+			}
+
+			nEvents = 0;
+			if (withEvents && k % EVENT_BLOCKS == 0)
+			{
+				SampleIngest::BlockEvent& event = events[nEvents++];
+				event.channel = nullptr;
+				event.timestamp = channels[0].timestamp + EVENT_OFFSET;
+				event.rate = CHANNEL_RATES[0];
+				event.size = EVENT_SIZE;
+				std::copy(EVENT_DATA, EVENT_DATA + EVENT_SIZE, event.data);
+			}
+		}
+
+		// CoherenceNode::process's call, with the traps armed, keeping the longest it took
+		int process()
+		{
+			using Clock = std::chrono::steady_clock;
+			ArmedScope armed;
+			auto start = Clock::now();
+			int nSamples = ingest.process(routes, channels.data(), N_CHANNELS, events, nEvents);
+			maxSeconds = jmax(maxSeconds, std::chrono::duration<double>(Clock::now() - start).count());
+			return nSamples;
+		}
+
+		SampleRing ring;
+		ArtifactDetectors detectors;
+		SampleIngest ingest;
+		std::vector<SampleIngest::Route> routes;
+		std::vector<std::vector<float>> samples;
+		std::vector<SampleIngest::ChannelBlock> channels;
+		bool withEvents;
+		SampleIngest::BlockEvent events[1];
+		int nEvents;
+		double maxSeconds;
+	};
+
+	void testRealTimeSafe()
+	{
+		IngestFixture fixture;
+		fixture.withEvents = true;
+		SampleRing& ring = fixture.ring;
+		int allocationsBefore = nAllocations;
+		int locksBefore = nLocks;
+
+		// The reader keeps up, asks to be woken for every block and takes the events
+		int nBlocks = 200;
+		int nEventsTaken = 0;
+		bool eventsPlaced = true;
+		for (int k = 0; k < nBlocks; k++)
+		{
+			fixture.makeBlocks(k, k % 50 == 25, 150);
+			ring.setWakeIndex(ring.getWriteIndex() + 1);
+			fixture.process();
+			ring.setReadIndex(ring.getWriteIndex());
+
+			SampleIngest::PendingEvent pending;
+			while (fixture.ingest.popEvent(pending))
+			{
+				// ring sample 0 is the first block's first sample, and before the jump channel 0's
+				// timestamps are ring positions
+				if (k < 150)
+				{
+					eventsPlaced = eventsPlaced && pending.position == int64(k) * BLOCK_SAMPLES + EVENT_OFFSET
+						&& pending.size == EVENT_SIZE && pending.data[0] == EVENT_DATA[0];
+				}
+				nEventsTaken++;
+			}
+		}
+		check(ring.getWriteIndex() > (nBlocks - 2) * BLOCK_SAMPLES, "blocks reach the ring");
+		check(fixture.ingest.getDroppedSamples() == 0, "nothing dropped while the reader keeps up");
+		check(nEventsTaken == nBlocks / EVENT_BLOCKS, "every event is queued for the coherence thread");
+		check(eventsPlaced, "events are placed in the ring by their timestamps");
+
+		// The audio thread has a block's time for everything, not just this node
+		double blockSeconds = BLOCK_SAMPLES / FS;
+		std::printf("longest process() call %.1f us of a %.0f ms block\n", fixture.maxSeconds * 1e6, blockSeconds * 1e3);
+		check(fixture.maxSeconds < MAX_BLOCK_FRACTION * blockSeconds, "process() takes a small part of its block's time");
+		check(fixture.ingest.getWorstBlockSeconds() > 0, "longest call is kept for the visualizer");
+		checkNear(fixture.ingest.getWorstBlockDuration(), blockSeconds, 1e-6, "with the time its block lasts");
+
+		// Then it stops reading, so blocks are dropped once the ring is full
+		for (int k = nBlocks; k < nBlocks + 2 * RING_CAPACITY / BLOCK_SAMPLES; k++)
+		{
+			fixture.makeBlocks(k, false, 150);
+			fixture.process();
+		}
+		check(fixture.ingest.getDroppedSamples() > 0, "blocks dropped once the ring is full");
+
+		// A source with a shorter block doesn't shorten the time dropped
+		int64 droppedBefore = fixture.ingest.getDroppedSamples();
+		fixture.makeBlocks(nBlocks + 2 * RING_CAPACITY / BLOCK_SAMPLES, false, 150);
+		fixture.channels[0].n /= 2;
+		fixture.process();
+		check(fixture.ingest.getDroppedSamples() - droppedBefore == BLOCK_SAMPLES,
+			"dropped time is the longest block's, at the analysis rate");
+
+		check(nAllocations == allocationsBefore, "no allocation while ingesting");
+		check(nLocks == locksBefore, "no lock taken while ingesting");
+	}
+
+	// Samples of the slot at the analysis rate come out as they went in
+	void testSamplesKept()
+	{
+		IngestFixture fixture;
+		for (int k = 0; k < 10; k++)
+		{
+			fixture.makeBlocks(k);
+			fixture.process();
+		}
+
+		const float* first;
+		const float* second;
+		int nFirst, nSecond;
+		fixture.ring.getSpans(0, 0, BLOCK_SAMPLES, first, nFirst, second, nSecond);
+		double maxError = 0;
+		for (int i = 0; i < nFirst; i++)
+		{
+			maxError = jmax(maxError, std::abs(first[i] - 100 * std::sin(2 * double_Pi * 10 * i / FS)));
+		}
+		checkNear(maxError, 0, 1e-3, "slot at the analysis rate is written unchanged");
+	}
+
+	// A reader waiting for 5 blocks sleeps through the first 4 and wakes on the 5th,
+	// long before its timeout
+	void testWaitBlocks()
+	{
+		using Clock = std::chrono::steady_clock;
+		const int N_WAIT_BLOCKS = 5;
+		const int TIMEOUT_MS = 10000;
+		const auto BLOCK_INTERVAL = std::chrono::milliseconds(20);
+
+		IngestFixture fixture;
+		SampleRing& ring = fixture.ring;
+		fixture.makeBlocks(0);
+		fixture.process();
+		int64 wakeIndex = ring.getWriteIndex() + N_WAIT_BLOCKS * BLOCK_SAMPLES;
+
+		std::atomic<bool> woken(false);
+		std::atomic<int64> writeIndexWoken(0);
+		std::thread reader([&]()
+		{
+			fixture.ingest.waitForSamples(wakeIndex, TIMEOUT_MS);
+			writeIndexWoken = ring.getWriteIndex();
+			woken = true;
+		});
+
+		bool wokeEarly = false;
+		int k = 1;
+		for (; ring.getWriteIndex() < wakeIndex; k++)
+		{
+			std::this_thread::sleep_for(BLOCK_INTERVAL);
+			wokeEarly = wokeEarly || woken;
+			fixture.makeBlocks(k);
+			fixture.process();
+		}
+		auto reached = Clock::now();
+		while (!woken && Clock::now() - reached < std::chrono::milliseconds(TIMEOUT_MS / 2))
+		{
+			std::this_thread::yield();
+		}
+		auto wakeDelay = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - reached);
+		reader.join();
+
+		check(!wokeEarly, "reader sleeps until the wake index");
+		check(writeIndexWoken >= wakeIndex, "reader wakes with the samples it asked for");
+		check(wakeDelay < BLOCK_INTERVAL * 5, "reader wakes as soon as the wake index is reached");
+	}
+
+#if JUCE_LINUX
+	double getThreadCpuSeconds()
+	{
+		timespec time;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+		return time.tv_sec + time.tv_nsec * 1e-9;
+	}
+
+	// CPU time a reader spends in wait(fixture, wakeIndex) while the blocks up to its wake index
+	// come in, one every 20 ms
+	double measureWaitCpu(void (*wait)(IngestFixture&, int64))
+	{
+		const int N_WAIT_BLOCKS = 10;
+		const auto BLOCK_INTERVAL = std::chrono::milliseconds(20);
+
+		IngestFixture fixture;
+		SampleRing& ring = fixture.ring;
+		fixture.makeBlocks(0);
+		fixture.process();
+		int64 wakeIndex = ring.getWriteIndex() + N_WAIT_BLOCKS * BLOCK_SAMPLES;
+
+		double cpuSeconds = 0;
+		std::thread reader([&]()
+		{
+			double start = getThreadCpuSeconds();
+			wait(fixture, wakeIndex);
+			cpuSeconds = getThreadCpuSeconds() - start;
+		});
+
+		for (int k = 1; ring.getWriteIndex() < wakeIndex; k++)
+		{
+			std::this_thread::sleep_for(BLOCK_INTERVAL);
+			fixture.makeBlocks(k);
+			fixture.process();
+		}
+		reader.join();
+		return cpuSeconds;
+	}
+
+	// Sleeping in waitForSamples costs the coherence thread next to nothing, where checking for
+	// samples in a loop (as it did with hasUpdate) spins a core for the whole wait
+	void testWaitCpuTime()
+	{
+		double waitingSeconds = measureWaitCpu([](IngestFixture& fixture, int64 wakeIndex)
+		{
+			fixture.ingest.waitForSamples(wakeIndex, 10000);
+		});
+		double pollingSeconds = measureWaitCpu([](IngestFixture& fixture, int64 wakeIndex)
+		{
+			while (fixture.ring.getWriteIndex() < wakeIndex) {}
+		});
+
+		std::printf("reader CPU time waiting for 10 blocks: %.2f ms in waitForSamples, %.2f ms polling\n",
+			waitingSeconds * 1e3, pollingSeconds * 1e3);
+		check(waitingSeconds < 0.1 * pollingSeconds, "waiting for samples takes a fraction of the CPU time of polling");
+	}
+#endif
+}
+
+int main()
+{
+#if JUCE_LINUX
+	nextMutexLock = reinterpret_cast<MutexFunction>(dlsym(RTLD_NEXT, "pthread_mutex_lock"));
+#endif
+	testTrapsWork();
+	testRealTimeSafe();
+	testSamplesKept();
+	testWaitBlocks();
+#if JUCE_LINUX
+	testWaitCpuTime();
+#endif
+	return finishTests("SampleIngestTest");
+}
@@ -0,0 +1,75 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef TEST_UTILS_H_INCLUDED
+#define TEST_UTILS_H_INCLUDED
+
+/*
+
+Test Utils - checks for the standalone tests. A failed check prints what was expected and
+counts towards main's return value, so one run reports every failure.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <cstdio>
+
+inline int& getNumFailures()
+{
+	static int nFailures = 0;
+	return nFailures;
+}
+
+// Returns condition, printing the description if it's false
+inline bool check(bool condition, const char* description)
+{
+	if (!condition)
+	{
+		std::printf("FAILED: %s\n", description);
+		getNumFailures()++;
+	}
+	return condition;
+}
+
+// Check that value is within tolerance of expected, printing both if it isn't
+inline bool checkNear(double value, double expected, double tolerance, const char* description)
+{
+	bool near = std::abs(value - expected) <= tolerance;
+	if (!near)
+	{
+		std::printf("FAILED: %s (got %g, expected %g +/- %g)\n", description, value, expected, tolerance);
+		getNumFailures()++;
+	}
+	return near;
+}
+
+// Print the result and return main's exit code
+inline int finishTests(const char* name)
+{
+	std::printf("%s: %d failure(s)\n", name, getNumFailures());
+	return getNumFailures() > 0 ? 1 : 0;
+}
+
+#endif // TEST_UTILS_H_INCLUDED